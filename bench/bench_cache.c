@@ -0,0 +1,187 @@
+/**
+ * @file bench_cache.c
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Microbenchmark of the lookups of the caches
+ *
+ * Fills caches of increasing sizes, with every policy, and times lookups of
+ * random documents that are all cached, so every lookup is a hit. The time
+ * of a linear search over an array of identifiers of the same size, which
+ * is what finding a slot cost before the map, is shown next to it. The
+ * documents are written to a temporary storage first, and every hit is
+ * checked against it.
+ *
+ * The caches report every lookup on the standard output, so it is sent to
+ * /dev/null while they run and the results go to the standard error.
+ *
+ * Usage: ./bin/bench_cache [max_size]
+ */
+
+#include "cache.h"
+#include "storage.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_MAX 65536 /**< Size of the largest cache */
+#define LOOKUPS 200000    /**< Lookups timed per cache */
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Time of a lookup by linear search, in nanoseconds
+ */
+static double bench_scan(int size, const int *targets) {
+    int *identifiers = (int *)malloc(size * sizeof(int));
+    if (identifiers == NULL) {
+        return 0;
+    }
+
+    for (int i = 0; i < size; i++) {
+        identifiers[i] = i;
+    }
+
+    // fewer lookups, a search over a big cache takes long
+    int lookups = LOOKUPS / 10;
+    volatile int found = 0;
+
+    double start = now_ms();
+    for (int n = 0; n < lookups; n++) {
+        int i = 0;
+        for (; i < size && identifiers[i] != targets[n]; i++)
+            ;
+        found += i;
+    }
+    double elapsed = now_ms() - start;
+
+    free(identifiers);
+
+    return elapsed * 1e6 / lookups;
+}
+
+/**
+ * @brief Time of a hit of a cache, in nanoseconds, -1 if a hit was wrong
+ */
+static double bench_policy(Cache_Type type, int size, Storage *storage,
+                           const int *targets) {
+    Cache *cache = cache_start(size, type, storage);
+    if (cache == NULL) {
+        return -1;
+    }
+
+    Document doc;
+    for (int id = 0; id < size; id++) {
+        if (storage_get(storage, id, &doc) != NULL) {
+            cache_add_document(cache, id, &doc);
+        }
+    }
+
+    int wrong = 0;
+    double start = now_ms();
+    for (int n = 0; n < LOOKUPS; n++) {
+        Document *hit = cache_get_document(cache, targets[n]);
+        if (hit == NULL) {
+            wrong++;
+        }
+        destroy_document(hit);
+    }
+    double elapsed = now_ms() - start;
+
+    // every document must be the one in the storage
+    for (int n = 0; n < LOOKUPS && wrong == 0; n += 97) {
+        Document *hit = cache_get_document(cache, targets[n]);
+        storage_get(storage, targets[n], &doc);
+        if (hit == NULL || strcmp(hit->title, doc.title) != 0 ||
+            strcmp(hit->path, doc.path) != 0) {
+            wrong++;
+        }
+        destroy_document(hit);
+    }
+
+    cache_destroy(cache);
+
+    return wrong == 0 ? elapsed * 1e6 / LOOKUPS : -1;
+}
+
+int main(int argc, char *argv[]) {
+    int max_size = DEFAULT_MAX;
+    if (argc > 1) {
+        max_size = atoi(argv[1]);
+    }
+
+    if (max_size <= 0) {
+        fprintf(stderr, "usage: %s [max_size]\n", argv[0]);
+        return 1;
+    }
+
+    char dir[] = "/tmp/bench_cache_XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    char heap_path[64], table_path[64];
+    snprintf(heap_path, sizeof(heap_path), "%s/metadata.bin", dir);
+    snprintf(table_path, sizeof(table_path), "%s/offsets.bin", dir);
+
+    Storage *storage = storage_open(heap_path, table_path, 1, 0, NULL, NULL);
+    int *targets = (int *)malloc(LOOKUPS * sizeof(int));
+    if (storage == NULL || targets == NULL) {
+        fprintf(stderr, "can't create the storage\n");
+        storage_close(storage);
+        rmdir(dir);
+        return 1;
+    }
+
+    Document doc;
+    memset(&doc, 0, sizeof(Document));
+    for (int id = 0; id < max_size; id++) {
+        snprintf(doc.title, sizeof(doc.title), "document %d", id);
+        snprintf(doc.path, sizeof(doc.path), "%d.txt", id);
+        storage_write(storage, id, &doc, 1);
+    }
+
+    // the caches write to the standard output on every lookup
+    fflush(stdout);
+    int null = open("/dev/null", O_WRONLY);
+    if (null != -1) {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+
+    fprintf(stderr, "%d lookups per cache, all hits, time of a lookup\n",
+            LOOKUPS);
+    fprintf(stderr, "%-10s %12s %12s %12s %12s\n", "size", "fifo (ns)",
+            "rand (ns)", "lru (ns)", "scan (ns)");
+
+    srand(42);
+    for (int size = 64; size <= max_size; size *= 4) {
+        for (int n = 0; n < LOOKUPS; n++) {
+            targets[n] = rand() % size;
+        }
+
+        double fifo = bench_policy(FIFO, size, storage, targets);
+        double rand_ = bench_policy(RAND, size, storage, targets);
+        double lru = bench_policy(LRU, size, storage, targets);
+        double scan = bench_scan(size, targets);
+
+        fprintf(stderr, "%-10d %12.1f %12.1f %12.1f %12.1f%s\n", size, fifo,
+                rand_, lru, scan,
+                fifo < 0 || rand_ < 0 || lru < 0 ? "  MISMATCH" : "");
+    }
+
+    free(targets);
+    storage_close(storage);
+    unlink(heap_path);
+    unlink(table_path);
+    rmdir(dir);
+
+    return 0;
+}
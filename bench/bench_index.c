@@ -0,0 +1,117 @@
+/**
+ * @file bench_index.c
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Microbenchmark of the enumeration of the index table
+ *
+ * Fills index tables with different densities of valid documents and times
+ * it_get_valid_ids() against a check of every identifier with
+ * it_entry_is_valid(), which is what enumerating the table bit by bit costs.
+ * Both fill an array with the identifiers found. Walking the table with a
+ * cursor (it_iter_next()), which allocates nothing, is timed too. Every
+ * density is run with
+ * both representations of the table, and the size of their snapshot (what
+ * they take in the control file) is shown too.
+ *
+ * Usage: ./bin/bench_index [nr_ids]
+ */
+
+#include "index_table.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_IDS 10000000 /**< Identifiers of each table */
+#define ROUNDS 5             /**< Enumerations timed per table */
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Times both enumerations of a table with one valid id in every step
+ */
+static void bench_density(unsigned nr_ids, unsigned step, Table_Type type) {
+    Index_Table *it = it_create(type);
+    if (it == NULL) {
+        return;
+    }
+
+    for (unsigned id = 0; id < nr_ids; id += step) {
+        it_add_entry(it, id);
+    }
+    // the last identifier fixes the size of the table
+    it_add_entry(it, nr_ids - 1);
+
+    double words = 0, bits = 0, walk = 0;
+    unsigned found = 0, checked = 0, walked = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now_ms();
+        int *ids = it_get_valid_ids(it);
+        found = 0;
+        for (unsigned i = 0; ids != NULL && ids[i] != -1; i++) {
+            found++;
+        }
+        free(ids);
+        words += now_ms() - start;
+
+        start = now_ms();
+        ids = (int *)malloc((it_size(it) + 1) * sizeof(int));
+        checked = 0;
+        for (unsigned id = 0; ids != NULL && id < nr_ids; id++) {
+            if (it_entry_is_valid(it, id)) {
+                ids[checked++] = id;
+            }
+        }
+        free(ids);
+        bits += now_ms() - start;
+
+        start = now_ms();
+        It_Iter iter;
+        it_iter_begin(it, 0, INT_MAX, &iter);
+        walked = 0;
+        while (it_iter_next(&iter) != -1) {
+            walked++;
+        }
+        walk += now_ms() - start;
+    }
+
+    printf("%-8s 1/%-8u %10u %12.2f %12.2f %8.1fx %12.2f %12zu%s\n",
+           type == TABLE_ROARING ? "roaring" : "bitmap", step, found,
+           words / ROUNDS, bits / ROUNDS, words > 0 ? bits / words : 0,
+           walk / ROUNDS, it_snapshot(it, NULL),
+           found == checked && found == walked && found == it_size(it)
+               ? ""
+               : "  MISMATCH");
+
+    it_destroy(it);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned nr_ids = DEFAULT_IDS;
+    if (argc > 1) {
+        nr_ids = (unsigned)atoi(argv[1]);
+    }
+
+    if (nr_ids == 0) {
+        fprintf(stderr, "usage: %s [nr_ids]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%u identifiers, average of %d rounds\n", nr_ids, ROUNDS);
+    printf("%-8s %-10s %10s %12s %12s %9s %12s %12s\n", "table", "density",
+           "valid", "list (ms)", "check (ms)", "speedup", "walk (ms)",
+           "bytes");
+
+    unsigned steps[] = {1, 2, 64, 1000, 100000};
+    for (unsigned i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        bench_density(nr_ids, steps[i], TABLE_BITMAP);
+        bench_density(nr_ids, steps[i], TABLE_ROARING);
+    }
+
+    return 0;
+}
@@ -15,6 +15,7 @@
 #define CACHE_H
 
 #include "document.h"
+#include "storage.h"
 
 /**
  * @brief Opaque cache structure
@@ -41,14 +42,15 @@ typedef enum {
  *
  * @param cache_size Maximum number of documents in cache
  * @param type Replacement strategy to use
- * @param source File descriptor to get documents from
+ * @param source Storage to get documents from on cache misses
  * @return Cache instance pointer
  * @retval NULL If initialization fails (invalid parameters or allocation error)
  *
  * @note Actual implementation is strategy-specific
  * @note Allocates resources that must be freed with cache_destroy()
  */
-Cache *cache_start(int cache_size, Cache_Type type, int source);
+Cache *cache_start(int cache_size, Cache_Type type,
+                   const Storage *source);
 
 /**
  * @brief Releases all cache resources
@@ -69,6 +71,8 @@ void cache_destroy(Cache *cache);
  * @retval NULL If not found or invalid cache
  *
  * @note Delegates to strategy-specific implementation
+ * @note Safe to call from several threads, every operation on the cache
+ *       holds its lock
  */
 Document *cache_get_document(Cache *cache, int identifier);
 
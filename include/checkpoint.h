@@ -0,0 +1,97 @@
+/**
+ * @file checkpoint.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Snapshots of the index table and the free list
+ *
+ * A checkpoint (CONTROL_FILE) holds a versioned header followed by the free
+ * list, the index table and the secondary indexes, in the formats of
+ * fl_snapshot(), it_snapshot() and mi_snapshot(). The whole file is built in memory and written with a
+ * single write to a temporary file, synced and renamed over the previous
+ * checkpoint, so there is always a complete one on the disk. Loading it
+ * takes a single read, so restarting is bound by the bandwidth of the
+ * disk and not by the number of system calls.
+ *
+ * Control files written before the header existed, or before the secondary
+ * indexes (or their paths) were saved, are still loaded, without the
+ * indexes. When there is
+ * no control file at all, checkpoint_rebuild() recovers the free list and
+ * the index table from the state of the records of the metadata file.
+ *
+ * @example Checkpoint usage:
+ * @code
+ * checkpoint_write(CONTROL_FILE, fl, it, mi);
+ *
+ * Free_List *fl = NULL;
+ * Index_Table *it = NULL;
+ * Meta_Index *mi = NULL;
+ * checkpoint_load(CONTROL_FILE, TABLE_BITMAP, &fl, &it, &mi);  // empty if there is no file
+ * @endcode
+ *
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "free_list.h"
+#include "index_table.h"
+#include "meta_index.h"
+#include "storage.h"
+
+#define CHECKPOINT_MAGIC 0x54504B43u /**< First bytes of a checkpoint ("CKPT") */
+#define CHECKPOINT_VERSION 3         /**< Version of the checkpoint format */
+
+/**
+ * @brief Writes a checkpoint and replaces the previous one
+ *
+ * @param path Path of the checkpoint
+ * @param fl Free list to save
+ * @param it Index table to save
+ * @param mi Secondary indexes to save
+ * @retval 0 Checkpoint was written and synced
+ * @retval -1 Error writing, the previous checkpoint is kept
+ */
+int checkpoint_write(const char *path, const Free_List *fl,
+                     const Index_Table *it, const Meta_Index *mi);
+
+/**
+ * @brief Loads the latest checkpoint
+ *
+ * @param path Path of the checkpoint
+ * @param type Representation of the index table, a checkpoint of the
+ *             other one is converted
+ * @param[out] fl Receives the free list
+ * @param[out] it Receives the index table
+ * @param[out] mi Receives the secondary indexes, NULL if the checkpoint
+ *                is older than them
+ * @retval 0 Structures were loaded
+ * @retval 1 There is no checkpoint, the structures are empty
+ * @retval -1 Checkpoint is damaged or can't be read
+ *
+ * @note The structures must be released with fl_destroy(), it_destroy()
+ *       and mi_destroy()
+ */
+int checkpoint_load(const char *path, Table_Type type, Free_List **fl,
+                    Index_Table **it, Meta_Index **mi);
+
+/**
+ * @brief Rebuilds the index table and the free list from the metadata file
+ *
+ * The identifiers are split in `threads` contiguous ranges, and every
+ * thread scans the records of its range with storage_scan(). Identifiers
+ * with a live record are valid, every other one below storage_count() is
+ * free.
+ *
+ * @param storage Metadata file to scan
+ * @param threads Number of threads scanning it
+ * @param type Representation of the index table
+ * @param[out] fl Receives the free list
+ * @param[out] it Receives the index table
+ * @retval 0 Structures were rebuilt
+ * @retval -1 Error reading the metadata file or allocating memory
+ *
+ * @note The structures must be released with fl_destroy() and it_destroy()
+ */
+int checkpoint_rebuild(const Storage *storage, unsigned threads,
+                       Table_Type type, Free_List **fl, Index_Table **it);
+
+#endif /* CHECKPOINT_H */
@@ -15,6 +15,8 @@
 
 #include "defs.h"
 
+#include <stddef.h>
+
 /**
  * @brief Determines the operation type from a string
  * 
@@ -47,8 +49,37 @@ int define_request(Request *request, int argc, char **argv);
  * Formats and prints the server's response in an operation-specific manner.
  * 
  * @param op Operation type that was originally requested
- * @param reply Pointer to the server's reply data
+ * @param reply Payload of the reply frame
+ * @param length Number of bytes of the payload
+ */
+void show_reply(Operation op, const char *reply, size_t length);
+
+/**
+ * @brief Displays one frame of a streamed LIST_WORD reply
+ * 
+ * The identifiers of every frame are printed as they arrive, as a single
+ * list that is closed by the last frame.
+ * 
+ * @param reply Payload of the frame
+ * @param length Number of bytes of the payload
+ * @param first Set on the first frame of the stream
+ * @param last Set on the last frame of the stream
+ */
+void show_list_batch(const char *reply, size_t length, int first, int last);
+
+/**
+ * @brief Splits a command line into arguments
+ * 
+ * Breaks a line such as `-a "title" "authors" 1997 path` into separate
+ * arguments, in place. Single and double quotes group words together.
+ * The first slot of the result is left for the program name, so the
+ * output can be handed to define_request() directly.
+ * 
+ * @param line Line to split (modified in place)
+ * @param[out] argv Array that receives the arguments
+ * @param max_args Capacity of argv
+ * @return Number of slots used in argv (program name included)
  */
-void show_reply(Operation op, const void *reply);
+int split_command(char *line, char **argv, int max_args);
 
 #endif /* CLIENT_OPS_H */
\ No newline at end of file
@@ -20,21 +20,38 @@
 #define SERVER_FIFO "tmp/server_fifo"    /**< Server's receiving FIFO path */
 #define CLIENT_FIFO "tmp/client_fifo"    /**< Client's receiving FIFO path */
 
+/* Unix domain socket path */
+#define SERVER_SOCKET "tmp/server_socket" /**< Server's listening socket path */
+
+/* Shared memory object name */
+#define SERVER_SHM "/dserver_shm"        /**< Server's shared memory region */
+
 /* Data storage files */
 #define STORAGE_FILE "tmp/metadata.bin"          /**< Main data storage file */
+#define STORAGE_TABLE "tmp/metadata_offsets.bin" /**< Offset of each record in the storage file */
 #define CONTROL_FILE "tmp/metadata_control.bin"  /**< Control file for synchronization */
+#define WAL_FILE "tmp/metadata_wal.bin"          /**< Changes since the control file was written */
+#define WAL_OLD_FILE "tmp/metadata_wal_old.bin"  /**< Changes being saved by a checkpoint */
 
 /* Logging file */
 #define REQUESTS_LOG "tmp/requests.log"  /**< Server request log file path */
 
 /* System constants */
 #define BLOCK_SIZE 8                     /**< Basic I/O block size in bytes */
+#define MAX_SESSIONS 64                  /**< Maximum number of open client sessions */
+#define DEFAULT_WORKERS 4                /**< Worker processes started by default */
+#define DEFAULT_SYNC_EVERY 64            /**< Log records written between calls to fsync() */
+#define DEFAULT_CHECKPOINT_EVERY 10000   /**< Changes between checkpoints */
+#define CHECKPOINT_SECONDS 60            /**< Longest time between checkpoints while changes arrive */
+#define DEFAULT_RECOVERY_THREADS 4       /**< Threads scanning metadata.bin when the control file is missing */
+#define MAX_SEARCH_PROCS 256             /**< Most processes of a keyword listing */
 
 /* Field size definitions */
-#define TITLE_SIZE 200   /**< Maximum length for title field (including null terminator) */
+#define TITLE_SIZE 512   /**< Maximum length for title field (including null terminator) */
 #define AUTHORS_SIZE 200 /**< Maximum length for authors field (including null terminator) */
 #define YEAR_SIZE 4      /**< Size for year field (format YYYY + null terminator) */
-#define PATH_SIZE 64     /**< Maximum length for file path field */
+#define PATH_SIZE 256    /**< Maximum length for file path field */
+#define KEYWORD_SIZE 200 /**< Maximum length for a search keyword */
 
 /**
  * @brief Enumeration of supported operations
@@ -48,23 +65,41 @@ typedef enum {
     COUNT_WORD,     /**< Count occurrences of a word in a document */
     LIST_WORD,      /**< List documents containing a word */
     SHUTDOWN,       /**< Graceful server shutdown */
-    KILL           /**< Tell the server, child work is done */
+    KILL,           /**< Retired, children are reaped through SIGCHLD */
+    SESSION_OPEN,   /**< Keep the client FIFO open for several requests */
+    SESSION_CLOSE,  /**< End a session, the server closes the client FIFO */
+    INDEX_BULK,     /**< Index a batch of documents */
+    COMPACT,        /**< Rewrite metadata.bin without the dead records */
+    QUERY_AUTHOR,   /**< List the documents of an author */
+    QUERY_YEAR,     /**< List the documents of a range of years */
+    LOOKUP_PATH     /**< Find the document indexed with a path */
 } Operation;
 
 /**
  * @brief Request structure for client-server communication
  * 
- * This structure represents the complete request format sent from clients to
- * the server through the FIFO. All fields must be properly filled according
- * to the operation type.
+ * Decoded form of a request, as used by the client and the server. On the
+ * wire, requests are sent as frames (see protocol.h) and only the fields of
+ * the requested operation travel.
  */
 typedef struct {
-    pid_t client;               /**< Client process ID for response routing */
-    Operation operation;        /**< Requested operation type */
-    char title[TITLE_SIZE];     /**< Document title field, Document ID, Keyword */
-    char authors[AUTHORS_SIZE]; /**< Document authors field, Keyword, Number of processes */
-    char year[YEAR_SIZE];       /**< Document publication year */
-    char path[PATH_SIZE];       /**< Document file path */
+    pid_t client;                   /**< Client process ID for response routing */
+    Operation operation;            /**< Requested operation type */
+    unsigned sequence;              /**< Request id chosen by the client */
+    int legacy;                     /**< Request arrived in the old fixed format */
+    int key;                        /**< Document ID (REMOVE, CONSULT, COUNT_WORD), first year (QUERY_YEAR) */
+    int key_last;                   /**< Last year (QUERY_YEAR) */
+    int n_procs;                    /**< Number of processes (LIST_WORD) */
+    char keyword[KEYWORD_SIZE];     /**< Keyword (COUNT_WORD, LIST_WORD) */
+    char title[TITLE_SIZE];         /**< Document title (INDEX) */
+    char authors[AUTHORS_SIZE];     /**< Document authors (INDEX), one author (QUERY_AUTHOR) */
+    char year[YEAR_SIZE];           /**< Document publication year (INDEX) */
+    char path[PATH_SIZE];           /**< Document file path (INDEX, LOOKUP_PATH) */
+    unsigned flags;                 /**< Frame flags (see protocol.h) */
+    int channel;                    /**< Connection the reply goes back on, -1 to use the client FIFO */
+    void *ring;                     /**< Shared memory ring the reply goes to, NULL otherwise */
+    unsigned n_records;             /**< Number of documents (INDEX_BULK) */
+    void *records;                  /**< Array of Document (INDEX_BULK) */
 } Request;
 
 #endif /* DEFS_H */
\ No newline at end of file
@@ -12,6 +12,7 @@
 #define FIFO_CACHE_H
 
 #include "document.h"
+#include "storage.h"
 
 /**
  * @brief Opaque FIFO cache structure
@@ -24,13 +25,13 @@ typedef struct fifo FIFO_Cache;
  * @brief Creates a new FIFO cache instance
  * 
  * @param cache_size Maximum number of documents the cache can hold
- * @param source File descriptor for the file source
+ * @param source Storage of the metadata, read on cache misses
  * @return Pointer to initialized FIFO cache
  * @retval NULL If memory allocation fails or cache_size ≤ 0
  * 
  * @note Allocates resources that must be freed with fifoc_destroy()
  */
-void *fifoc_create(int cache_size, int source);
+void *fifoc_create(int cache_size, const Storage *source);
 
 /**
  * @brief Destroys a FIFO cache instance
@@ -4,21 +4,25 @@
  * @brief Free list implementation for managing available space in a file
  * system.
  *
- * The free list maintains a linked list of available (free) identifiers
+ * The free list maintains the set of available (free) identifiers
  * corresponding to a position in a file, enabling efficient space management
- * for file systems or storage systems.
+ * for file systems or storage systems. It is a contiguous bitmap with a bit
+ * per identifier, so adding and removing an identifier never allocates, and
+ * the next identifier given is always the lowest free one, which keeps the
+ * live records packed at the start of the file.
  *
  * @note All create/destroy operations should be paired:
  *       - fl_create() must be matched with fl_destroy()
  *       - fl_upload() must be matched with fl_destroy()
+ *       - fl_restore() must be matched with fl_destroy()
  *
  * @example Free_List usage:
  * @code
  * Free_List *fl = fl_create();
- * fl_push(fl, 1);  // Add ID 1
  * fl_push(fl, 2);  // Add ID 2
+ * fl_push(fl, 1);  // Add ID 1
  *
- * int id = fl_pop(fl);  // Retrieve next available identifier
+ * int id = fl_pop(fl);  // Lowest available identifier, 1
  *
  * fl_destroy(fl);  // Clean up
  * @endcode
@@ -34,8 +38,8 @@
 /**
  * @brief Opaque structure representing a Free List
  *
- * The Free_List maintains a collection of available 
- * file identifiers in a LIFO (stack) order.
+ * The Free_List maintains a collection of available
+ * file identifiers, given back lowest first.
  */
 typedef struct free_list Free_List;
 
@@ -68,11 +72,13 @@ void fl_destroy(Free_List *fl);
  * @retval 0 on success
  * @retval 1 on memory allocation error
  * @retval -1 on invalid input (NULL fl or invalid id)
+ *
+ * @note Adding an identifier that is already available has no effect
  */
 int fl_push(Free_List *fl, int id);
 
 /**
- * @brief Removes and returns the next available file identifier
+ * @brief Removes and returns the lowest available file identifier
  *
  * @param fl Pointer to the Free List
  * @return The available file identifier
@@ -82,6 +88,19 @@ int fl_push(Free_List *fl, int id);
  */
 int fl_pop(Free_List *fl);
 
+/**
+ * @brief Removes a given identifier from the Free List
+ *
+ * @param fl Pointer to the Free List
+ * @param id File identifier that is no longer available
+ * @return Operation status
+ * @retval 0 if the identifier was removed
+ * @retval -1 if fl is NULL or the identifier is not in the list
+ *
+ * @note Constant time
+ */
+int fl_remove(Free_List *fl, int id);
+
 /**
  * @brief Returns the current number of available identifiers
  *
@@ -132,4 +151,27 @@ Free_List *fl_upload(int file);
  */
 void fl_record(const Free_List *fl, int file);
 
+/**
+ * @brief Copies a Free List to memory, in the format of fl_record()
+ *
+ * @param fl Pointer to the Free List
+ * @param[out] out Buffer that receives the copy, NULL to only get its size
+ * @return Number of bytes of the copy
+ */
+size_t fl_snapshot(const Free_List *fl, void *out);
+
+/**
+ * @brief Rebuilds a Free List from a copy made by fl_snapshot()
+ *
+ * @param data Start of the copy
+ * @param size Bytes available at data
+ * @param[out] used Receives the number of bytes of the copy
+ * @return Pointer to the rebuilt Free List
+ * @retval NULL If the copy is cut short or memory allocation fails
+ *
+ * @note An empty copy (size 0) gives an empty list
+ * @note Must be paired with fl_destroy()
+ */
+Free_List *fl_restore(const void *data, size_t size, size_t *used);
+
 #endif
\ No newline at end of file
@@ -3,19 +3,43 @@
  * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
  * @brief Compact bit-based index table for tracking file validity
  *
- * Implements a space-efficient index table where each bit in a character array
- * represents the validity status of a corresponding file. This provides:
+ * Implements a space-efficient index table where each bit in an array of
+ * 64-bit words represents the validity status of a corresponding file. This
+ * provides:
  * - O(1) validity checks
  * - Minimal memory usage (1 bit per file)
  * - Compact disk storage format
+ * - Enumeration a word at a time, skipping empty words and finding the
+ *   valid bits of a word with count-trailing-zeros
+ *
+ * A table of type TABLE_ROARING keeps the valid bits in a compressed
+ * table instead (see roaring_table.h), whose size follows the number of
+ * valid files rather than the highest identifier ever valid. The type is
+ * chosen when the table is created, and a copy of one type is converted
+ * when restored as the other.
+ *
+ * A range of identifiers is walked with a cursor that lives in the caller,
+ * without allocating, and it_partition() splits the identifiers in ranges
+ * with the same number of valid files:
+ * @code
+ * int bounds[5];
+ * it_partition(it, 4, bounds);
+ *
+ * It_Iter iter;
+ * it_iter_begin(it, bounds[1], bounds[2], &iter);  // second quarter
+ * for (int id = it_iter_next(&iter); id != -1; id = it_iter_next(&iter)) {
+ *     // id is valid
+ * }
+ * @endcode
  *
  * @note All create/destroy operations should be paired:
  *       - it_create() must be matched with it_destroy()
  *       - it_upload() must be matched with it_destroy()
+ *       - it_restore() must be matched with it_destroy()
  *
  * @example Basic usage:
  * @code
- * Index_Table *it = it_create();
+ * Index_Table *it = it_create(TABLE_BITMAP);
  * it_add_entry(it, 42);    // Mark file ID 42 as valid
  * 
  * if (it_entry_is_valid(it, 42)) {
@@ -31,6 +55,7 @@
 #define INDEX_TABLE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 
 /**
@@ -43,16 +68,39 @@
  */
 typedef struct index_table Index_Table;
 
+/**
+ * @brief Cursor over the valid identifiers of a range
+ *
+ * Kept by the caller, usually on the stack. The fields are only used by
+ * it_iter_begin() and it_iter_next().
+ */
+typedef struct {
+    const Index_Table *it;  /**< Table being walked */
+    int next;               /**< First identifier not loaded in bits */
+    int end;                /**< First identifier after the range */
+    int base;               /**< Identifier of the lowest bit of bits */
+    uint64_t bits;          /**< Valid identifiers loaded and not returned */
+} It_Iter;
+
+/**
+ * @brief Representations of the valid bits
+ */
+typedef enum {
+    TABLE_BITMAP,   /**< One bit per identifier, up to the highest one */
+    TABLE_ROARING   /**< Compressed containers of 65536 identifiers */
+} Table_Type;
+
 /**
  * @brief Creates a new empty index table
  *
+ * @param type Representation of the valid bits
  * @return Pointer to a newly allocated index table
  * @retval NULL if memory allocation fails
  *
  * @note Initializes all bits to 0 (invalid)
  * @note Must be paired with it_destroy()
  */
-Index_Table *it_create(void);
+Index_Table *it_create(Table_Type type);
 
 /**
  * @brief Destroys an index table and releases all resources
@@ -133,13 +181,15 @@ void it_show(const Index_Table *it);
 /**
  * @brief Loads an index table from a file
  *
- * @param file Open file descriptor to read from
+ * @param file Open file descriptor to read from, the table is the rest
+ *             of the file
+ * @param type Representation of the loaded table
  * @return Pointer to the loaded index table
  * @retval NULL on read error or invalid input
  *
  * @note Must be paired with it_destroy()
  */
-Index_Table *it_upload(int file);
+Index_Table *it_upload(int file, Table_Type type);
 
 /**
  * @brief Saves an index table to a file
@@ -151,6 +201,32 @@ Index_Table *it_upload(int file);
  */
 void it_record(const Index_Table *it, int file);
 
+/**
+ * @brief Copies an index table to memory, in the format of it_record()
+ *
+ * @param it Pointer to the index table
+ * @param[out] out Buffer that receives the copy, NULL to only get its size
+ * @return Number of bytes of the copy
+ */
+size_t it_snapshot(const Index_Table *it, void *out);
+
+/**
+ * @brief Rebuilds an index table from a copy made by it_snapshot()
+ *
+ * @param data Start of the copy
+ * @param size Bytes available at data
+ * @param type Representation of the rebuilt table, converted if the copy
+ *             is of the other type
+ * @param[out] used Receives the number of bytes of the copy
+ * @return Pointer to the rebuilt index table
+ * @retval NULL If the copy is cut short or memory allocation fails
+ *
+ * @note An empty copy (size 0) gives an empty table
+ * @note Must be paired with it_destroy()
+ */
+Index_Table *it_restore(const void *data, size_t size, Table_Type type,
+                        size_t *used);
+
 /**
  * @brief Retrieves array of all valid file IDs
  *
@@ -163,4 +239,40 @@ void it_record(const Index_Table *it, int file);
  */
 int *it_get_valid_ids(const Index_Table *it);
 
+/**
+ * @brief Starts a cursor over the valid IDs of a range
+ *
+ * @param it Pointer to the index table
+ * @param start First ID of the range
+ * @param end First ID after the range, INT_MAX for the rest of the table
+ * @param[out] iter Cursor to start
+ *
+ * @note The table must not change while the cursor is in use
+ */
+void it_iter_begin(const Index_Table *it, int start, int end, It_Iter *iter);
+
+/**
+ * @brief Moves a cursor to the next valid ID of its range
+ *
+ * @param iter Cursor started by it_iter_begin()
+ * @return Next valid ID, in increasing order
+ * @retval -1 If there are no more valid IDs in the range
+ */
+int it_iter_next(It_Iter *iter);
+
+/**
+ * @brief Splits the IDs in ranges with the same number of valid IDs
+ *
+ * Range i goes from bounds[i] to bounds[i + 1] (excluded). The first one
+ * starts at 0 and the last one ends at INT_MAX. When there are fewer valid
+ * IDs than ranges, the last ranges are empty.
+ *
+ * @param it Pointer to the index table
+ * @param parts Number of ranges
+ * @param[out] bounds Receives parts + 1 bounds
+ * @retval 0 Bounds were filled
+ * @retval -1 Invalid input
+ */
+int it_partition(const Index_Table *it, unsigned parts, int *bounds);
+
 #endif
\ No newline at end of file
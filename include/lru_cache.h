@@ -12,6 +12,7 @@
 #define LRU_CACHE_H
 
 #include "document.h"
+#include "storage.h"
 
 /**
  * @brief Opaque LRU cache structure
@@ -24,13 +25,13 @@ typedef struct lru LRU_Cache;
  * @brief Creates a new LRU cache instance
  *
  * @param cache_size Maximum number of documents the cache can hold
- * @param source Open file descriptor for fetching documents on cache misses
+ * @param source Storage of the metadata, read on cache misses
  * @return Pointer to initialized LRU cache
  * @retval NULL If memory allocation fails or cache_size ≤ 0
  *
  * @note Allocates resources that must be freed with lruc_destroy()
  */
-void *lruc_create(int cache_size, int source);
+void *lruc_create(int cache_size, const Storage *source);
 
 /**
  * @brief Destroys an LRU cache instance
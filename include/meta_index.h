@@ -0,0 +1,160 @@
+/**
+ * @file meta_index.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Secondary indexes of the document metadata
+ *
+ * Maps every author and every year to the identifiers of their documents,
+ * so that queries by author, year or range of years are answered from
+ * memory, without reading the metadata file, and every path to the
+ * document indexed with it, so the same file is not indexed twice.
+ *
+ * The authors of a document are split on ';' and trimmed, each one is a
+ * key of a hash table with open addressing. Years are kept in a sorted array, so a range of years
+ * is a binary search followed by a walk over the adjacent years. Paths
+ * are the keys of a second hash table with open addressing, whose buckets
+ * hold the identifier that owns each path.
+ *
+ * The keys of every identifier are remembered too, so a document is
+ * removed from the indexes by its identifier alone.
+ *
+ * @note All create/destroy operations should be paired:
+ *       - mi_create() must be matched with mi_destroy()
+ *       - mi_restore() must be matched with mi_destroy()
+ *
+ * @example Meta_Index usage:
+ * @code
+ * Meta_Index *mi = mi_create();
+ * mi_add(mi, 3, "Dante Alighieri; Virgil", "1997", "inferno.txt");
+ * mi_find_path(mi, "inferno.txt");  // 3
+ *
+ * unsigned count = 0;
+ * int *ids = mi_by_author(mi, "Virgil", &count);  // [3]
+ * free(ids);
+ *
+ * ids = mi_by_years(mi, 1990, 1999, &count);  // [3]
+ * free(ids);
+ *
+ * mi_remove(mi, 3);
+ * mi_destroy(mi);
+ * @endcode
+ *
+ */
+
+#ifndef META_INDEX_H
+#define META_INDEX_H
+
+#include <stddef.h>
+
+/**
+ * @brief Opaque structure holding the secondary indexes
+ */
+typedef struct meta_index Meta_Index;
+
+/**
+ * @brief Creates empty indexes
+ *
+ * @return Pointer to the indexes
+ * @retval NULL If memory allocation fails
+ *
+ * @note Must be paired with mi_destroy()
+ */
+Meta_Index *mi_create(void);
+
+/**
+ * @brief Releases the indexes
+ *
+ * @param mi Indexes to destroy
+ *
+ * @note Safe to call with NULL
+ */
+void mi_destroy(Meta_Index *mi);
+
+/**
+ * @brief Indexes a document by its authors, year and path
+ *
+ * @param mi Indexes
+ * @param id Document identifier
+ * @param authors Authors of the document, separated by ';'
+ * @param year Year of the document, up to YEAR_SIZE digits, not
+ *             necessarily null terminated
+ * @param path Path of the document
+ * @retval 0 Document was indexed
+ * @retval -1 Invalid input or memory allocation failed
+ *
+ * @note An identifier already indexed is removed first
+ * @note A year that is not a number is not indexed
+ * @note A path already indexed now belongs to this identifier
+ */
+int mi_add(Meta_Index *mi, int id, const char *authors, const char *year,
+           const char *path);
+
+/**
+ * @brief Removes a document from the indexes
+ *
+ * @param mi Indexes
+ * @param id Document identifier
+ *
+ * @note No effect if the identifier is not indexed
+ */
+void mi_remove(Meta_Index *mi, int id);
+
+/**
+ * @brief Finds the document indexed with a path
+ *
+ * @param mi Indexes
+ * @param path Path of the document, compared as it is
+ * @return Document identifier
+ * @retval -1 If no document has the path
+ */
+int mi_find_path(const Meta_Index *mi, const char *path);
+
+/**
+ * @brief Finds the documents of an author
+ *
+ * @param mi Indexes
+ * @param author Name of the author, surrounding spaces are ignored
+ * @param[out] count Receives the number of identifiers
+ * @return Newly allocated array of identifiers, in increasing order
+ * @retval NULL If there are none or memory allocation fails
+ *
+ * @note The caller must free the returned array
+ */
+int *mi_by_author(const Meta_Index *mi, const char *author, unsigned *count);
+
+/**
+ * @brief Finds the documents of a range of years
+ *
+ * @param mi Indexes
+ * @param from First year of the range
+ * @param to Last year of the range, equal to from for a single year
+ * @param[out] count Receives the number of identifiers
+ * @return Newly allocated array of identifiers, in increasing order
+ * @retval NULL If there are none or memory allocation fails
+ *
+ * @note The caller must free the returned array
+ */
+int *mi_by_years(const Meta_Index *mi, int from, int to, unsigned *count);
+
+/**
+ * @brief Copies the indexes to memory
+ *
+ * @param mi Indexes
+ * @param[out] out Buffer that receives the copy, NULL to only get its size
+ * @return Number of bytes of the copy
+ */
+size_t mi_snapshot(const Meta_Index *mi, void *out);
+
+/**
+ * @brief Rebuilds the indexes from a copy made by mi_snapshot()
+ *
+ * @param data Start of the copy
+ * @param size Bytes available at data
+ * @param[out] used Receives the number of bytes of the copy
+ * @return Pointer to the rebuilt indexes
+ * @retval NULL If the copy is damaged or memory allocation fails
+ *
+ * @note Must be paired with mi_destroy()
+ */
+Meta_Index *mi_restore(const void *data, size_t size, size_t *used);
+
+#endif /* META_INDEX_H */
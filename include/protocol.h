@@ -0,0 +1,283 @@
+/**
+ * @file protocol.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Wire protocol shared by the client and the server
+ *
+ * Every message is a frame: a fixed Header followed by `length` bytes of
+ * payload. Payloads are typed per operation, strings travel with a 16-bit
+ * length prefix and integers as 32-bit values, so most requests take a few
+ * dozen bytes instead of a full Request structure.
+ *
+ * Request payloads:
+ * - INDEX: title, authors, year, path (strings)
+ * - REMOVE, CONSULT: key (integer)
+ * - COUNT_WORD: key (integer), keyword (string)
+ * - LIST_WORD: number of processes (integer), keyword (string)
+ * - INDEX_BULK: number of documents (integer), then title, authors, year
+ *   and path of each one (strings)
+ * - QUERY_AUTHOR: author (string)
+ * - QUERY_YEAR: first and last year (integers)
+ * - LOOKUP_PATH: path (string)
+ * - other operations: empty
+ *
+ * Reply payloads:
+ * - INDEX, REMOVE, COUNT_WORD, LOOKUP_PATH: one integer
+ * - CONSULT: title, authors, year, path (strings), empty if not found
+ * - LIST_WORD, INDEX_BULK, QUERY_AUTHOR, QUERY_YEAR: frames holding
+ *   arrays of integer identifiers
+ * - COMPACT: one 64-bit integer, bytes reclaimed or -1
+ *
+ * A batch of documents larger than one frame is sent as several INDEX_BULK
+ * frames, all but the last one flagged with FRAME_MORE. The server answers
+ * once, after the last frame, with the list of every identifier assigned.
+ *
+ * A list of identifiers is sent in frames of at most MAX_REQUEST bytes,
+ * so every write to a pipe is atomic, all but the last one flagged with
+ * FRAME_MORE. Clients join them by sequence number into one reply.
+ *
+ * LIST_WORD results are streamed: every batch of identifiers found by the
+ * workers is sent right away in a frame flagged with FRAME_MORE, and a
+ * last frame without the flag (usually empty) ends the stream. Results
+ * have no size limit and clients can show them before the scan ends.
+ *
+ * Messages in the old fixed format (Legacy_Request) are still accepted.
+ * They are told apart by the first four bytes, which hold a process ID in
+ * the old format and PROTOCOL_MAGIC in a frame. Replies to such requests
+ * are sent in the old raw format.
+ *
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "defs.h"
+#include "document.h"
+
+#include <limits.h>
+#include <stdint.h>
+
+#define PROTOCOL_MAGIC 0x44534F50u  /**< First bytes of every frame ("DSOP") */
+#define MAX_REQUEST PIPE_BUF        /**< Largest request frame, keeps FIFO writes atomic */
+
+#define LEGACY_TITLE_SIZE 200       /**< Title field of the old fixed format */
+#define LEGACY_AUTHORS_SIZE 200     /**< Authors field of the old fixed format */
+#define LEGACY_PATH_SIZE 64         /**< Path field of the old fixed format */
+
+#define FRAME_MORE 0x1              /**< More frames of the same request follow */
+
+/** @brief Identifiers that fit in one LIST_WORD frame */
+#define MAX_LIST_BATCH ((MAX_REQUEST - sizeof(Header)) / sizeof(int32_t))
+
+/**
+ * @brief Frame header
+ *
+ * Precedes every message, in both directions.
+ */
+typedef struct {
+    uint32_t magic;     /**< Always PROTOCOL_MAGIC */
+    uint16_t opcode;    /**< Operation the frame refers to */
+    uint16_t flags;     /**< FRAME_* flags */
+    uint32_t sequence;  /**< Request id chosen by the client, echoed in the reply */
+    int32_t client;     /**< Client process ID, for response routing */
+    uint32_t length;    /**< Number of payload bytes after the header */
+} Header;
+
+/**
+ * @brief Request structure of the first protocol version
+ *
+ * Fixed size message, fields are overloaded according to the operation.
+ * Kept so that old clients can still talk to the server.
+ */
+typedef struct {
+    pid_t client;               /**< Client process ID for response routing */
+    Operation operation;        /**< Requested operation type */
+    char title[LEGACY_TITLE_SIZE];      /**< Document title field, Document ID, Keyword */
+    char authors[LEGACY_AUTHORS_SIZE];  /**< Document authors field, Keyword, Number of processes */
+    char year[YEAR_SIZE];               /**< Document publication year */
+    char path[LEGACY_PATH_SIZE];        /**< Document file path */
+} Legacy_Request;
+
+/**
+ * @brief Document reply of the first protocol version
+ *
+ * Longer fields are cut to fit.
+ */
+typedef struct {
+    char title[LEGACY_TITLE_SIZE];      /**< Document title */
+    char authors[LEGACY_AUTHORS_SIZE];  /**< Document authors */
+    char year[YEAR_SIZE];               /**< Publication year */
+    char path[LEGACY_PATH_SIZE];        /**< Filesystem path to document */
+} Legacy_Document;
+
+/**
+ * @brief Encodes a request as a frame
+ *
+ * @param request Request to encode
+ * @param[out] frame Buffer that receives the frame
+ * @param size Capacity of the buffer
+ * @return Number of bytes of the frame
+ * @retval 0 If the request does not fit in the buffer
+ */
+size_t encode_request(const Request *request, char *frame, size_t size);
+
+/**
+ * @brief Decodes the payload of a request frame
+ *
+ * @param header Header of the frame
+ * @param payload Payload bytes (header->length of them)
+ * @param[out] request Request to fill
+ * @retval 0 Request was decoded
+ * @retval 1 Malformed payload or unknown operation
+ */
+int decode_request(const Header *header, const char *payload,
+                   Request *request);
+
+/**
+ * @brief Releases the memory held by a decoded request
+ *
+ * @param request Request filled by decode_request() or receive_request()
+ *
+ * @note Only INDEX_BULK requests own memory, safe to call with any request
+ */
+void release_request(Request *request);
+
+/**
+ * @brief Number of bytes a document takes in an INDEX_BULK frame
+ *
+ * @param doc Document to measure
+ * @return Size of the encoded document
+ */
+size_t record_length(const Document *doc);
+
+/**
+ * @brief Converts a request of the first protocol version
+ *
+ * @param old Request in the old fixed format
+ * @param[out] request Request to fill
+ * @retval 0 Request was converted
+ * @retval 1 Unknown operation
+ */
+int decode_legacy_request(const Legacy_Request *old, Request *request);
+
+/**
+ * @brief Reads one request from a descriptor
+ *
+ * Accepts both frames and old fixed size requests.
+ *
+ * @param fd Descriptor to read from
+ * @param[out] request Request to fill
+ * @retval 0 A request was read
+ * @retval 1 End of file
+ * @retval -1 Read error or malformed message
+ */
+int receive_request(int fd, Request *request);
+
+/**
+ * @brief Builds a reply frame
+ *
+ * @param request Request being answered
+ * @param payload Reply payload
+ * @param length Number of payload bytes
+ * @param[out] size Number of bytes of the frame
+ * @return Newly allocated frame
+ * @retval NULL If memory allocation fails
+ *
+ * @note The caller is responsible for freeing the returned memory
+ */
+char *encode_reply(const Request *request, const void *payload, size_t length,
+                   size_t *size);
+
+/**
+ * @brief Builds an integer reply
+ *
+ * @param request Request being answered
+ * @param value Integer to send
+ * @param[out] size Number of bytes of the reply
+ * @return Newly allocated reply, a frame or the old raw format
+ * @retval NULL If memory allocation fails
+ */
+char *encode_int_reply(const Request *request, int value, size_t *size);
+
+/**
+ * @brief Builds a document reply
+ *
+ * @param request Request being answered
+ * @param doc Document to send, NULL if it was not found
+ * @param[out] size Number of bytes of the reply
+ * @return Newly allocated reply, a frame or the old raw format
+ * @retval NULL If memory allocation fails
+ */
+char *encode_document_reply(const Request *request, const Document *doc,
+                            size_t *size);
+
+/**
+ * @brief Builds an identifier list reply
+ *
+ * @param request Request being answered
+ * @param ids Identifiers to send
+ * @param count Number of identifiers
+ * @param[out] size Number of bytes of the reply
+ * @return Newly allocated reply, a frame or the old raw format
+ * @retval NULL If memory allocation fails
+ *
+ * @note Frame clients get the identifiers in frames of at most MAX_REQUEST
+ *       bytes, one after the other in the reply, all but the last one
+ *       flagged with FRAME_MORE
+ * @note The old raw format is a string, truncated to BUFSIZ bytes
+ */
+char *encode_list_reply(const Request *request, const int *ids,
+                        unsigned count, size_t *size);
+
+/**
+ * @brief Size of the first frame of a reply
+ *
+ * @param request Request being answered
+ * @param reply Reply bytes
+ * @param size Number of bytes of the reply
+ * @return Number of bytes of the first frame, the whole reply in the old
+ *         raw format
+ */
+size_t reply_frame(const Request *request, const char *reply, size_t size);
+
+/**
+ * @brief Builds one frame of a streamed identifier list
+ *
+ * @param request Request being answered
+ * @param ids Identifiers to send
+ * @param count Number of identifiers
+ * @param more Set when other frames follow, clear on the last one
+ * @param[out] size Number of bytes of the frame
+ * @return Newly allocated frame
+ * @retval NULL If memory allocation fails
+ *
+ * @note Only for frame clients, old clients get encode_list_reply()
+ */
+char *encode_list_batch(const Request *request, const int *ids,
+                        unsigned count, int more, size_t *size);
+
+/**
+ * @brief Reads one frame from a descriptor
+ *
+ * @param fd Descriptor to read from
+ * @param[out] header Header of the frame
+ * @param[out] payload Newly allocated payload, NULL if empty
+ * @retval 0 A frame was read
+ * @retval 1 End of file
+ * @retval -1 Read error or malformed frame
+ *
+ * @note The caller is responsible for freeing the payload
+ */
+int receive_frame(int fd, Header *header, char **payload);
+
+/**
+ * @brief Decodes a document sent in a CONSULT reply
+ *
+ * @param payload Payload bytes
+ * @param length Number of payload bytes
+ * @param[out] doc Document to fill
+ * @retval 0 Document was decoded
+ * @retval 1 Malformed payload
+ */
+int decode_document(const char *payload, size_t length, Document *doc);
+
+#endif /* PROTOCOL_H */
@@ -12,6 +12,7 @@
 #define RAND_CACHE_H
 
 #include "document.h"
+#include "storage.h"
 
 /**
  * @brief Opaque RAND cache structure
@@ -24,13 +25,13 @@ typedef struct rand RAND_Cache;
  * @brief Creates a new RAND cache instance
  * 
  * @param cache_size Maximum number of documents the cache can hold
- * @param source Open file descriptor for fetching documents on cache misses
+ * @param source Storage of the metadata, read on cache misses
  * @return Pointer to initialized RAND cache
  * @retval NULL If memory allocation fails or cache_size ≤ 0
  * 
  * @note Allocates resources that must be freed with randc_destroy()
  */
-void *randc_create(int cache_size, int source);
+void *randc_create(int cache_size, const Storage *source);
 
 /**
  * @brief Destroys a RAND cache instance
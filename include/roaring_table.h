@@ -0,0 +1,145 @@
+/**
+ * @file roaring_table.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Compressed index table, in the style of roaring bitmaps
+ *
+ * The identifiers are split by their 16 high bits into containers of 65536
+ * identifiers, and only containers with valid identifiers exist. Each one
+ * keeps its valid identifiers in whichever form is smallest:
+ * - an array of the 16 low bits, 2 bytes per valid identifier
+ * - a bitmap of 65536 bits, 8 KiB
+ * - runs of consecutive identifiers, 4 bytes per run
+ *
+ * Memory, and the size of a snapshot, follow the number of valid
+ * identifiers instead of the highest identifier ever valid. A container
+ * changes form when another one is smaller by more than an eighth, so
+ * adding and removing the same identifier doesn't convert it back and forth.
+ *
+ * @note All create/destroy operations should be paired:
+ *       - rt_create() must be matched with rt_destroy()
+ *       - rt_restore() must be matched with rt_destroy()
+ *
+ */
+
+#ifndef ROARING_TABLE_H
+#define ROARING_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Opaque structure of the compressed table
+ */
+typedef struct roaring_table Roaring_Table;
+
+/**
+ * @brief Creates an empty table
+ *
+ * @return Pointer to the table
+ * @retval NULL If memory allocation fails
+ *
+ * @note Must be paired with rt_destroy()
+ */
+Roaring_Table *rt_create(void);
+
+/**
+ * @brief Releases the table
+ *
+ * @param rt Table to destroy
+ *
+ * @note Safe to call with NULL
+ */
+void rt_destroy(Roaring_Table *rt);
+
+/**
+ * @brief Marks an identifier as valid
+ *
+ * @param rt Table
+ * @param id Identifier
+ * @retval 0 Identifier is valid
+ * @retval 1 Memory allocation failed
+ * @retval -1 Invalid input
+ */
+int rt_add_entry(Roaring_Table *rt, int id);
+
+/**
+ * @brief Marks an identifier as invalid
+ *
+ * @param rt Table
+ * @param id Identifier
+ * @return The identifier, if it was valid
+ * @retval -1 Identifier was not valid
+ */
+int rt_remove_entry(Roaring_Table *rt, int id);
+
+/**
+ * @brief Checks if an identifier is valid
+ *
+ * @param rt Table
+ * @param id Identifier
+ * @return 1 if valid, 0 otherwise
+ */
+int rt_entry_is_valid(const Roaring_Table *rt, int id);
+
+/**
+ * @brief Number of valid identifiers
+ *
+ * @param rt Table
+ * @return Number of valid identifiers, 0 if rt is NULL
+ */
+unsigned rt_size(const Roaring_Table *rt);
+
+/**
+ * @brief Prints the containers of the table
+ *
+ * @param rt Table
+ */
+void rt_show(const Roaring_Table *rt);
+
+/**
+ * @brief Copies the table to memory
+ *
+ * @param rt Table
+ * @param[out] out Buffer that receives the copy, NULL to only get its size
+ * @return Number of bytes of the copy
+ */
+size_t rt_snapshot(const Roaring_Table *rt, void *out);
+
+/**
+ * @brief Rebuilds a table from a copy made by rt_snapshot()
+ *
+ * @param data Start of the copy
+ * @param size Bytes available at data
+ * @param[out] used Receives the number of bytes of the copy
+ * @return Pointer to the rebuilt table
+ * @retval NULL If the copy is damaged or memory allocation fails
+ *
+ * @note Must be paired with rt_destroy()
+ */
+Roaring_Table *rt_restore(const void *data, size_t size, size_t *used);
+
+/**
+ * @brief Lists the valid identifiers
+ *
+ * @param rt Table
+ * @return Newly allocated array of identifiers, in increasing order and
+ *         terminated with -1
+ * @retval NULL If there are none or memory allocation fails
+ *
+ * @note The caller must free the returned array
+ */
+int *rt_get_valid_ids(const Roaring_Table *rt);
+
+/**
+ * @brief Finds the first 64 aligned identifiers, from a given one, with a
+ *        valid one
+ *
+ * @param rt Table
+ * @param from First identifier to look at
+ * @param[out] base Receives the first of the 64 identifiers, a multiple of 64
+ * @return Bit i set if base + i is valid, identifiers below from are clear
+ * @retval 0 If no identifier from there is valid
+ */
+uint64_t rt_next_bits(const Roaring_Table *rt, int from, int *base);
+
+#endif /* ROARING_TABLE_H */
@@ -14,6 +14,7 @@
 
 #include "cache.h"
 #include "defs.h"
+#include "index_table.h"
 
 /**
  * @brief Opaque server structure
@@ -30,6 +31,20 @@ typedef struct server Server;
  * @param document_folder Root directory for document storage
  * @param cache_size Maximum number of items in cache
  * @param type Cache replacement strategy (FIFO/RAND/LRU)
+ * @param workers Number of worker processes, 0 to fork for every reply
+ * @param threads Number of threads serving reads, 0 to serve them in the
+ *                caller
+ * @param map 1 to map the metadata file, 0 to read it with pread()
+ * @param sync_every Changes logged between calls to fsync(), 0 to never
+ *                   call it
+ * @param checkpoint_every Changes between checkpoints taken in the
+ *                         background, 0 to only take them at startup and
+ *                         shutdown
+ * @param recovery_threads Threads scanning the metadata file when the
+ *                         control file is missing
+ * @param uring 1 to read through io_uring, the metadata blocks read with
+ *              pread() and the documents of a search, 0 to use read()
+ * @param table Representation of the index table
  * @return Pointer to initialized server instance
  * @retval NULL If initialization fails (invalid params or system error)
  * 
@@ -37,7 +52,10 @@ typedef struct server Server;
  * @note Must be paired with shutdown_server()
  */
 Server *start_server(const char *document_folder, int cache_size,
-                     Cache_Type type);
+                     Cache_Type type, unsigned workers, unsigned threads,
+                     int map, unsigned sync_every,
+                     unsigned checkpoint_every, unsigned recovery_threads,
+                     int uring, Table_Type table);
 
 /**
  * @brief Processes a client request and sends response
@@ -51,10 +69,49 @@ Server *start_server(const char *document_folder, int cache_size,
  * @retval 1 Initiate graceful shutdown
  * @retval -1 Error occurred (logged internally)
  *
- * @note All responses are sent through CLIENT_FIFO
+ * @note Responses go to request->ring or request->channel when they are
+ *       set, to the client session when there is one, or else through
+ *       CLIENT_FIFO
+ * @note With threads, CONSULT, COUNT_WORD and LIST_WORD are queued and
+ *       served concurrently, other requests are served before returning
  */
 int process_request(Server *server, const Request *request);
 
+/**
+ * @brief Forgets the sessions bound to a connection
+ *
+ * Called by connection based transports when a client disconnects.
+ *
+ * @param server Server instance
+ * @param channel Descriptor of the closed connection
+ *
+ * @note The descriptor itself is closed by the transport
+ */
+void drop_channel(Server *server, int channel);
+
+/**
+ * @brief Forgets the session of a client
+ *
+ * Called by the shared memory transport when a client dies without
+ * releasing its slot.
+ *
+ * @param server Server instance
+ * @param client Process ID of the client
+ */
+void drop_client(Server *server, pid_t client);
+
+/**
+ * @brief Handles the exit of a child process of the server
+ *
+ * Worker processes that die are replaced, a finished checkpoint drops the
+ * log it saved, other children are ignored.
+ *
+ * @param server Server instance
+ * @param pid Process ID returned by waitpid()
+ * @param status Exit status returned by waitpid()
+ */
+void reap_worker(Server *server, pid_t pid, int status);
+
 /**
  * @brief Shuts down the server and releases all resources
  *
@@ -0,0 +1,207 @@
+/**
+ * @file shared_memory.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Shared memory transport between the clients and the server
+ *
+ * The server creates a shared memory object (SERVER_SHM) split in SHM_SLOTS
+ * slots. A client claims a free slot and talks to the server through its two
+ * rings: requests go in the request ring, replies come back in the reply
+ * ring. Frames are the same as in the other transports (see protocol.h), but
+ * they are copied straight into the shared memory, without any read() or
+ * write() system call.
+ *
+ * Waiting sides spin for a short while and then sleep on a futex, which the
+ * other side only wakes when someone is actually sleeping. A client rings
+ * the doorbell of the region after every request, so the server sleeps on a
+ * single futex for every slot.
+ *
+ * - request ring: one producer (the client), one consumer (the server)
+ * - reply ring: many producers (the server and its children), one consumer
+ *
+ */
+
+#ifndef SHARED_MEMORY_H
+#define SHARED_MEMORY_H
+
+#include "protocol.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SHM_SLOTS 16            /**< Number of clients served at the same time */
+#define SHM_RING_SIZE 65536     /**< Bytes of each ring, a power of two */
+
+/**
+ * @brief Opaque shared memory region
+ */
+typedef struct shm_region Shm_Region;
+
+/**
+ * @brief Opaque ring buffer inside the region
+ */
+typedef struct shm_ring Shm_Ring;
+
+/**
+ * @brief Creates the shared memory region of the server
+ *
+ * @return Pointer to the region
+ * @retval NULL If the region can't be created
+ *
+ * @note Must be paired with shm_destroy()
+ */
+Shm_Region *shm_create(void);
+
+/**
+ * @brief Removes the shared memory region of the server
+ *
+ * @param region Region created by shm_create()
+ *
+ * @note Safe to call with NULL
+ */
+void shm_destroy(Shm_Region *region);
+
+/**
+ * @brief Maps the region of a running server
+ *
+ * @return Pointer to the region
+ * @retval NULL If no server is serving through shared memory
+ *
+ * @note Must be paired with shm_detach()
+ */
+Shm_Region *shm_attach(void);
+
+/**
+ * @brief Unmaps a region mapped with shm_attach()
+ *
+ * @param region Region to unmap
+ *
+ * @note Safe to call with NULL
+ */
+void shm_detach(Shm_Region *region);
+
+/**
+ * @brief Claims a free slot for the calling process
+ *
+ * @param region Mapped region
+ * @return Index of the slot
+ * @retval -1 Every slot is taken
+ */
+int shm_claim_slot(Shm_Region *region);
+
+/**
+ * @brief Gives a slot back
+ *
+ * When called by the client, waits until the server took every request
+ * still in the request ring.
+ *
+ * @param region Mapped region
+ * @param slot Slot to release
+ */
+void shm_release_slot(Shm_Region *region, int slot);
+
+/**
+ * @brief Process that holds a slot
+ *
+ * @param region Mapped region
+ * @param slot Slot to check
+ * @return Process ID of the owner
+ * @retval 0 The slot is free
+ */
+pid_t shm_slot_owner(const Shm_Region *region, int slot);
+
+/**
+ * @brief Request ring of a slot
+ *
+ * @param region Mapped region
+ * @param slot Slot index
+ * @return Ring written by the client and read by the server
+ */
+Shm_Ring *shm_request_ring(Shm_Region *region, int slot);
+
+/**
+ * @brief Reply ring of a slot
+ *
+ * @param region Mapped region
+ * @param slot Slot index
+ * @return Ring written by the server and read by the client
+ */
+Shm_Ring *shm_reply_ring(Shm_Region *region, int slot);
+
+/**
+ * @brief Current value of the doorbell
+ *
+ * Read before looking for requests, then handed to shm_wait_requests().
+ *
+ * @param region Mapped region
+ * @return Number of requests announced so far
+ */
+unsigned shm_doorbell(const Shm_Region *region);
+
+/**
+ * @brief Waits for the doorbell to ring
+ *
+ * @param region Mapped region
+ * @param seen Value returned by shm_doorbell() before the last scan
+ * @param timeout_ms Maximum time to wait, in milliseconds
+ * @retval 0 New requests were announced
+ * @retval 1 Timed out
+ */
+int shm_wait_requests(Shm_Region *region, unsigned seen, int timeout_ms);
+
+/**
+ * @brief Sends a request frame to the server
+ *
+ * Writes the frame in the request ring of the slot and rings the doorbell.
+ *
+ * @param region Mapped region
+ * @param slot Slot of the client
+ * @param frame Encoded frame
+ * @param size Number of bytes of the frame
+ * @retval 0 Frame was sent
+ * @retval -1 The server is gone
+ */
+int shm_send(Shm_Region *region, int slot, const void *frame, size_t size);
+
+/**
+ * @brief Receives a reply frame from the server
+ *
+ * @param region Mapped region
+ * @param slot Slot of the client
+ * @param[out] header Header of the frame
+ * @param[out] payload Newly allocated payload, NULL if empty
+ * @retval 0 A frame was received
+ * @retval 1 The server is gone
+ * @retval -1 Malformed frame
+ *
+ * @note The caller is responsible for freeing the payload
+ */
+int shm_receive(Shm_Region *region, int slot, Header *header, char **payload);
+
+/**
+ * @brief Takes the next complete frame out of a ring, without waiting
+ *
+ * @param ring Ring to read from
+ * @param[out] frame Buffer that receives the frame
+ * @param size Capacity of the buffer
+ * @return Number of bytes of the frame
+ * @retval 0 No complete frame in the ring
+ * @retval -1 Malformed frame, the ring was emptied
+ */
+ssize_t shm_take_frame(Shm_Ring *ring, char *frame, size_t size);
+
+/**
+ * @brief Writes bytes in a ring
+ *
+ * Waits for room when the ring is full. Producers are serialized, so a
+ * frame written with one call is never mixed with other frames.
+ *
+ * @param ring Ring to write to
+ * @param data Bytes to write
+ * @param size Number of bytes
+ * @param peer Process reading the ring, the call gives up if it dies
+ * @retval 0 Bytes were written
+ * @retval -1 The reader is gone
+ */
+int shm_write(Shm_Ring *ring, const void *data, size_t size, pid_t peer);
+
+#endif /* SHARED_MEMORY_H */
@@ -0,0 +1,93 @@
+/**
+ * @file slot_map.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Map from document identifiers to the cache slots holding them
+ *
+ * Every cache policy keeps its documents in an array of slots, next to an
+ * array with the identifier of each slot (-1 for an empty one). The map is a
+ * hash table with open addressing over those identifiers, so finding the
+ * slot of a document takes the same time at any cache size. It is sized
+ * once, for a fixed number of slots, and never grows.
+ *
+ * The policies never write the array of identifiers directly, sm_set()
+ * changes a slot and the map together. An identifier lives in a single
+ * slot, placing it in another one empties the first.
+ *
+ * @note sm_create() must be matched with sm_destroy()
+ *
+ * @example Slot_Map usage:
+ * @code
+ * int identifiers[4] = {-1, -1, -1, -1};
+ * Slot_Map *map = sm_create(4);
+ *
+ * sm_set(map, identifiers, 2, 17);  // slot 2 holds 17
+ * sm_find(map, 17);                 // 2
+ * sm_set(map, identifiers, 0, 17);  // slot 0 holds 17, slot 2 is empty
+ * sm_set(map, identifiers, 0, -1);  // slot 0 is empty
+ * sm_find(map, 17);                 // -1
+ *
+ * sm_destroy(map);
+ * @endcode
+ *
+ */
+
+#ifndef SLOT_MAP_H
+#define SLOT_MAP_H
+
+/**
+ * @brief Opaque structure of the map
+ */
+typedef struct slot_map Slot_Map;
+
+/**
+ * @brief Creates an empty map
+ *
+ * @param slots Number of slots of the cache
+ * @return Pointer to the map
+ * @retval NULL If memory allocation fails or slots < 0
+ *
+ * @note Must be paired with sm_destroy()
+ */
+Slot_Map *sm_create(int slots);
+
+/**
+ * @brief Releases the map
+ *
+ * @param map Map to destroy
+ *
+ * @note Safe to call with NULL
+ */
+void sm_destroy(Slot_Map *map);
+
+/**
+ * @brief Finds the slot of an identifier
+ *
+ * @param map Map
+ * @param identifier Document identifier
+ * @return Slot holding the identifier
+ * @retval -1 If no slot holds it
+ */
+int sm_find(const Slot_Map *map, int identifier);
+
+/**
+ * @brief Number of slots holding a document
+ *
+ * @param map Map
+ * @return Number of identifiers in the map, 0 if map is NULL
+ */
+int sm_count(const Slot_Map *map);
+
+/**
+ * @brief Changes the identifier of a slot, keeping the map in sync
+ *
+ * The identifier held by the slot before, if any, leaves the map. A slot
+ * that held the new identifier is emptied.
+ *
+ * @param map Map
+ * @param identifiers Identifier of every slot of the cache
+ * @param slot Slot to change
+ * @param identifier New identifier of the slot, -1 to empty it
+ */
+void sm_set(Slot_Map *map, int *identifiers, int slot, int identifier);
+
+#endif /* SLOT_MAP_H */
@@ -0,0 +1,268 @@
+/**
+ * @file storage.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Storage of the document metadata
+ *
+ * The metadata is kept in two files:
+ *
+ * - heap (STORAGE_FILE): a small header followed by packed records, each one
+ *   the identifier, its state (live or removed) and the length of every
+ *   field, then the bytes of the fields without terminators, so a record
+ *   takes as much space as its contents
+ * - offset table (STORAGE_TABLE): array indexed by identifier with the
+ *   offset and length of the record of each identifier in the heap, loaded
+ *   in memory with a single read, so finding a record is still O(1)
+ *
+ * Records are only appended to the heap, and the table is updated after
+ * them. Every access is positional, so the storage can be shared by threads
+ * and forked processes without anyone moving a file offset.
+ *
+ * - mapped: the heap is mapped in memory, so records are decoded straight
+ *   from the mapping (no system call), and the mapping grows with mremap()
+ *   when the heap grows past it
+ * - positional: a record is read with one pread() of its exact length, and
+ *   a block with one pread() for every run of records that are next to each
+ *   other in the heap, or with io_uring, every run in flight at once
+ *
+ * Removing a document rewrites the state of its record in place (a
+ * tombstone), so the heap alone tells which documents are valid and the
+ * index table can be rebuilt from it with storage_scan().
+ *
+ * Records are never moved in place, so the heap keeps the records of
+ * removed documents and the old records of reused identifiers. Compaction
+ * writes a dense copy of the records worth keeping, in the order of the
+ * identifiers, while the storage keeps serving reads and writes, then
+ * brings over what changed meanwhile and swaps the files. Identifiers go
+ * through the offset table, so they don't change.
+ *
+ * A metadata file in the old fixed size format, or a heap written before
+ * records had a state, is converted when opened. Those formats don't tell
+ * removed documents apart, a filter given to storage_open() does.
+ *
+ * @warning Readers and writers must be serialized by the caller (the server
+ *          holds its table lock).
+ *
+ * @note All open/close operations should be paired:
+ *       - storage_open() must be matched with storage_close()
+ *
+ * @example Storage usage:
+ * @code
+ * Storage *storage = storage_open(STORAGE_FILE, STORAGE_TABLE, 1, 0, NULL, NULL);
+ * storage_write(storage, 0, &doc, 1);  // record 0
+ *
+ * Document buffer;
+ * const Document *found = storage_get(storage, 0, &buffer);  // == &buffer
+ *
+ * storage_close(storage);
+ * @endcode
+ *
+ */
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "document.h"
+
+#define STORAGE_MIN_MAP 1048576 /**< Bytes mapped when the heap is small */
+#define STORAGE_MAGIC 0x4D455441  /**< First bytes of the heap, "META" */
+#define STORAGE_VERSION 2         /**< Version of the heap format */
+
+/**
+ * @brief Opaque storage structure
+ */
+typedef struct storage Storage;
+
+/**
+ * @brief Tells whether the record of an identifier is kept by a compaction,
+ *        or stays live when an old format is converted
+ *
+ * @param context Context given to storage_compact_copy() or storage_open()
+ * @param identifier Identifier with a record
+ * @return Non zero to keep the record
+ */
+typedef int (*Storage_Filter)(void *context, int identifier);
+
+/**
+ * @brief Opens (or creates) the metadata files
+ *
+ * @param heap_path Path of the heap
+ * @param table_path Path of the offset table
+ * @param map 1 to map the heap, 0 to use positional reads
+ * @param uring 1 to read the runs of a block through io_uring, when the
+ *              heap is not mapped
+ * @param keep Tells which records of a converted file are live, NULL to
+ *             convert them all as live
+ * @param context Context given to keep
+ * @return Pointer to the storage
+ * @retval NULL If the files can't be opened or converted
+ *
+ * @note Falls back to positional reads when the heap can't be mapped, and
+ *       to pread() when a thread can't set up a ring
+ * @note A swap for a compacted copy that was cut short is finished first,
+ *       or undone if it never committed
+ * @note Must be paired with storage_close()
+ */
+Storage *storage_open(const char *heap_path, const char *table_path,
+                      int map, int uring, Storage_Filter keep,
+                      void *context);
+
+/**
+ * @brief Unmaps and closes the metadata files
+ *
+ * @param storage Storage to close
+ *
+ * @note Safe to call with NULL
+ */
+void storage_close(Storage *storage);
+
+/**
+ * @brief Number of entries of the offset table
+ *
+ * @param storage Storage instance
+ * @return Highest identifier written plus one, including the removed ones
+ */
+unsigned storage_count(const Storage *storage);
+
+/**
+ * @brief Reads a record
+ *
+ * @param storage Storage instance
+ * @param identifier Record to read
+ * @param buffer Receives the record
+ * @return buffer
+ * @retval NULL If the identifier has no record or it can't be read
+ */
+const Document *storage_get(const Storage *storage, int identifier,
+                            Document *buffer);
+
+/**
+ * @brief Reads consecutive records into separate buffers
+ *
+ * @param storage Storage instance
+ * @param identifier First record to read
+ * @param slots Buffer of each record, they don't need to be contiguous
+ * @param count Number of records wanted
+ * @return Number of records read, less than count at the end of the table
+ * @retval -1 Error reading the heap
+ *
+ * @note Identifiers without a record are filled with zeros
+ */
+int storage_read_block(const Storage *storage, int identifier,
+                       Document *const *slots, unsigned count);
+
+/**
+ * @brief Writes consecutive records
+ *
+ * The records are appended to the heap with a single write, then the
+ * offset table is pointed at them.
+ *
+ * @param storage Storage instance
+ * @param identifier First record to write
+ * @param docs Records to write
+ * @param count Number of records
+ * @retval 0 Records were written
+ * @retval -1 Error writing the files or growing the mapping
+ */
+int storage_write(Storage *storage, int identifier, const Document *docs,
+                  unsigned count);
+
+/**
+ * @brief Marks the record of an identifier as removed
+ *
+ * @param storage Storage instance
+ * @param identifier Record to mark
+ * @retval 0 Record was marked
+ * @retval -1 The identifier has no record or the heap can't be written
+ *
+ * @note The record can still be read, only storage_scan() looks at its state
+ */
+int storage_remove(Storage *storage, int identifier);
+
+/**
+ * @brief Tells which records of a range of identifiers are live
+ *
+ * Only the headers are looked at. The records of consecutive identifiers
+ * are read in runs of up to 1 MiB, so a scan reads the heap sequentially.
+ *
+ * @param storage Storage instance
+ * @param identifier First identifier to look at
+ * @param count Number of identifiers
+ * @param[out] live Receives 1 for every live record, 0 for identifiers
+ *                  without a record or whose record was removed
+ * @return Number of identifiers looked at, less than count at the end of
+ *         the table
+ * @retval -1 Error reading the heap
+ *
+ * @note Ranges that don't overlap can be scanned by concurrent threads
+ */
+int storage_scan(const Storage *storage, int identifier, unsigned count,
+                 unsigned char *live);
+
+/**
+ * @brief Starts tracking the changes made during a compaction
+ *
+ * Must be called before the copy is started (usually in a child process,
+ * with storage_compact_copy()), then matched by storage_compact_finish()
+ * or storage_compact_abort().
+ *
+ * @param storage Storage instance
+ */
+void storage_compact_start(Storage *storage);
+
+/**
+ * @brief Writes a dense copy of the records next to the metadata files
+ *
+ * @param storage Storage instance, as it was at storage_compact_start()
+ * @param heap_path Path of the heap, the copy goes to heap_path.new
+ * @param table_path Path of the offset table, the copy goes to
+ *                   table_path.new
+ * @param keep Records to copy, NULL to copy every record
+ * @param context Context given to keep
+ * @retval 0 Copy was written and synced
+ * @retval -1 Error writing the copy, nothing is left behind
+ */
+int storage_compact_copy(const Storage *storage, const char *heap_path,
+                         const char *table_path, Storage_Filter keep,
+                         void *context);
+
+/**
+ * @brief Swaps the metadata files for the compacted copy
+ *
+ * Records written and removed since storage_compact_start() are brought
+ * over to the copy, which is then renamed over the metadata files and
+ * mapped in their place. The swap commits before the renames, with a
+ * marker next to the heap, so a crash between them never pairs the new
+ * offset table with the old heap: the next storage_open() ends the swap.
+ *
+ * @param storage Storage instance
+ * @param heap_path Path of the heap
+ * @param table_path Path of the offset table
+ * @return Number of bytes the heap shrank
+ * @retval -1 Error updating the copy or committing the swap, the storage is
+ *         unchanged
+ *
+ * @note Readers must be stopped while the files are swapped
+ */
+long long storage_compact_finish(Storage *storage, const char *heap_path,
+                                 const char *table_path);
+
+/**
+ * @brief Drops a compaction that failed
+ *
+ * @param storage Storage instance
+ * @param heap_path Path of the heap
+ * @param table_path Path of the offset table
+ */
+void storage_compact_abort(Storage *storage, const char *heap_path,
+                           const char *table_path);
+
+/**
+ * @brief Flushes both files to the disk
+ *
+ * @param storage Storage instance
+ * @retval 0 Files were flushed
+ * @retval -1 Error syncing a file
+ */
+int storage_sync(const Storage *storage);
+
+#endif /* STORAGE_H */
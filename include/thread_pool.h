@@ -0,0 +1,92 @@
+/**
+ * @file thread_pool.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Pool of threads that run tasks of the server process
+ *
+ * Unlike the worker processes (see worker_pool.h), the threads share the
+ * memory of the server, so a task sees (and may change) the live data
+ * structures. Tasks wait in a bounded queue, and every one is run by exactly
+ * one thread.
+ *
+ * The threads block every signal, so signals keep being handled by the
+ * thread that created the pool.
+ *
+ * @note All create/destroy operations should be paired:
+ *       - tpool_create() must be matched with tpool_destroy()
+ *
+ * @example Thread_Pool usage:
+ * @code
+ * Thread_Pool *pool = tpool_create(4, handler, context);
+ * tpool_submit(pool, task);  // some thread runs handler(context, task)
+ *
+ * tpool_wait(pool);  // every task submitted so far is done
+ *
+ * tpool_destroy(pool);  // threads finish the queued tasks and exit
+ * @endcode
+ *
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#define TPOOL_QUEUE_SIZE 1024   /**< Tasks waiting for a thread */
+
+/**
+ * @brief Opaque structure representing a thread pool
+ */
+typedef struct thread_pool Thread_Pool;
+
+/**
+ * @brief Function run by a thread for every task
+ *
+ * @param context Context given to tpool_create()
+ * @param task Task given to tpool_submit(), owned by the handler
+ */
+typedef void (*Task_Handler)(void *context, void *task);
+
+/**
+ * @brief Creates the pool and starts its threads
+ *
+ * @param size Number of threads
+ * @param handler Function that runs the tasks
+ * @param context Passed to handler
+ * @return Pointer to the pool
+ * @retval NULL If a thread can't be created
+ *
+ * @note Must be paired with tpool_destroy()
+ */
+Thread_Pool *tpool_create(unsigned size, Task_Handler handler, void *context);
+
+/**
+ * @brief Queues a task for the first idle thread
+ *
+ * Blocks while the queue is full.
+ *
+ * @param pool Thread pool
+ * @param task Task handed to the handler
+ * @retval 0 Task was queued
+ * @retval 1 The pool is shutting down
+ */
+int tpool_submit(Thread_Pool *pool, void *task);
+
+/**
+ * @brief Waits until every task submitted so far is done
+ *
+ * @param pool Thread pool
+ *
+ * @note Safe to call with NULL
+ */
+void tpool_wait(Thread_Pool *pool);
+
+/**
+ * @brief Stops the threads and releases the pool
+ *
+ * Threads finish the tasks already queued before they exit.
+ *
+ * @param pool Thread pool
+ *
+ * @note Safe to call with NULL
+ */
+void tpool_destroy(Thread_Pool *pool);
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,80 @@
+/**
+ * @file transport.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Request transports of the server
+ *
+ * A transport receives requests from clients and hands them to
+ * process_request(), which is the same for every transport. Replies go
+ * back on the channel recorded in the request.
+ *
+ * - FIFO: every client writes to SERVER_FIFO, replies go through the
+ *   client FIFO (or the client session)
+ * - SOCKET: clients connect to SERVER_SOCKET, an epoll loop multiplexes
+ *   every connection and replies are written on the same connection
+ * - SHM: clients claim a slot of a shared memory region, requests and
+ *   replies are copied through ring buffers (see shared_memory.h)
+ *
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "server_ops.h"
+#include "shared_memory.h"
+
+/**
+ * @brief Supported transports
+ */
+typedef enum {
+    TRANSPORT_FIFO,     /**< Named pipes (default) */
+    TRANSPORT_SOCKET,   /**< Unix domain stream socket with epoll */
+    TRANSPORT_SHM       /**< Shared memory rings with futex wakeups */
+} Transport;
+
+/**
+ * @brief Serves requests arriving through SERVER_FIFO
+ *
+ * @param server Server instance
+ * @retval 0 Server was asked to shut down
+ * @retval 2 Error setting up the transport
+ *
+ * @note SERVER_FIFO must already exist
+ */
+int run_fifo_loop(Server *server);
+
+/**
+ * @brief Serves requests arriving through SERVER_SOCKET
+ *
+ * Creates the listening socket and multiplexes every connected client
+ * with epoll. Each request is answered on its own connection, without
+ * creating a child process for the light operations.
+ *
+ * @param server Server instance
+ * @retval 0 Server was asked to shut down
+ * @retval 2 Error setting up the transport
+ */
+int run_socket_loop(Server *server);
+
+/**
+ * @brief Serves requests arriving through the shared memory region
+ *
+ * Serves every claimed slot of the region. When no slot has a
+ * request, the server sleeps on the doorbell of the region. Slots of dead
+ * clients are released every time the wait times out.
+ *
+ * @param server Server instance
+ * @param region Region created by shm_create() before the server started,
+ *               so that its worker processes share the mapping
+ * @retval 0 Server was asked to shut down
+ */
+int run_shm_loop(Server *server, Shm_Region *region);
+
+/**
+ * @brief Connects to the server socket
+ *
+ * @return Descriptor of the connection
+ * @retval -1 The server is not listening on SERVER_SOCKET
+ */
+int connect_socket(void);
+
+#endif /* TRANSPORT_H */
@@ -0,0 +1,109 @@
+/**
+ * @file uring.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Minimal io_uring ring for asynchronous reads
+ *
+ * Talks to the kernel through the io_uring system calls directly, without
+ * liburing. Reads are queued in the submission ring, handed to the kernel
+ * together with uring_submit(), and their results collected from the
+ * completion ring with uring_reap(), in the order they finish. Many reads
+ * can be in flight at once, so a process waits for the slowest of a batch
+ * instead of the sum of all of them.
+ *
+ * A ring belongs to the thread (and process) that created it: it must not
+ * be shared by threads, nor used by a child process after a fork().
+ *
+ * @note All create/destroy operations should be paired:
+ *       - uring_create() must be matched with uring_destroy()
+ *
+ * @example Uring usage:
+ * @code
+ * Uring *ring = uring_create(32);
+ * if (ring == NULL) {
+ *     // io_uring is not available, use read()
+ * }
+ *
+ * uring_read(ring, fd, buffer, size, 0, 7);  // tag 7
+ * uring_submit(ring, 1);  // and wait for one completion
+ *
+ * uint64_t tag;
+ * int result;
+ * while (uring_reap(ring, &tag, &result)) {
+ *     // result is what read() would return, or -errno
+ * }
+ *
+ * uring_destroy(ring);
+ * @endcode
+ *
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define URING_DEPTH 32  /**< Reads in flight per ring */
+
+/**
+ * @brief Opaque structure representing a ring
+ */
+typedef struct uring Uring;
+
+/**
+ * @brief Sets up a ring
+ *
+ * @param entries Number of reads that can be queued at once
+ * @return Pointer to the ring
+ * @retval NULL If the kernel doesn't support io_uring or denies it
+ *
+ * @note Must be paired with uring_destroy()
+ */
+Uring *uring_create(unsigned entries);
+
+/**
+ * @brief Unmaps and closes a ring
+ *
+ * @param ring Ring to destroy
+ *
+ * @note Safe to call with NULL
+ */
+void uring_destroy(Uring *ring);
+
+/**
+ * @brief Queues a read, it starts at the next uring_submit()
+ *
+ * @param ring Ring instance
+ * @param fd Descriptor to read from
+ * @param buffer Receives the bytes, must stay valid until the completion
+ * @param length Number of bytes to read
+ * @param offset Position in the file
+ * @param tag Value returned with the completion
+ * @retval 0 Read was queued
+ * @retval -1 Submission ring is full
+ */
+int uring_read(Uring *ring, int fd, void *buffer, unsigned length,
+               off_t offset, uint64_t tag);
+
+/**
+ * @brief Hands the queued reads to the kernel
+ *
+ * @param ring Ring instance
+ * @param wait Number of completions to wait for, 0 to return at once
+ * @retval 0 Reads were submitted
+ * @retval -1 Error entering the kernel
+ */
+int uring_submit(Uring *ring, unsigned wait);
+
+/**
+ * @brief Takes one completion, without waiting
+ *
+ * @param ring Ring instance
+ * @param[out] tag Tag given to uring_read()
+ * @param[out] result Bytes read, or -errno
+ * @retval 1 A completion was taken
+ * @retval 0 No completion is ready
+ */
+int uring_reap(Uring *ring, uint64_t *tag, int *result);
+
+#endif /* URING_H */
@@ -0,0 +1,162 @@
+/**
+ * @file wal.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Write-ahead log of the changes to the index table and free list
+ *
+ * Every INDEX and REMOVE is appended to the log (WAL_FILE) before its reply
+ * is sent, so the changes survive the server being killed. The control file
+ * is the checkpoint: at startup the log is replayed on top of it, a new
+ * checkpoint is written and the log starts over.
+ *
+ * Records are buffered by wal_append() and written together by
+ * wal_commit(), so a batch of documents (or several requests served before
+ * a reply) costs a single write (group commit). Once a write reaches the
+ * system the record survives a crash of the server; fsync() is what makes
+ * it survive a crash of the machine, and it is only called every
+ * `sync_every` records (batching), or never when it is 0.
+ *
+ * A checkpoint taken while the server keeps running first moves the log
+ * aside with wal_rotate(), so new records go to an empty log, and the old
+ * one is deleted once the checkpoint is written.
+ *
+ * Every record carries a checksum, so a record cut short by a crash is
+ * found and dropped on replay.
+ *
+ * @note All open/close operations should be paired:
+ *       - wal_open() must be matched with wal_close()
+ *
+ * @example Wal usage:
+ * @code
+ * Wal *wal = wal_open(WAL_FILE, 64);
+ * wal_replay(wal, apply, context);  // changes since the last checkpoint
+ *
+ * wal_append(wal, WAL_INDEX, 3);
+ * wal_append(wal, WAL_REMOVE, 1);
+ * wal_commit(wal);  // both records in one write
+ *
+ * wal_reset(wal);  // after a checkpoint
+ * wal_close(wal);
+ * @endcode
+ *
+ */
+
+#ifndef WAL_H
+#define WAL_H
+
+/**
+ * @brief Opaque structure representing the log
+ */
+typedef struct wal Wal;
+
+/**
+ * @brief Kinds of changes recorded in the log
+ */
+typedef enum {
+    WAL_INDEX = 1,  /**< Identifier became valid */
+    WAL_REMOVE      /**< Identifier was removed, its slot is free */
+} Wal_Type;
+
+/**
+ * @brief Function called for every record replayed
+ *
+ * @param context Context given to wal_replay()
+ * @param type Kind of change
+ * @param identifier Document identifier
+ */
+typedef void (*Wal_Handler)(void *context, Wal_Type type, int identifier);
+
+/**
+ * @brief Opens (or creates) the log
+ *
+ * @param path Path of the log file
+ * @param sync_every Records written between calls to fsync(), 0 to never
+ *                   call it
+ * @return Pointer to the log
+ * @retval NULL If the file can't be opened
+ *
+ * @note Must be paired with wal_close()
+ */
+Wal *wal_open(const char *path, unsigned sync_every);
+
+/**
+ * @brief Commits the records still buffered, syncs and closes the log
+ *
+ * @param wal Log to close
+ *
+ * @note Safe to call with NULL
+ */
+void wal_close(Wal *wal);
+
+/**
+ * @brief Calls handler for every record of the log, in order
+ *
+ * Stops at the first damaged record and cuts the log there, so new records
+ * follow the last good one.
+ *
+ * @param wal Log instance
+ * @param handler Function that applies the records
+ * @param context Passed to handler
+ * @return Number of records replayed
+ * @retval -1 Error reading the log
+ */
+int wal_replay(Wal *wal, Wal_Handler handler, void *context);
+
+/**
+ * @brief Buffers a record, it is written by the next wal_commit()
+ *
+ * @param wal Log instance
+ * @param type Kind of change
+ * @param identifier Document identifier
+ * @retval 0 Record was buffered
+ * @retval -1 Error allocating memory
+ */
+int wal_append(Wal *wal, Wal_Type type, int identifier);
+
+/**
+ * @brief Checks if the next wal_commit() will call fsync()
+ *
+ * Data the records refer to must reach the disk before them.
+ *
+ * @param wal Log instance
+ * @return 1 if a sync is due, 0 otherwise
+ */
+int wal_sync_due(const Wal *wal);
+
+/**
+ * @brief Writes every buffered record with a single write
+ *
+ * Calls fsync() once `sync_every` records were written since the last one.
+ *
+ * @param wal Log instance
+ * @retval 0 Records were written (or there were none)
+ * @retval -1 Error writing or syncing the log
+ *
+ * @note Safe to call with NULL
+ */
+int wal_commit(Wal *wal);
+
+/**
+ * @brief Empties the log, once its records are in a checkpoint
+ *
+ * @param wal Log instance
+ * @retval 0 Log was emptied
+ * @retval -1 Error truncating the file
+ */
+int wal_reset(Wal *wal);
+
+/**
+ * @brief Moves the records written so far to another file
+ *
+ * Commits and syncs the log, renames it to old_path and starts an empty
+ * log in its place.
+ *
+ * @param wal Log instance
+ * @param old_path New path of the current records
+ * @retval 0 Log was rotated
+ * @retval -1 Error, the log is unchanged
+ *
+ * @warning An existing file at old_path is replaced
+ */
+int wal_rotate(Wal *wal, const char *old_path);
+
+#endif /* WAL_H */
@@ -0,0 +1,104 @@
+/**
+ * @file worker_pool.h
+ * @author Eduardo Freitas Fernandes (ef05238@gmail.com)
+ * @brief Pool of long-lived worker processes
+ *
+ * The workers are created once and wait for jobs on a shared queue (a
+ * SOCK_SEQPACKET socket pair), so that slow or blocking work doesn't need
+ * a new process per request. Every job is one message, taken by exactly one
+ * worker, and may carry a descriptor that the worker receives as well.
+ *
+ * Workers that die are replaced when their exit is reported to pool_reap().
+ *
+ * @note All create/destroy operations should be paired:
+ *       - pool_create() must be matched with pool_destroy()
+ *
+ * @example Worker_Pool usage:
+ * @code
+ * Worker_Pool *pool = pool_create(4, handler, context);
+ * pool_submit(pool, &job, sizeof(job), -1);  // any worker runs handler()
+ *
+ * pool_reap(pool, pid);  // a child exited, replace it if it was a worker
+ *
+ * pool_destroy(pool);  // workers finish their jobs and exit
+ * @endcode
+ *
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define POOL_JOB_SIZE 16384     /**< Largest job accepted by the pool */
+
+/**
+ * @brief Opaque structure representing a worker pool
+ */
+typedef struct worker_pool Worker_Pool;
+
+/**
+ * @brief Function run by a worker for every job
+ *
+ * @param context Context given to pool_create()
+ * @param job Bytes of the job
+ * @param size Number of bytes of the job
+ * @param fd Descriptor sent with the job, -1 if none
+ *
+ * @note The descriptor is closed by the pool after the call
+ */
+typedef void (*Job_Handler)(void *context, const void *job, size_t size,
+                            int fd);
+
+/**
+ * @brief Creates the pool and starts its workers
+ *
+ * @param size Number of workers
+ * @param handler Function that runs the jobs
+ * @param context Passed to handler, as seen by the process at fork time
+ * @return Pointer to the pool
+ * @retval NULL If the queue or a worker can't be created
+ *
+ * @note Must be paired with pool_destroy()
+ */
+Worker_Pool *pool_create(unsigned size, Job_Handler handler, void *context);
+
+/**
+ * @brief Hands a job to the first idle worker
+ *
+ * Blocks while the queue is full.
+ *
+ * @param pool Worker pool
+ * @param job Bytes of the job
+ * @param size Number of bytes of the job
+ * @param fd Descriptor to send with the job, -1 if none
+ * @retval 0 Job was queued
+ * @retval 1 Job is too large or the queue failed
+ */
+int pool_submit(Worker_Pool *pool, const void *job, size_t size, int fd);
+
+/**
+ * @brief Handles the exit of a child process
+ *
+ * @param pool Worker pool
+ * @param pid Process ID returned by waitpid()
+ * @retval 1 The process was a worker (it was replaced)
+ * @retval 0 The process is not a worker
+ *
+ * @note Safe to call with NULL
+ */
+int pool_reap(Worker_Pool *pool, pid_t pid);
+
+/**
+ * @brief Stops the workers and releases the pool
+ *
+ * Workers finish the jobs already queued before they exit.
+ *
+ * @param pool Worker pool
+ *
+ * @note Safe to call with NULL
+ */
+void pool_destroy(Worker_Pool *pool);
+
+#endif /* WORKER_POOL_H */
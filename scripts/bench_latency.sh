@@ -0,0 +1,52 @@
+#!/bin/bash
+# Script to compare the consult latency (p50/p99) of every transport
+# Usage: ./scripts/bench_latency.sh document_folder [nr_requests]
+
+# Check if one argument was given (document folder)
+if [ "$#" -lt 1 ] || [ "$#" -gt 2 ]; then
+  echo "Usage: $0 <document_folder> [nr_requests]"
+  exit 1
+fi
+
+DOCUMENT_FOLDER="$1"
+REQUESTS=${2:-10000}
+
+# output file
+timestamp=$(date +%Y-%m-%d_%H:%M:%S)
+output_file="results/latency_${timestamp}.txt"
+>"$output_file" # clear previous content
+
+{
+  echo "Latency Benchmark Results ($REQUESTS consults per transport)"
+  echo "-----------------------------------------------------------------"
+} >>"$output_file"
+
+# ============================================
+# One server run per transport
+# ============================================
+
+for transport in fifo socket shm; do
+  case "$transport" in
+    socket) flag="-u" ;;
+    shm) flag="-m" ;;
+    *) flag="" ;;
+  esac
+
+  echo "[INFO] Starting server ($transport) with no cache and no debugging messages"
+  ./bin/dserver "$DOCUMENT_FOLDER" "0" "-g" $flag &
+  sleep 0.5
+
+  ./bin/dclient -a "Benchmark" "Nobody" "2025" "bench.txt" >/dev/null
+
+  echo "[INFO] Running $REQUESTS consults"
+  printf "%-7s | %s\n" "$transport" "$(./bin/dclient -L 0 "$REQUESTS")" >>"$output_file"
+
+  echo "[INFO] Shut down server"
+  ./bin/dclient "-f"
+  wait
+
+  # clean tmp directory
+  rm -f tmp/*
+done
+
+cat "$output_file"
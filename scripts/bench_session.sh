@@ -0,0 +1,87 @@
+#!/bin/bash
+# Script to compare the throughput of one-shot requests, a session and a
+# pipelined session
+# Usage: ./scripts/bench_session.sh document_folder [nr_requests]
+
+# Check if one argument was given (document folder)
+if [ "$#" -lt 1 ] || [ "$#" -gt 2 ]; then
+  echo "Usage: $0 <document_folder> [nr_requests]"
+  exit 1
+fi
+
+DOCUMENT_FOLDER="$1"
+REQUESTS=${2:-1000}
+
+# output file
+timestamp=$(date +%Y-%m-%d_%H:%M:%S)
+output_file="results/session_${timestamp}.txt"
+>"$output_file" # clear previous content
+
+# ============================================
+# 1 - Start the server and index a document
+# ============================================
+
+echo "[INFO] Starting server with no cache and no debugging messages"
+./bin/dserver "$DOCUMENT_FOLDER" "0" "-g" &
+sleep 0.5
+echo "[INFO] Server is online"
+
+./bin/dclient -a "Benchmark" "Nobody" "2025" "bench.txt" >/dev/null
+
+# ============================================
+# 2 - One request per dclient call
+# ============================================
+
+echo "[INFO] Running $REQUESTS one-shot requests"
+start_time=$(date +%s.%N)
+i=0
+while [ $i -lt "$REQUESTS" ]; do
+  ./bin/dclient -c 0 >/dev/null
+  i=$((i + 1))
+done
+end_time=$(date +%s.%N)
+one_shot=$(awk "BEGIN { print $end_time - $start_time }")
+
+# ============================================
+# 3 - Every request over the same session
+# ============================================
+
+echo "[INFO] Running $REQUESTS requests in one session"
+start_time=$(date +%s.%N)
+yes -- "-c 0" | head -n "$REQUESTS" | ./bin/dclient -i >/dev/null
+end_time=$(date +%s.%N)
+session=$(awk "BEGIN { print $end_time - $start_time }")
+
+# ============================================
+# 4 - Many requests in flight over one session
+# ============================================
+
+echo "[INFO] Running $REQUESTS pipelined requests"
+yes -- "-c 0" | head -n "$REQUESTS" >tmp/bench_commands.txt
+start_time=$(date +%s.%N)
+./bin/dclient -b tmp/bench_commands.txt >/dev/null
+end_time=$(date +%s.%N)
+pipelined=$(awk "BEGIN { print $end_time - $start_time }")
+
+# ============================================
+# 5 - Show results and shut down server
+# ============================================
+
+{
+  echo "Session Benchmark Results ($REQUESTS consults)"
+  echo "-----------------------------------------------"
+  echo "Mode      | Time (s) | Requests/s"
+  echo "-----------------------------------------------"
+  printf "%-9s | %-8.3f | %.0f\n" "one-shot" "$one_shot" "$(awk "BEGIN { print $REQUESTS / $one_shot }")"
+  printf "%-9s | %-8.3f | %.0f\n" "session" "$session" "$(awk "BEGIN { print $REQUESTS / $session }")"
+  printf "%-9s | %-8.3f | %.0f\n" "pipelined" "$pipelined" "$(awk "BEGIN { print $REQUESTS / $pipelined }")"
+} >>"$output_file"
+
+echo "[INFO] Shut down server"
+./bin/dclient "-f"
+echo "[INFO] Server is offline"
+
+# clean tmp directory
+rm -f tmp/*
+
+cat "$output_file"
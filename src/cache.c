@@ -4,6 +4,7 @@
 #include "lru_cache.h"
 #include "rand_cache.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 
 
@@ -17,14 +18,15 @@
 typedef struct cache {
     Cache_Type type;        /**< Active replacement strategy */
     void *cache;            /**< Opaque pointer to strategy-specific cache instance */
+    pthread_mutex_t lock;   /**< Serializes the threads of the server, even lookups reorder entries */
     
     /**
      * @brief Strategy constructor function pointer
      * @param size Cache capacity
-     * @param source Data source identifier
+     * @param source Storage of the metadata
      * @return Pointer to initialized cache instance
      */
-    void *(*create)(int size, int source);
+    void *(*create)(int size, const Storage *source);
     
     /**
      * @brief Strategy destructor function pointer
@@ -63,7 +65,7 @@ typedef struct cache {
 } Cache;
 
 
-Cache *cache_start(int cache_size, Cache_Type type, int source) {
+Cache *cache_start(int cache_size, Cache_Type type, const Storage *source) {
     Cache *cache = (Cache *)calloc(1, sizeof(Cache));
     if (cache == NULL) {
         return NULL;
@@ -104,6 +106,7 @@ Cache *cache_start(int cache_size, Cache_Type type, int source) {
 
     cache->type = type;
     cache->cache = cache->create(cache_size, source);
+    pthread_mutex_init(&cache->lock, NULL);
 
     return cache;
 }
@@ -112,6 +115,7 @@ void cache_destroy(Cache *cache) {
     if (cache != NULL) {
 
         cache->destroy(cache->cache);
+        pthread_mutex_destroy(&cache->lock);
 
         free(cache);
     }
@@ -122,19 +126,27 @@ Document *cache_get_document(Cache *cache, int identifier) {
         return NULL;
     }
 
-    return cache->get_doc(cache->cache, identifier);
+    pthread_mutex_lock(&cache->lock);
+    Document *doc = cache->get_doc(cache->cache, identifier);
+    pthread_mutex_unlock(&cache->lock);
+
+    return doc;
 }
 
 void cache_add_document(Cache *cache, int identifier, Document * doc) {
     if (cache != NULL && identifier >= 0 && doc != NULL) {
+        pthread_mutex_lock(&cache->lock);
         cache->add_doc(cache->cache, identifier, doc);
+        pthread_mutex_unlock(&cache->lock);
     }
 }
 
 
 void cache_remove_document(Cache *cache, int identifier) {
     if (cache != NULL && identifier >= 0) {
+        pthread_mutex_lock(&cache->lock);
         cache->remove_doc(cache->cache, identifier);
+        pthread_mutex_unlock(&cache->lock);
     }
 }
 
@@ -0,0 +1,272 @@
+#include "checkpoint.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief First bytes of a checkpoint
+ */
+typedef struct {
+    uint32_t magic;         /**< Always CHECKPOINT_MAGIC */
+    uint32_t version;       /**< Always CHECKPOINT_VERSION */
+    uint32_t list_size;     /**< Bytes of the free list */
+    uint32_t table_size;    /**< Bytes of the index table */
+    uint32_t meta_size;     /**< Bytes of the secondary indexes (since version 2) */
+} Checkpoint_Header;
+
+/** @brief Header of the first version, without the secondary indexes */
+#define HEADER_V1_SIZE offsetof(Checkpoint_Header, meta_size)
+
+int checkpoint_write(const char *path, const Free_List *fl,
+                     const Index_Table *it, const Meta_Index *mi) {
+    Checkpoint_Header header = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION,
+                                fl_snapshot(fl, NULL), it_snapshot(it, NULL),
+                                mi_snapshot(mi, NULL)};
+    size_t size = sizeof(header) + header.list_size + header.table_size +
+                  header.meta_size;
+
+    char *data = (char *)malloc(size);
+    if (data == NULL) {
+        return -1;
+    }
+
+    memcpy(data, &header, sizeof(header));
+    fl_snapshot(fl, data + sizeof(header));
+    it_snapshot(it, data + sizeof(header) + header.list_size);
+    mi_snapshot(mi, data + sizeof(header) + header.list_size +
+                        header.table_size);
+
+    char temp[256];
+    snprintf(temp, sizeof(temp), "%s.new", path);
+
+    int file = open(temp, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    if (file == -1) {
+        perror("open()");
+        free(data);
+        return -1;
+    }
+
+    // the whole checkpoint in a single write
+    ssize_t out = write(file, data, size);
+    free(data);
+
+    if (out != (ssize_t)size || fsync(file) == -1) {
+        perror("write()");
+        close(file);
+        unlink(temp);
+        return -1;
+    }
+    close(file);
+
+    // the old checkpoint is replaced only once the new one is complete
+    if (rename(temp, path) == -1) {
+        perror("rename()");
+        unlink(temp);
+        return -1;
+    }
+
+    return 0;
+}
+
+int checkpoint_load(const char *path, Table_Type type, Free_List **fl,
+                    Index_Table **it, Meta_Index **mi) {
+    *fl = NULL;
+    *it = NULL;
+    *mi = NULL;
+
+    int file = open(path, O_RDONLY);
+    if (file == -1 && errno == ENOENT) {
+        // first run, or the file was lost
+        *fl = fl_create();
+        *it = it_create(type);
+        *mi = mi_create();
+        return *fl != NULL && *it != NULL && *mi != NULL ? 1 : -1;
+    }
+
+    if (file == -1) {
+        perror("open()");
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) == -1) {
+        perror("fstat()");
+        close(file);
+        return -1;
+    }
+
+    char *data = (char *)malloc(info.st_size + 1);
+    if (data == NULL) {
+        close(file);
+        return -1;
+    }
+
+    // the whole checkpoint in a single read
+    ssize_t out = read(file, data, info.st_size);
+    close(file);
+    if (out != info.st_size) {
+        perror("read()");
+        free(data);
+        return -1;
+    }
+
+    Checkpoint_Header header;
+    size_t offset = 0, used = 0;
+    int has_meta = 0;
+
+    memset(&header, 0, sizeof(header));
+    if ((size_t)out >= HEADER_V1_SIZE) {
+        memcpy(&header, data, HEADER_V1_SIZE);
+    }
+
+    if ((size_t)out >= HEADER_V1_SIZE && header.magic == CHECKPOINT_MAGIC) {
+        // the first version has no secondary indexes, the second one has
+        // no paths, both get them from the metadata file
+        has_meta = header.version == CHECKPOINT_VERSION;
+        offset = header.version == 1 ? HEADER_V1_SIZE : sizeof(header);
+        if (header.version > 1 && (size_t)out >= sizeof(header)) {
+            memcpy(&header, data, sizeof(header));
+        }
+
+        if (header.version < 1 || header.version > CHECKPOINT_VERSION ||
+            offset + header.list_size + header.table_size + header.meta_size >
+                (size_t)out) {
+            printf("[SERVER INFO] %s has an unknown format\n", path);
+            free(data);
+            return -1;
+        }
+    }
+
+    // a control file without the header starts with the free list too
+    *fl = fl_restore(data + offset, out - offset, &used);
+    if (*fl != NULL) {
+        offset += used;
+        *it = it_restore(data + offset, out - offset, type, &used);
+    }
+    if (*it != NULL && has_meta) {
+        offset += used;
+        *mi = mi_restore(data + offset, out - offset, &used);
+    }
+
+    free(data);
+
+    if (*fl == NULL || *it == NULL ||
+        (*mi == NULL && has_meta)) {
+        printf("[SERVER INFO] %s is damaged\n", path);
+        fl_destroy(*fl);
+        it_destroy(*it);
+        mi_destroy(*mi);
+        *fl = NULL;
+        *it = NULL;
+        *mi = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Range of identifiers scanned by one thread of checkpoint_rebuild()
+ */
+typedef struct {
+    const Storage *storage; /**< Metadata being scanned */
+    int first;              /**< First identifier of the range */
+    unsigned count;         /**< Number of identifiers of the range */
+    unsigned char *live;    /**< State of each identifier of the range */
+    int status;             /**< Result of storage_scan() */
+    int running;            /**< Scanned by a thread that must be joined */
+    pthread_t thread;       /**< Thread scanning the range */
+} Scan_Range;
+
+static void *scan_range(void *arg) {
+    Scan_Range *range = (Scan_Range *)arg;
+
+    range->status = storage_scan(range->storage, range->first, range->count,
+                                 range->live);
+    return NULL;
+}
+
+int checkpoint_rebuild(const Storage *storage, unsigned threads,
+                       Table_Type type, Free_List **fl, Index_Table **it) {
+    unsigned count = storage_count(storage);
+    unsigned char *live = (unsigned char *)malloc(count + 1);
+    Scan_Range *ranges = NULL;
+    int status = 0;
+
+    if (threads == 0) {
+        threads = 1;
+    }
+    if (threads > count && count > 0) {
+        threads = count;
+    }
+
+    ranges = (Scan_Range *)calloc(threads, sizeof(Scan_Range));
+    if (live == NULL || ranges == NULL) {
+        free(live);
+        free(ranges);
+        return -1;
+    }
+
+    // every thread reads its own contiguous part of the heap
+    unsigned chunk = count / threads;
+    unsigned started = 0;
+    for (unsigned i = 0; i < threads; i++) {
+        ranges[i].storage = storage;
+        ranges[i].first = i * chunk;
+        ranges[i].count = i == threads - 1 ? count - i * chunk : chunk;
+        ranges[i].live = live + i * chunk;
+
+        if (pthread_create(&ranges[i].thread, NULL, scan_range,
+                           ranges + i) != 0) {
+            // scan it here instead
+            scan_range(ranges + i);
+            continue;
+        }
+        ranges[i].running = 1;
+        started++;
+    }
+
+    for (unsigned i = 0; i < threads; i++) {
+        if (ranges[i].running) {
+            pthread_join(ranges[i].thread, NULL);
+        }
+        if (ranges[i].status != (int)ranges[i].count) {
+            status = -1;
+        }
+    }
+
+    *fl = fl_create();
+    *it = it_create(type);
+    if (*fl == NULL || *it == NULL) {
+        status = -1;
+    }
+
+    // from the end, so the first identifier sizes the tables at once
+    for (unsigned i = count; status == 0 && i > 0; i--) {
+        status = live[i - 1] ? it_add_entry(*it, i - 1)
+                             : fl_push(*fl, i - 1);
+    }
+
+    free(live);
+    free(ranges);
+
+    if (status != 0) {
+        fl_destroy(*fl);
+        it_destroy(*it);
+        *fl = NULL;
+        *it = NULL;
+        return -1;
+    }
+
+    printf("[SERVER INFO] rebuilt %u of %u documents with %u threads\n",
+           it_size(*it), count, started == 0 ? 1 : started);
+    return 0;
+}
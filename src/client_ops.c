@@ -1,7 +1,10 @@
 
 #include "client_ops.h"
 #include "document.h"
+#include "protocol.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -31,6 +34,18 @@ Operation check_operation(const char *opr) {
         case 'f':
             result = SHUTDOWN;
             break;
+        case 'k':
+            result = COMPACT;
+            break;
+        case 'w':
+            result = QUERY_AUTHOR;
+            break;
+        case 'y':
+            result = QUERY_YEAR;
+            break;
+        case 'p':
+            result = LOOKUP_PATH;
+            break;
         default:
             break;
     }
@@ -51,9 +66,15 @@ int define_request(Request *request, int argc, char **argv) {
                 return 1;
             }
 
+            if (strlen(argv[2]) >= TITLE_SIZE ||
+                strlen(argv[3]) >= AUTHORS_SIZE ||
+                strlen(argv[4]) > YEAR_SIZE || strlen(argv[5]) >= PATH_SIZE) {
+                return 1;
+            }
+
             strcpy(request->title, argv[2]);
             strcpy(request->authors, argv[3]);
-            strcpy(request->year, argv[4]);
+            strncpy(request->year, argv[4], YEAR_SIZE);
             strcpy(request->path, argv[5]);
 
             break;
@@ -63,7 +84,7 @@ int define_request(Request *request, int argc, char **argv) {
                 return 1;
             }
 
-            strcpy(request->title, argv[2]);
+            request->key = atoi(argv[2]);
 
             break;
         case CONSULT:
@@ -72,32 +93,56 @@ int define_request(Request *request, int argc, char **argv) {
                 return 1;
             }
 
-            strcpy(request->title, argv[2]);
+            request->key = atoi(argv[2]);
 
             break;
         case COUNT_WORD:
             /* count occurrences */
-            if (argc != 4) {
+            if (argc != 4 || strlen(argv[3]) >= KEYWORD_SIZE) {
                 return 1;
             }
 
-            strcpy(request->title, argv[2]);
-            strcpy(request->authors, argv[3]);
+            request->key = atoi(argv[2]);
+            strcpy(request->keyword, argv[3]);
 
             break;
         case LIST_WORD:
             /* list documents */
+            if ((argc != 3 && argc != 4) || strlen(argv[2]) >= KEYWORD_SIZE) {
+                return 1;
+            }
+
+            strcpy(request->keyword, argv[2]);
+            request->n_procs = argc == 4 ? atoi(argv[3]) : 1;
+
+            break;
+        case QUERY_AUTHOR:
+            /* documents of an author */
+            if (argc != 3 || strlen(argv[2]) >= AUTHORS_SIZE) {
+                return 1;
+            }
+
+            strcpy(request->authors, argv[2]);
+
+            break;
+        case QUERY_YEAR:
+            /* documents of a year, or a range of years */
             if (argc != 3 && argc != 4) {
                 return 1;
             }
 
-            strcpy(request->title, argv[2]);
-            if (argc == 4) {
-                strcpy(request->authors, argv[3]);
-            } else {
-                strcpy(request->authors, "1\0");
+            request->key = atoi(argv[2]);
+            request->key_last = argc == 4 ? atoi(argv[3]) : request->key;
+
+            break;
+        case LOOKUP_PATH:
+            /* document indexed with a path */
+            if (argc != 3 || strlen(argv[2]) >= PATH_SIZE) {
+                return 1;
             }
 
+            strcpy(request->path, argv[2]);
+
             break;
         default:
             break;
@@ -107,7 +152,7 @@ int define_request(Request *request, int argc, char **argv) {
     return 0;
 }
 
-void show_reply(Operation op, const void *reply) {
+void show_reply(Operation op, const char *reply, size_t length) {
     switch (op) {
         case INDEX:
             /* index document */
@@ -130,12 +175,11 @@ void show_reply(Operation op, const void *reply) {
         case CONSULT:
             /* consult document */
 
-            Document *doc = (Document *)reply;
-            char *not_found_msg = "Document was not found";
-            if (strcmp(doc->title, not_found_msg) == 0) {
-                printf("%s\n", not_found_msg);
+            Document doc;
+            if (length == 0 || decode_document(reply, length, &doc) != 0) {
+                printf("Document was not found\n");
             } else {
-                show_document(doc);
+                show_document(&doc);
             }
 
             break;
@@ -153,10 +197,123 @@ void show_reply(Operation op, const void *reply) {
         case LIST_WORD:
             /* list documents */
 
-            printf("IDs: %s\n", (char *)reply);
+            show_list_batch(reply, length, 1, 1);
+
+            break;
+        case INDEX_BULK:
+            /* index a batch of documents */
+
+            if (length == 0) {
+                printf("No documents indexed\n");
+            } else {
+                printf("%zu documents indexed (first %d, last %d)\n",
+                       length / sizeof(int), ((int *)reply)[0],
+                       ((int *)reply)[length / sizeof(int) - 1]);
+            }
+
+            break;
+        case QUERY_AUTHOR:
+        case QUERY_YEAR:
+            /* documents of an author or a range of years */
+
+            if (length == 0) {
+                printf("No documents found\n");
+            } else {
+                show_list_batch(reply, length, 1, 1);
+            }
+
+            break;
+        case LOOKUP_PATH:
+            /* document indexed with a path */
+
+            identifier = *(int *)reply;
+
+            if (identifier == -1) {
+                printf("Document was not found\n");
+            } else {
+                printf("Document %d\n", identifier);
+            }
+
+            break;
+        case COMPACT:
+            /* compact the metadata file */
+
+            long long reclaimed = 0;
+            memcpy(&reclaimed, reply,
+                   length < sizeof(reclaimed) ? length : sizeof(reclaimed));
+
+            if (length < sizeof(reclaimed) || reclaimed == -1) {
+                printf("Compaction failed or already running\n");
+            } else {
+                printf("Compaction reclaimed %lld bytes\n", reclaimed);
+            }
 
             break;
         default:
             break;
     }
 }
+
+void show_list_batch(const char *reply, size_t length, int first, int last) {
+    static int shown = 0;
+
+    if (first) {
+        printf("IDs: [");
+        shown = 0;
+    }
+
+    for (size_t i = 0; i < length / sizeof(int); i++) {
+        printf(shown++ == 0 ? "%d" : ", %d", ((int *)reply)[i]);
+    }
+
+    if (last) {
+        printf("]\n");
+    }
+
+    // let the user see the ids found so far
+    fflush(stdout);
+}
+
+int split_command(char *line, char **argv, int max_args) {
+    int argc = 1;
+    char quote = 0;
+    char *write = line;
+
+    argv[0] = "dclient";
+
+    while (*line != '\0' && *line != '\n' && argc < max_args) {
+        // skip the separators
+        while (*line == ' ' || *line == '\t') {
+            line++;
+        }
+
+        if (*line == '\0' || *line == '\n') {
+            break;
+        }
+
+        argv[argc++] = write;
+
+        // copy the argument, removing the quotes
+        while (*line != '\0' && *line != '\n') {
+            if (quote != 0 && *line == quote) {
+                quote = 0;
+            } else if (quote == 0 && (*line == '"' || *line == '\'')) {
+                quote = *line;
+            } else if (quote == 0 && (*line == ' ' || *line == '\t')) {
+                break;
+            } else {
+                *write++ = *line;
+            }
+
+            line++;
+        }
+
+        if (*line != '\0' && *line != '\n') {
+            line++;
+        }
+
+        *write++ = '\0';
+    }
+
+    return argc;
+}
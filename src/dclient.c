@@ -1,15 +1,41 @@
-
 #include "client_ops.h"
 #include "defs.h"
 #include "document.h"
+#include "protocol.h"
+#include "shared_memory.h"
+#include "transport.h"
 #include "utils.h"
 
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#define MAX_ARGS 16     /**< Maximum number of arguments in a session command */
+#define MAX_IN_FLIGHT 64    /**< Requests sent ahead of their replies (-b) */
+
+/**
+ * @brief Request waiting for its reply, in pipelined mode
+ */
+typedef struct {
+    int busy;               /**< The reply did not arrive yet */
+    unsigned line;          /**< Line of the command in the input file */
+    Request request;        /**< Request that was sent */
+    int *ids;               /**< Identifiers received so far (lists) */
+    unsigned n_ids;         /**< Number of identifiers in ids */
+} In_Flight;
+
+// shared memory slot, when the server serves through shared memory
+static Shm_Region *region = NULL;
+static int slot = -1;
+
+// sequence number of the next request
+static unsigned sequence = 0;
+
 static void usage(const char *command) {
     printf("Usage:\n");
     printf("%s -a 'title' 'authors' 'year' 'path'\n", command);
@@ -17,7 +43,609 @@ static void usage(const char *command) {
     printf("%s -c 'key'\n", command);
     printf("%s -l 'key' 'keyword'\n", command);
     printf("%s -s 'keyword' [nr_processes]\n", command);
+    printf("%s -w 'author'\n", command);
+    printf("%s -y 'year' ['last_year']\n", command);
+    printf("%s -p 'path'\n", command);
     printf("%s -f\n", command);
+    printf("%s -k (compact the metadata file)\n", command);
+    printf("%s -i (session, reads one command per line)\n", command);
+    printf("%s -A 'catalog.tsv' [limit]\n", command);
+    printf("%s -L 'key' [nr_requests] (consult latency)\n", command);
+    printf("%s -b 'commands.txt' (pipelined, one command per line)\n", command);
+}
+
+static int read_frame(int client, Header *header, char **payload) {
+    // receive response from server
+    int status = region != NULL ? shm_receive(region, slot, header, payload)
+                                : receive_frame(client, header, payload);
+    if (status == 1) {
+        printf("SERVER IS OFFLINE\n");
+        return 2;
+    }
+
+    return status == 0 ? 0 : 2;
+}
+
+/**
+ * @brief Tells whether the reply to an operation is a list of identifiers,
+ *        sent in frames until one without FRAME_MORE
+ */
+static int list_reply(Operation operation) {
+    return operation == LIST_WORD || operation == INDEX_BULK ||
+           operation == QUERY_AUTHOR || operation == QUERY_YEAR;
+}
+
+static int check_reply(Operation operation, const Header *header) {
+    // lists are made of whole identifiers
+    if (list_reply(operation) && header->length % sizeof(int) != 0) {
+        printf("Invalid reply\n");
+        return 2;
+    }
+
+    // integer replies must carry their value
+    if (operation != CONSULT && list_reply(operation) == 0 &&
+        operation != SESSION_OPEN && header->length < sizeof(int)) {
+        printf("Invalid reply\n");
+        return 2;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Adds the identifiers of a frame to those received before
+ */
+static int append_ids(int **ids, unsigned *n_ids, const char *payload,
+                      size_t length) {
+    unsigned count = length / sizeof(int);
+    if (count == 0) {
+        return 0;
+    }
+
+    int *other = (int *)realloc(*ids, (*n_ids + count) * sizeof(int));
+    if (other == NULL) {
+        return -1;
+    }
+
+    memcpy(other + *n_ids, payload, count * sizeof(int));
+    *ids = other;
+    *n_ids += count;
+
+    return 0;
+}
+
+static int fetch_reply(int client, const Request *request, Header *header,
+                       char **payload) {
+    if (read_frame(client, header, payload) != 0) {
+        return 2;
+    }
+
+    if (header->sequence != request->sequence) {
+        printf("Unexpected reply %u to request %u\n", header->sequence,
+               request->sequence);
+        free(*payload);
+        return 2;
+    }
+
+    if (check_reply(request->operation, header) != 0) {
+        free(*payload);
+        return 2;
+    }
+
+    return 0;
+}
+
+static int receive_reply(int client, const Request *request) {
+    Header header;
+    char *payload = NULL;
+    int first = 1;
+    int *ids = NULL;
+    unsigned n_ids = 0;
+
+    // lists come in frames, until one without FRAME_MORE
+    do {
+        if (fetch_reply(client, request, &header, &payload) != 0) {
+            free(ids);
+            return 2;
+        }
+
+        // show response to user, LIST_WORD batches as they arrive
+        if (request->operation == LIST_WORD) {
+            show_list_batch(payload, header.length, first,
+                            (header.flags & FRAME_MORE) == 0);
+        } else if (list_reply(request->operation)) {
+            if (append_ids(&ids, &n_ids, payload, header.length) != 0) {
+                free(payload);
+                free(ids);
+                return 2;
+            }
+
+            if ((header.flags & FRAME_MORE) == 0) {
+                show_reply(request->operation, (const char *)ids,
+                           n_ids * sizeof(int));
+            }
+        } else {
+            show_reply(request->operation, payload, header.length);
+        }
+
+        free(payload);
+        first = 0;
+    } while (header.flags & FRAME_MORE);
+
+    free(ids);
+    return 0;
+}
+
+static int send_request(int server, Request *request) {
+    char frame[MAX_REQUEST];
+
+    request->sequence = sequence++;
+
+    size_t length = encode_request(request, frame, sizeof(frame));
+    if (length == 0) {
+        printf("Request is too large\n");
+        return 2;
+    }
+
+    if (region != NULL) {
+        // copied straight into the request ring
+        if (shm_send(region, slot, frame, length) != 0) {
+            printf("SERVER IS OFFLINE\n");
+            return 2;
+        }
+
+        return 0;
+    }
+
+    ssize_t out = write(server, frame, length);
+    if (out == -1) {
+        perror("write()");
+        return 2;
+    }
+
+    return 0;
+}
+
+static void close_channel(int server, int client) {
+    // the socket is closed by the caller, with the sending side
+    if (client != server) {
+        close(client);
+    }
+}
+
+static int open_session(const char *fifo_name, int server, int *channel) {
+    // connected through the socket or shared memory, replies come back on
+    // the same channel
+    int client = server;
+
+    // open the private channel first, so the server never blocks on it
+    if (fifo_name != NULL) {
+        client = open(fifo_name, O_RDONLY | O_NONBLOCK);
+        if (client == -1) {
+            perror("open()");
+            return -1;
+        }
+    }
+
+    Request request;
+    memset(&request, 0, sizeof(request));
+    request.operation = SESSION_OPEN;
+    request.client = getpid();
+
+    if (send_request(server, &request) != 0) {
+        close_channel(server, client);
+        return -1;
+    }
+
+    // wait for the server to connect to the channel
+    struct pollfd ready = {.fd = client, .events = POLLIN};
+    if (region == NULL && poll(&ready, 1, -1) == -1) {
+        perror("poll()");
+        close_channel(server, client);
+        return -1;
+    }
+
+    if (fifo_name != NULL) {
+        fcntl(client, F_SETFL, fcntl(client, F_GETFL) & ~O_NONBLOCK);
+    }
+
+    if (receive_reply(client, &request) != 0) {
+        printf("Session refused by the server\n");
+        close_channel(server, client);
+        return -1;
+    }
+
+    *channel = client;
+    return 0;
+}
+
+static void close_session(int server, int client) {
+    Request request;
+    memset(&request, 0, sizeof(request));
+    request.operation = SESSION_CLOSE;
+    request.client = getpid();
+    send_request(server, &request);
+
+    close_channel(server, client);
+}
+
+static int run_session(const char *fifo_name, int server) {
+    int client = -1;
+    if (open_session(fifo_name, server, &client) != 0) {
+        return 2;
+    }
+
+    Request request;
+    char line[BUFSIZ];
+    char *args[MAX_ARGS];
+    int argc = 0, status = 0;
+
+    memset(&request, 0, sizeof(request));
+
+    // one command per line, with the same arguments as a single call
+    while (status == 0 && fgets(line, sizeof(line), stdin) != NULL) {
+        argc = split_command(line, args, MAX_ARGS);
+        if (argc < 2) {
+            continue;
+        }
+
+        memset(&request, 0, sizeof(request));
+        if (define_request(&request, argc, args) != 0) {
+            printf("Invalid input\n");
+            continue;
+        }
+
+        status = send_request(server, &request);
+        if (status != 0) {
+            break;
+        }
+
+        if (request.operation == SHUTDOWN) {
+            break;
+        }
+
+        status = receive_reply(client, &request);
+    }
+
+    if (request.operation == SHUTDOWN) {
+        close_channel(server, client);
+    } else {
+        close_session(server, client);
+    }
+
+    return status;
+}
+
+static int collect_reply(int client, In_Flight *flight, unsigned *pending) {
+    Header header;
+    char *payload = NULL;
+
+    if (read_frame(client, &header, &payload) != 0) {
+        return 2;
+    }
+
+    // replies may arrive in any order, the sequence number says whose it is
+    In_Flight *entry = flight + header.sequence % MAX_IN_FLIGHT;
+    if (entry->busy == 0 || entry->request.sequence != header.sequence) {
+        printf("Unexpected reply %u\n", header.sequence);
+        free(payload);
+        return 0;
+    }
+
+    Operation operation = entry->request.operation;
+    if (check_reply(operation, &header) != 0) {
+        free(payload);
+        return 2;
+    }
+
+    if (list_reply(operation)) {
+        // keep the frames until the last one
+        if (append_ids(&entry->ids, &entry->n_ids, payload,
+                       header.length) != 0) {
+            free(payload);
+            return 2;
+        }
+
+        free(payload);
+
+        if (header.flags & FRAME_MORE) {
+            return 0;
+        }
+
+        payload = (char *)entry->ids;
+        header.length = entry->n_ids * sizeof(int);
+        entry->ids = NULL;
+        entry->n_ids = 0;
+    }
+
+    printf("(%u) ", entry->line);
+    show_reply(operation, payload, header.length);
+    free(payload);
+
+    entry->busy = 0;
+    (*pending)--;
+
+    return 0;
+}
+
+static int run_pipeline(const char *fifo_name, int server,
+                        const char *commands) {
+    FILE *input = fopen(commands, "r");
+    if (input == NULL) {
+        perror("fopen()");
+        return 2;
+    }
+
+    int client = -1;
+    if (open_session(fifo_name, server, &client) != 0) {
+        fclose(input);
+        return 2;
+    }
+
+    In_Flight *flight = (In_Flight *)calloc(MAX_IN_FLIGHT, sizeof(In_Flight));
+    if (flight == NULL) {
+        close_session(server, client);
+        fclose(input);
+        return 2;
+    }
+
+    Request request;
+    char line[BUFSIZ];
+    char *args[MAX_ARGS];
+    int argc = 0, status = 0, stop = 0;
+    unsigned n_line = 0, sent = 0, pending = 0;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (status == 0 && stop == 0 && fgets(line, sizeof(line), input)) {
+        n_line++;
+
+        argc = split_command(line, args, MAX_ARGS);
+        if (argc < 2) {
+            continue;
+        }
+
+        memset(&request, 0, sizeof(request));
+        if (define_request(&request, argc, args) != 0) {
+            printf("(%u) Invalid input\n", n_line);
+            continue;
+        }
+
+        // the server stops at once, so wait for every reply first
+        stop = request.operation == SHUTDOWN;
+
+        // wait for the reply that holds the slot of this sequence number
+        In_Flight *entry = flight + sequence % MAX_IN_FLIGHT;
+        while (status == 0 && (entry->busy || (stop && pending > 0))) {
+            status = collect_reply(client, flight, &pending);
+        }
+
+        if (status != 0) {
+            break;
+        }
+
+        status = send_request(server, &request);
+        if (status != 0 || stop) {
+            break;
+        }
+
+        entry->busy = 1;
+        entry->line = n_line;
+        entry->request = request;
+        pending++;
+        sent++;
+    }
+
+    // collect the replies that are still on the way
+    while (status == 0 && pending > 0) {
+        status = collect_reply(client, flight, &pending);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("%u requests in %.3f s (%.0f requests/s)\n", sent, elapsed,
+           elapsed > 0 ? sent / elapsed : 0);
+
+    for (int i = 0; i < MAX_IN_FLIGHT; i++) {
+        free(flight[i].ids);
+    }
+    free(flight);
+    fclose(input);
+
+    if (stop) {
+        close_channel(server, client);
+    } else {
+        close_session(server, client);
+    }
+
+    return status;
+}
+
+static int parse_record(char *line, Document *doc) {
+    // filename, title, year and authors, separated by tabs
+    char *fields[4];
+    for (int i = 0; i < 4; i++) {
+        fields[i] = strsep(&line, "\t\n");
+        if (fields[i] == NULL) {
+            return 1;
+        }
+    }
+
+    if (strlen(fields[1]) >= TITLE_SIZE || strlen(fields[3]) >= AUTHORS_SIZE ||
+        strlen(fields[2]) > YEAR_SIZE || strlen(fields[0]) >= PATH_SIZE) {
+        return 1;
+    }
+
+    memset(doc, 0, sizeof(Document));
+    strcpy(doc->title, fields[1]);
+    strcpy(doc->authors, fields[3]);
+    strncpy(doc->year, fields[2], YEAR_SIZE);
+    strcpy(doc->path, fields[0]);
+
+    return 0;
+}
+
+static int run_bulk(const char *fifo_name, int server, const char *catalog,
+                    unsigned limit) {
+    FILE *input = fopen(catalog, "r");
+    if (input == NULL) {
+        perror("fopen()");
+        return 2;
+    }
+
+    int client = -1;
+    if (open_session(fifo_name, server, &client) != 0) {
+        fclose(input);
+        return 2;
+    }
+
+    // documents of one frame, a frame never holds more than this
+    Document batch[MAX_REQUEST / (4 * sizeof(uint16_t))];
+    size_t used = sizeof(Header) + sizeof(int32_t);
+    unsigned n_lines = 0, total = 0;
+    int status = 0, last = 0;
+    char line[BUFSIZ];
+
+    Request request;
+    memset(&request, 0, sizeof(request));
+    request.operation = INDEX_BULK;
+    request.client = getpid();
+    request.records = batch;
+
+    // skip the header line
+    last = fgets(line, sizeof(line), input) == NULL;
+
+    while (status == 0 && last == 0) {
+        last = fgets(line, sizeof(line), input) == NULL ||
+               (limit > 0 && n_lines >= limit);
+
+        Document *doc = batch + request.n_records;
+        if (last == 0) {
+            n_lines++;
+            if (parse_record(line, doc) != 0) {
+                printf("Skipping line %u of %s\n", n_lines + 1, catalog);
+                continue;
+            }
+        }
+
+        // send the frame when the document does not fit, or at the end
+        if (last != 0 || used + record_length(doc) > MAX_REQUEST) {
+            Document pending = *doc;
+
+            request.flags = last ? 0 : FRAME_MORE;
+            status = send_request(server, &request);
+            total += request.n_records;
+
+            batch[0] = pending;
+            request.n_records = 0;
+            used = sizeof(Header) + sizeof(int32_t);
+        }
+
+        if (last == 0) {
+            used += record_length(batch + request.n_records);
+            request.n_records++;
+        }
+    }
+
+    fclose(input);
+
+    if (status == 0) {
+        request.n_records = total;
+        status = receive_reply(client, &request);
+    }
+
+    close_session(server, client);
+
+    return status;
+}
+
+static int compare_times(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int run_latency(const char *fifo_name, int server, int key,
+                       unsigned count) {
+    double *times = (double *)calloc(count, sizeof(double));
+    if (times == NULL) {
+        return 2;
+    }
+
+    int client = -1;
+    if (open_session(fifo_name, server, &client) != 0) {
+        free(times);
+        return 2;
+    }
+
+    Request request;
+    memset(&request, 0, sizeof(request));
+    request.operation = CONSULT;
+    request.client = getpid();
+    request.key = key;
+
+    Header header;
+    char *payload = NULL;
+    struct timespec start, end;
+    int status = 0;
+    unsigned done = 0;
+
+    // one request at a time, so each sample is a full round trip
+    while (status == 0 && done < count) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        status = send_request(server, &request);
+        if (status == 0) {
+            status = fetch_reply(client, &request, &header, &payload);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        free(payload);
+        payload = NULL;
+
+        times[done++] = (end.tv_sec - start.tv_sec) * 1e6 +
+                        (end.tv_nsec - start.tv_nsec) / 1e3;
+    }
+
+    close_session(server, client);
+
+    if (status == 0) {
+        qsort(times, count, sizeof(double), compare_times);
+        printf("%u consults | p50 %.1f us | p99 %.1f us | max %.1f us\n",
+               count, times[(count - 1) * 50 / 100],
+               times[(count - 1) * 99 / 100], times[count - 1]);
+    }
+
+    free(times);
+
+    return status;
+}
+
+static int connect_shm(void) {
+    region = shm_attach();
+    if (region == NULL) {
+        return 1;
+    }
+
+    slot = shm_claim_slot(region);
+    if (slot == -1) {
+        // every slot is taken, use another transport
+        shm_detach(region);
+        region = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void disconnect_shm(void) {
+    if (region != NULL) {
+        shm_release_slot(region, slot);
+        shm_detach(region);
+        region = NULL;
+    }
 }
 
 int main(int argc, char **argv) {
@@ -28,8 +656,24 @@ int main(int argc, char **argv) {
     }
 
     Request request;
+    memset(&request, 0, sizeof(request));
+
+    int session = strcmp(argv[1], "-i") == 0;
+    int bulk = strcmp(argv[1], "-A") == 0;
+    int latency = strcmp(argv[1], "-L") == 0;
+    int pipeline = strcmp(argv[1], "-b") == 0;
+
+    // a latency run needs at least one request
+    if (((bulk != 0 || latency != 0) && argc != 3 && argc != 4) ||
+        (latency != 0 && argc == 4 && atoi(argv[3]) < 1) ||
+        (pipeline != 0 && argc != 3)) {
+        usage(argv[0]);
+        return 1;
+    }
+
     // validate user input
-    if (define_request(&request, argc, argv) != 0) {
+    if (session == 0 && bulk == 0 && latency == 0 && pipeline == 0 &&
+        define_request(&request, argc, argv) != 0) {
         printf("Invalid input\n");
         usage(argv[0]);
         return 1;
@@ -38,81 +682,96 @@ int main(int argc, char **argv) {
     char fifo_name[50];
     sprintf(fifo_name, "%s_%u", CLIENT_FIFO, getpid());
 
-    // create client fifo
-    if (create_fifo(fifo_name) != 0) {
-        printf("Error creating fifo %s\n", fifo_name);
-        return 2;
+    // prefer shared memory, then the socket, when the server offers them
+    int server = -1;
+    if (connect_shm() != 0) {
+        server = connect_socket();
     }
 
-    // open the server fifo
-    int server = open(SERVER_FIFO, O_WRONLY);
-    if (server == -1) {
-        printf("SERVER IS OFFLINE\n");
-        unlink(fifo_name);
-        return 2;
-    }
+    int use_fifo = region == NULL && server == -1;
 
-    // send request to server
-    ssize_t out = write(server, &request, sizeof(request));
-    close(server);
+    if (use_fifo) {
+        // create client fifo
+        if (create_fifo(fifo_name) != 0) {
+            printf("Error creating fifo %s\n", fifo_name);
+            return 2;
+        }
 
-    if (out == -1) {
-        perror("write()");
-        unlink(fifo_name);
-        return 2;
+        // open the server fifo
+        server = open(SERVER_FIFO, O_WRONLY);
+        if (server == -1) {
+            printf("SERVER IS OFFLINE\n");
+            unlink(fifo_name);
+            return 2;
+        }
     }
 
-    if (request.operation != SHUTDOWN) {
-        // open the private chanel
-        int client = open(fifo_name, O_RDONLY);
-        if (client == -1) {
-            perror("open()");
+    int status = 0;
+
+    if (session != 0 || bulk != 0 || latency != 0 || pipeline != 0) {
+        const char *channel = use_fifo ? fifo_name : NULL;
+
+        // many requests over the same channels
+        if (session != 0) {
+            status = run_session(channel, server);
+        } else if (bulk != 0) {
+            status = run_bulk(channel, server, argv[2],
+                              argc == 4 ? atoi(argv[3]) : 0);
+        } else if (pipeline != 0) {
+            status = run_pipeline(channel, server, argv[2]);
+        } else {
+            status = run_latency(channel, server, atoi(argv[2]),
+                                 argc == 4 ? atoi(argv[3]) : 10000);
+        }
+
+        if (server != -1) {
+            close(server);
+        }
+        if (use_fifo) {
             unlink(fifo_name);
-            return 2;
         }
+        disconnect_shm();
+        return status;
+    }
 
-        size_t response_size = 0;
-
-        switch (request.operation) {
-            case INDEX:
-                response_size = sizeof(int);
-                break;
-            case REMOVE:
-                response_size = sizeof(int);
-                break;
-            case CONSULT:
-                response_size = sizeof(Document);
-                break;
-            case COUNT_WORD:
-                response_size = sizeof(int);
-                break;
-            case LIST_WORD:
-                response_size = BUFSIZ * sizeof(sizeof(char));
-                break;
-            default:
-                break;
-        }
-
-        void *response = malloc(response_size);
-
-        // receive response from server
-        out = read(client, response, response_size);
-        close(client);
+    // send request to server
+    status = send_request(server, &request);
 
-        if (out == -1) {
-            perror("read()");
+    if (status != 0 || request.operation == SHUTDOWN) {
+        if (server != -1) {
+            close(server);
+        }
+        if (use_fifo) {
             unlink(fifo_name);
-            return 2;
         }
+        disconnect_shm();
+        return status;
+    }
 
-        unlink(fifo_name);
+    if (use_fifo == 0) {
+        // the reply comes back on the connection or the slot
+        status = receive_reply(server, &request);
+        if (server != -1) {
+            close(server);
+        }
+        disconnect_shm();
+        return status;
+    }
 
-        // show response to user
-        show_reply(request.operation, response);
-        free(response);
+    close(server);
+
+    // open the private chanel
+    int client = open(fifo_name, O_RDONLY);
+    if (client == -1) {
+        perror("open()");
+        unlink(fifo_name);
+        return 2;
     }
 
+    status = receive_reply(client, &request);
+    close(client);
+
     unlink(fifo_name);
 
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
@@ -14,7 +14,7 @@ Document *create_document(const char *title, const char *authors,
 
     strcpy(doc->title, title);
     strcpy(doc->authors, authors);
-    strcpy(doc->year, year);
+    strncpy(doc->year, year, YEAR_SIZE);
     strcpy(doc->path, path);
 
     return doc;
@@ -38,7 +38,7 @@ void show_document(const Document *doc) {
     if (doc != NULL) {
         printf("Title: %s\n", doc->title);
         printf("Authors: %s\n", doc->authors);
-        printf("Year: %s\n", doc->year);
+        printf("Year: %.*s\n", YEAR_SIZE, doc->year);
         printf("Path: %s\n", doc->path);
     }
 }
@@ -1,10 +1,11 @@
-
 #include "cache.h"
 #include "defs.h"
 #include "server_ops.h"
+#include "transport.h"
 #include "utils.h"
 
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -13,7 +14,22 @@
 
 static void usage(const char *command) {
     printf("Usage:\n");
-    printf("%s document_folder cache_size [-g] [cache_type]\n", command);
+    printf("%s document_folder cache_size [-g] [-u | -m] [-w workers] [-t threads] [-r] [-j records] [-c changes] [-p threads] [-e engine] [-i table] [cache_type]\n", command);
+    printf("  -g  turn off debugging messages\n");
+    printf("  -u  serve clients through a unix socket instead of fifos\n");
+    printf("  -m  serve clients through shared memory instead of fifos\n");
+    printf("  -w  number of worker processes (default %d, 0 forks for every reply)\n",
+           DEFAULT_WORKERS);
+    printf("  -t  number of threads serving reads (default 0, served by the loop)\n");
+    printf("  -r  read the metadata file with pread() instead of mapping it\n");
+    printf("  -j  changes logged between calls to fsync() (default %d, 0 never syncs)\n",
+           DEFAULT_SYNC_EVERY);
+    printf("  -c  changes between checkpoints (default %d, 0 only at startup and shutdown)\n",
+           DEFAULT_CHECKPOINT_EVERY);
+    printf("  -p  threads rebuilding the index from the metadata file when the control file is missing (default %d)\n",
+           DEFAULT_RECOVERY_THREADS);
+    printf("  -e  engine reading block consults with -r and searched documents, sync or uring (default sync)\n");
+    printf("  -i  index table, bitmap or roaring (default bitmap)\n");
 }
 
 int main(int argc, char **argv) {
@@ -26,18 +42,92 @@ int main(int argc, char **argv) {
         return 0;
     }
 
-    // determine the cache type
     Cache_Type type = NONE;
-    if (strcmp(argv[argc - 1], "FIFO") == 0) {
-        type = FIFO;
-    } else if (strcmp(argv[argc - 1], "RAND") == 0) {
-        type = RAND;
-    } else if (strcmp(argv[argc - 1], "LRU") == 0) {
-        type = LRU;
+    Transport transport = TRANSPORT_FIFO;
+    int quiet = 0;
+    int workers = DEFAULT_WORKERS;
+    int threads = 0;
+    int map = 1;
+    int sync_every = DEFAULT_SYNC_EVERY;
+    int checkpoint_every = DEFAULT_CHECKPOINT_EVERY;
+    int recovery_threads = DEFAULT_RECOVERY_THREADS;
+    int uring = 0;
+    Table_Type table = TABLE_BITMAP;
+
+    // optional arguments, in any order
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "FIFO") == 0) {
+            type = FIFO;
+        } else if (strcmp(argv[i], "RAND") == 0) {
+            type = RAND;
+        } else if (strcmp(argv[i], "LRU") == 0) {
+            type = LRU;
+        } else if (strcmp(argv[i], "-g") == 0) {
+            quiet = 1;
+        } else if (strcmp(argv[i], "-u") == 0) {
+            transport = TRANSPORT_SOCKET;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            transport = TRANSPORT_SHM;
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+            if (workers < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-r") == 0) {
+            map = 0;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            sync_every = atoi(argv[++i]);
+            if (sync_every < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            checkpoint_every = atoi(argv[++i]);
+            if (checkpoint_every < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            recovery_threads = atoi(argv[++i]);
+            if (recovery_threads < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "uring") == 0) {
+                uring = 1;
+            } else if (strcmp(argv[i], "sync") == 0) {
+                uring = 0;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "roaring") == 0) {
+                table = TABLE_ROARING;
+            } else if (strcmp(argv[i], "bitmap") == 0) {
+                table = TABLE_BITMAP;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
     }
 
     // turn off debugging messages
-    if ((strcmp(argv[argc - 1], "-g") == 0) || (strcmp(argv[argc - 2], "-g") == 0)) {
+    if (quiet) {
         int trash = open("/dev/null", O_WRONLY);
         if (trash == -1) {
             perror("open()");
@@ -49,41 +139,52 @@ int main(int argc, char **argv) {
     }
 
     // create server fifo
-    if (create_fifo(SERVER_FIFO) != 0) {
+    if (transport == TRANSPORT_FIFO && create_fifo(SERVER_FIFO) != 0) {
         printf("Error creating fifo %s\n", SERVER_FIFO);
         return 2;
     }
 
-    // start the server (open files, create data structures, ...)
-    Server *server = start_server(argv[1], atoi(argv[2]), type);
-
-    Request request;
-    int stop = 0, input = 0;
-    ssize_t out = 0;
+    // a client that leaves a session early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
 
-    while (stop == 0) {
-        // open the server fifo
-        input = open(SERVER_FIFO, O_RDONLY);
-        if (input == -1) {
-            perror("open()");
-            break;
+    // the workers must inherit the mapping of the shared memory region
+    Shm_Region *region = NULL;
+    if (transport == TRANSPORT_SHM) {
+        region = shm_create();
+        if (region == NULL) {
+            return 2;
         }
+    }
 
-        // receive request from client
-        out = read(input, &request, sizeof(request));
-        close(input);
+    // start the server (open files, create data structures, ...)
+    Server *server = start_server(argv[1], atoi(argv[2]), type, workers,
+                                  threads, map, sync_every,
+                                  checkpoint_every, recovery_threads, uring,
+                                  table);
+    if (server == NULL) {
+        unlink(SERVER_FIFO);
+        shm_destroy(region);
+        return 2;
+    }
 
-        if (out == -1) {
-            perror("read()");
-            break;
-        }
+    int status = 0;
 
-        // process request
-        stop = process_request(server, &request);
+    // serve requests until a shutdown is requested
+    switch (transport) {
+        case TRANSPORT_SOCKET:
+            status = run_socket_loop(server);
+            break;
+        case TRANSPORT_SHM:
+            status = run_shm_loop(server, region);
+            break;
+        default:
+            status = run_fifo_loop(server);
+            break;
     }
 
     // shut down the server (close files, free data structures, ...)
     shutdown_server(server);
+    shm_destroy(region);
 
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
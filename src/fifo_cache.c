@@ -1,6 +1,8 @@
 
 #include "fifo_cache.h"
 #include "defs.h"
+#include "slot_map.h"
+#include "storage.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +31,11 @@ typedef struct fifo {
      */
     int *identifiers;
 
+    /**
+     * @brief Slot of each cached identifier, kept in sync with identifiers.
+     */
+    Slot_Map *map;
+
     /**
      * @brief Index to the back (insertion point) of the FIFO queue.
      *
@@ -42,16 +49,16 @@ typedef struct fifo {
     int size;
 
     /**
-     * @brief File descriptor for the source file.
+     * @brief Storage of the metadata.
      *
-     * This file descriptor is used to fetch documents on a cache miss.
+     * The mapping of the file is used to fetch documents on a cache miss.
      */
-    int source;
+    const Storage *source;
 } FIFO_Cache;
 
 
-void *fifoc_create(int cache_size, int source) {
-    if (cache_size < 0 || source < 0) {
+void *fifoc_create(int cache_size, const Storage *source) {
+    if (cache_size < 0 || source == NULL) {
         return NULL;
     }
 
@@ -80,6 +87,14 @@ void *fifoc_create(int cache_size, int source) {
     // ids also work as valid bits, -1 is invalid
     memset(cache->identifiers, -1, cache->size * sizeof(int));
 
+    cache->map = sm_create(cache->size);
+    if (cache->map == NULL) {
+        free(cache->identifiers);
+        free(cache->documents);
+        free(cache);
+        return NULL;
+    }
+
     cache->back = 0;
     cache->source = source;
 
@@ -97,6 +112,7 @@ void fifoc_destroy(void *cache) {
             free(fifo->identifiers);
         }
 
+        sm_destroy(fifo->map);
         free(fifo);
     }
 }
@@ -110,45 +126,36 @@ Document *fifoc_get_document(void *cache, int identifier) {
 
     printf("[CACHE INFO] searching in memory for %d\n", identifier);
 
-    int i;
-    // search the document in the cache
-    for (i = 0; i < fifo->size && fifo->identifiers[i] != identifier; i++)
-        ;
+    int i = sm_find(fifo->map, identifier);
 
     // document is not in cache
-    if (i == fifo->size) {
+    if (i == -1) {
         // get BLOCK_SIZE documents from metadata.bin
 
         printf("[CACHE INFO] going to disk for %d\n", identifier);
 
-        Document *docs = (Document *)calloc(BLOCK_SIZE, sizeof(Document));
-        if (docs == NULL) {
-            return NULL;
+        // the block goes to the back of the queue
+        int wanted = BLOCK_SIZE < fifo->size ? BLOCK_SIZE : fifo->size;
+        Document *slots[BLOCK_SIZE];
+        for (i = 0; i < wanted; i++) {
+            int slot = (fifo->back + i) % fifo->size;
+            slots[i] = fifo->documents + slot;
+            sm_set(fifo->map, fifo->identifiers, slot, -1);
         }
 
-        // go to the right position
-        lseek(fifo->source, identifier * sizeof(Document), SEEK_SET);
-
-        // read the documents from disk
-        ssize_t out = read(fifo->source, docs, BLOCK_SIZE * sizeof(Document));
-        if (out == -1) {
-            perror("read()");
+        // read the block straight into the cache slots
+        int temp_size = storage_read_block(fifo->source, identifier, slots,
+                                           wanted);
+        if (temp_size <= 0) {
             return NULL;
         }
 
-        Document *result = clone_document(docs);
-
-        // number of documents read, less or equal than BLOCK_SIZE
-        int temp_size = out / sizeof(Document);
-
-        // fill the cache with a new block
         for (i = 0; i < temp_size; i++) {
-            memcpy(fifo->documents + fifo->back, docs + i, sizeof(docs[i]));
-            fifo->identifiers[fifo->back] = identifier + i;
+            sm_set(fifo->map, fifo->identifiers, fifo->back, identifier + i);
             fifo->back = (fifo->back + 1) % fifo->size;
         }
 
-        return result;
+        return clone_document(slots[0]);
     }
 
     return clone_document(fifo->documents + i);
@@ -160,7 +167,7 @@ void fifoc_add_document(void *cache, int identifier, Document * doc) {
 
         // place the document at the back of the queue
         memcpy(fifo->documents + fifo->back, doc, sizeof(Document));
-        fifo->identifiers[fifo->back] = identifier;
+        sm_set(fifo->map, fifo->identifiers, fifo->back, identifier);
         fifo->back = (fifo->back + 1) % fifo->size;
     }
 }
@@ -170,13 +177,11 @@ void fifoc_remove_document(void *cache, int identifier) {
     if (cache != NULL && identifier >= 0) {
         FIFO_Cache * fifo = (FIFO_Cache *) cache;
 
-        int i = 0;
-        // search for the document
-        for (; i < fifo->size && fifo->identifiers[i] != identifier; i++);
+        int i = sm_find(fifo->map, identifier);
 
         // found the document
-        if (i < fifo->size) {
-            fifo->identifiers[i] = -1;
+        if (i != -1) {
+            sm_set(fifo->map, fifo->identifiers, i, -1);
         }
     }
 }
@@ -1,68 +1,52 @@
 
 #include "free_list.h"
-#include "document.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
-/**
- * @brief Node structure for the free list
- * 
- * Represents a single available document slot in storage.
- * Forms the building block of the Free_List linked list.
- */
-struct link {
-    int id;                 /**< Document Identifier */
-    struct link *next;      /**< Pointer to the next node */
-};
+#define INIT_WORDS 1        /**< Initial number of words of the list */
+#define WORD_BITS 64        /**< Number of bits in a word */
 
 /**
  * @brief Free list management structure
- * 
- * Maintains a linked list of available document slots in storage.
- * Provides O(1) insertion/removal from the head of the list.
+ *
+ * One bit per identifier, set when the identifier is free, in a contiguous
+ * array of 64-bit words. Identifiers are added and removed in constant time
+ * without allocating, and the lowest free identifier is always the next
+ * one given, so live records stay packed at the start of the storage.
  */
 typedef struct free_list {
-    struct link *head;      /**< Pointer to the head of the list */
-    unsigned size;          /**< Number of elements on the list */
+    uint64_t *words;        /**< Free bits */
+    unsigned capacity;      /**< Number of words */
+    unsigned size;          /**< Number of free identifiers */
+    unsigned low;           /**< No word below this one has a free bit */
 } Free_List;
 
-static struct link *create_link(int id) {
-    struct link *node = (struct link *)calloc(1, sizeof(struct link));
-    if (node == NULL) {
-        return NULL;
-    }
-
-    node->id = id;
-    node->next = NULL;
-
-    return node;
-}
-
 Free_List *fl_create(void) {
     Free_List *fl = (Free_List *)calloc(1, sizeof(Free_List));
     if (fl == NULL) {
         return NULL;
     }
 
-    fl->head = NULL;
+    fl->capacity = INIT_WORDS;
     fl->size = 0;
+    fl->low = 0;
+
+    fl->words = (uint64_t *)calloc(fl->capacity, sizeof(uint64_t));
+    if (fl->words == NULL) {
+        free(fl);
+        return NULL;
+    }
 
     return fl;
 }
 
 void fl_destroy(Free_List *fl) {
     if (fl != NULL) {
-        struct link *temp = fl->head, *other = NULL;
-
-        // free every node
-        while (temp != NULL) {
-            other = temp->next;
-            free(temp);
-            temp = other;
-        }
-
+        free(fl->words);
         free(fl);
     }
 }
@@ -71,112 +55,219 @@ int fl_push(Free_List *fl, int id) {
     if (fl == NULL || id < 0)
         return -1;
 
-    struct link *new_node = create_link(id);
-    if (new_node == NULL) {
-        return 1;
+    unsigned word = id / WORD_BITS;
+    uint64_t bit = (uint64_t)1 << (id % WORD_BITS);
+
+    if (word >= fl->capacity) {
+        // double the size
+        unsigned new_capacity = fl->capacity * 2;
+        if (word >= new_capacity) {
+            new_capacity = word + 1;
+        }
+
+        uint64_t *other = (uint64_t *)realloc(
+            fl->words, new_capacity * sizeof(uint64_t));
+        if (other == NULL) {
+            return 1;
+        }
+
+        // the new identifiers are not free
+        memset(other + fl->capacity, 0,
+               (new_capacity - fl->capacity) * sizeof(uint64_t));
+
+        fl->words = other;
+        fl->capacity = new_capacity;
+    }
+
+    // an identifier already free is not counted twice
+    if ((fl->words[word] & bit) == 0) {
+        fl->words[word] |= bit;
+        fl->size++;
     }
 
-    // add the new node to the head
-    new_node->next = fl->head;
-    fl->head = new_node;
-    fl->size++;
+    if (word < fl->low) {
+        fl->low = word;
+    }
 
     return 0;
 }
 
 int fl_pop(Free_List *fl) {
-    if (fl == NULL) {
+    if (fl == NULL || fl->size == 0) {
+        // empty list
         return -1;
     }
 
-    struct link *temp = fl->head;
-    if (temp == NULL) {
-        // empty list
-        return -1;
+    // words below low are empty, so the first set bit from there is the
+    // lowest free identifier
+    while (fl->words[fl->low] == 0) {
+        fl->low++;
     }
 
-    int result = temp->id;
-    temp = temp->next;
+    uint64_t bits = fl->words[fl->low];
+    int result = fl->low * WORD_BITS + __builtin_ctzll(bits);
 
-    // remove the head of the list
-    free(fl->head);
-    fl->head = temp;
+    fl->words[fl->low] = bits & (bits - 1);
     fl->size--;
 
     return result;
 }
 
+int fl_remove(Free_List *fl, int id) {
+    if (fl == NULL || id < 0) {
+        return -1;
+    }
+
+    unsigned word = id / WORD_BITS;
+    uint64_t bit = (uint64_t)1 << (id % WORD_BITS);
+
+    if (word >= fl->capacity || (fl->words[word] & bit) == 0) {
+        return -1;
+    }
+
+    fl->words[word] &= ~bit;
+    fl->size--;
+
+    return 0;
+}
+
 unsigned fl_size(const Free_List *fl) { return fl == NULL ? 0 : fl->size; }
 
 bool fl_is_empty(const Free_List *fl) { return fl == NULL || fl->size == 0; }
 
 void fl_show(const Free_List *fl) {
     if (fl != NULL) {
-        struct link *temp = fl->head;
-
         printf("\n- FREE LIST [size: %3u]\n", fl->size);
-        while (temp != NULL) {
-            printf("[%4d, %5ld]\n", temp->id, temp->id * sizeof(Document));
-            temp = temp->next;
+
+        for (unsigned i = fl->low; i < fl->capacity; i++) {
+            for (uint64_t bits = fl->words[i]; bits != 0; bits &= bits - 1) {
+                int id = i * WORD_BITS + __builtin_ctzll(bits);
+                printf("[%4d]\n", id);
+            }
         }
     }
 }
 
 Free_List *fl_upload(int file) {
-    Free_List *fl = fl_create();
-    if (fl == NULL) {
-        return NULL;
-    }
-
     unsigned size = 0;
 
     // read the number of links
     ssize_t out = read(file, &size, sizeof(size));
     if (out == -1) {
         perror("read()");
-        return fl;
     }
 
-    if (out == 0) {
-        return fl;
+    if (out <= 0 || size == 0) {
+        return fl_create();
     }
 
-    int temp;
-    unsigned i = 0;
-
-    // iterate over the recorded links
-    while (i < size && (out = read(file, &temp, sizeof(temp))) > 0) {
-        // add the id to the free list
-        if (fl_push(fl, temp) != 0) {
-            return fl;
-        }
-
-        i++;
+    char *data = (char *)malloc(sizeof(size) + size * sizeof(int));
+    if (data == NULL) {
+        return NULL;
     }
 
+    // every id in a single read
+    memcpy(data, &size, sizeof(size));
+    out = read(file, data + sizeof(size), size * sizeof(int));
     if (out == -1) {
-        perror("read() 2");
+        perror("read()");
+        out = 0;
     }
 
-    return fl;
+    Free_List *fl = fl_restore(data, sizeof(size) + out, NULL);
+    free(data);
+
+    return fl != NULL ? fl : fl_create();
 }
 
 void fl_record(const Free_List *fl, int file) {
     if (fl != NULL) {
-        // record the size of the list in the file
-        ssize_t out = write(file, &(fl->size), sizeof(fl->size));
+        size_t size = fl_snapshot(fl, NULL);
+        char *data = (char *)malloc(size);
+        if (data == NULL) {
+            return;
+        }
 
-        struct link *temp = fl->head;
+        // the size and every id in a single write
+        fl_snapshot(fl, data);
+        if (write(file, data, size) == -1) {
+            perror("write()");
+        }
 
-        // record every id from the list in the file
-        while (temp != NULL && out > 0) {
-            out = write(file, &(temp->id), sizeof(temp->id));
+        free(data);
+    }
+}
 
-            temp = temp->next;
+size_t fl_snapshot(const Free_List *fl, void *out) {
+    unsigned size = fl_size(fl);
+
+    if (out != NULL) {
+        char *cursor = (char *)out;
+        memcpy(cursor, &size, sizeof(size));
+        cursor += sizeof(size);
+
+        // ids in increasing order, the order they are given in
+        for (unsigned i = fl->low; i < fl->capacity; i++) {
+            for (uint64_t bits = fl->words[i]; bits != 0; bits &= bits - 1) {
+                int id = i * WORD_BITS + __builtin_ctzll(bits);
+                memcpy(cursor, &id, sizeof(id));
+                cursor += sizeof(id);
+            }
         }
+    }
 
-        if (out == -1) {
-            perror("write()");
+    return sizeof(size) + size * sizeof(int);
+}
+
+Free_List *fl_restore(const void *data, size_t size, size_t *used) {
+    const char *bytes = (const char *)data;
+    unsigned count = 0;
+
+    if (size == 0) {
+        if (used != NULL) {
+            *used = 0;
+        }
+        return fl_create();
+    }
+
+    if (size < sizeof(count)) {
+        return NULL;
+    }
+
+    memcpy(&count, bytes, sizeof(count));
+    if ((size - sizeof(count)) / sizeof(int) < count) {
+        return NULL;
+    }
+
+    Free_List *fl = fl_create();
+    if (fl == NULL) {
+        return NULL;
+    }
+
+    // copies of older lists, in the order of a stack, give the same set
+    int id = 0, highest = -1;
+    for (unsigned i = 0; i < count; i++) {
+        memcpy(&id, bytes + sizeof(count) + i * sizeof(int), sizeof(int));
+        highest = id > highest ? id : highest;
+    }
+
+    // the words are allocated once, for the highest identifier
+    if (highest >= 0 && fl_push(fl, highest) != 0) {
+        fl_destroy(fl);
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        memcpy(&id, bytes + sizeof(count) + i * sizeof(int), sizeof(int));
+        if (fl_push(fl, id) != 0) {
+            fl_destroy(fl);
+            return NULL;
         }
     }
-}
\ No newline at end of file
+
+    if (used != NULL) {
+        *used = sizeof(count) + count * sizeof(int);
+    }
+
+    return fl;
+}
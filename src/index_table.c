@@ -1,47 +1,121 @@
 
 #include "index_table.h"
-#include "document.h"
+#include "roaring_table.h"
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 
-#define INIT_SIZE 4         /**< Initial size for the Table */
-#define SET_SIZE 8          /**< Number of bits in a character */
+#define INIT_WORDS 1        /**< Initial number of words of the table */
+#define WORD_BITS 64        /**< Number of bits in a word */
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_AVX2 1         /**< Empty words can be skipped four at a time */
+#endif
 
 /**
  * @brief Compact bit-based index table for tracking document validity
  *
  * Space-efficient structure where each bit represents the validity status
  * (1 = valid/exists, 0 = invalid/removed) of a document in storage.
- * Provides O(1) validity checks and minimal memory overhead.
+ * Provides O(1) validity checks and minimal memory overhead. The bits are
+ * kept in 64-bit words, so runs of invalid documents are skipped a word
+ * (or, with AVX2, four words) at a time.
+ *
+ * A TABLE_ROARING table keeps no words, every operation goes to the
+ * compressed table instead.
  */
 typedef struct index_table {
-    unsigned capacity;      /**< Array capacity */
+    Table_Type type;        /**< Representation of the valid bits */
+    unsigned capacity;      /**< Number of words */
     unsigned count;         /**< Number of documents indexed */
-    char *table;            /**< Array of valid bits */
+    uint64_t *table;        /**< Array of valid bits */
+    Roaring_Table *roaring; /**< Compressed table, with TABLE_ROARING */
 } Index_Table;
 
-Index_Table *it_create(void) {
+#ifdef HAVE_AVX2
+__attribute__((target("avx2"))) static unsigned
+next_word_avx2(const uint64_t *words, unsigned from, unsigned capacity) {
+    // 256 identifiers per test
+    while (from + 4 <= capacity) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(words + from));
+        if (_mm256_testz_si256(block, block) == 0) {
+            break;
+        }
+        from += 4;
+    }
+
+    while (from < capacity && words[from] == 0) {
+        from++;
+    }
+
+    return from;
+}
+#endif
+
+/**
+ * @brief Finds the first word, from a given one, with a valid entry
+ *
+ * @return Position of the word, capacity if there is none
+ */
+static unsigned next_word(const uint64_t *words, unsigned from,
+                          unsigned capacity) {
+#ifdef HAVE_AVX2
+    static int avx2 = -1;
+    if (avx2 == -1) {
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    if (avx2) {
+        return next_word_avx2(words, from, capacity);
+    }
+#endif
+
+    while (from < capacity && words[from] == 0) {
+        from++;
+    }
+
+    return from;
+}
+
+static unsigned count_bits(const uint64_t *words, unsigned capacity) {
+    unsigned count = 0;
+    for (unsigned i = 0; i < capacity; i++) {
+        count += __builtin_popcountll(words[i]);
+    }
+
+    return count;
+}
+
+Index_Table *it_create(Table_Type type) {
     Index_Table *it = (Index_Table *)calloc(1, sizeof(Index_Table));
     if (it == NULL) {
         return NULL;
     }
 
-    it->capacity = INIT_SIZE;
+    it->type = type;
+    if (type == TABLE_ROARING) {
+        it->roaring = rt_create();
+        if (it->roaring == NULL) {
+            free(it);
+            return NULL;
+        }
+        return it;
+    }
+
+    it->capacity = INIT_WORDS;
     it->count = 0;
 
-    it->table = (char *)calloc(it->capacity, sizeof(char));
+    // initialize the table with invalid entries
+    it->table = (uint64_t *)calloc(it->capacity, sizeof(uint64_t));
     if (it->table == NULL) {
         free(it);
         return NULL;
     }
 
-    // initialize the table with invalid entries
-    memset(it->table, 0, it->capacity * sizeof(char));
-
     return it;
 }
 
@@ -50,6 +124,7 @@ void it_destroy(Index_Table *it) {
         if (it->table != NULL) {
             free(it->table);
         }
+        rt_destroy(it->roaring);
         free(it);
     }
 }
@@ -59,11 +134,15 @@ int it_add_entry(Index_Table *it, int id) {
         return -1;
     }
 
-    unsigned set = id / SET_SIZE;
-    unsigned entry = id % SET_SIZE;
+    if (it->type == TABLE_ROARING) {
+        return rt_add_entry(it->roaring, id);
+    }
 
-    // table is full or set is larger than capacity
-    if ((it->capacity * SET_SIZE) == it->count || set >= it->capacity) {
+    unsigned set = id / WORD_BITS;
+    unsigned entry = id % WORD_BITS;
+
+    // set is larger than capacity
+    if (set >= it->capacity) {
 
         // double the size
         unsigned new_capacity = it->capacity * 2;
@@ -73,41 +152,52 @@ int it_add_entry(Index_Table *it, int id) {
         }
 
         // allocate more space
-        char *other = (char *)realloc(it->table, new_capacity * sizeof(char));
+        uint64_t *other =
+            (uint64_t *)realloc(it->table, new_capacity * sizeof(uint64_t));
         if (other == NULL) {
             return 1;
         }
 
         // set the new entries to 0
-        memset(other + it->capacity, 0, it->capacity * sizeof(char));
+        memset(other + it->capacity, 0,
+               (new_capacity - it->capacity) * sizeof(uint64_t));
 
         it->table = other;
         it->capacity = new_capacity;
     }
 
+    // an entry that is already valid is not counted twice
+    if (((it->table[set] >> entry) & 1) == 0) {
+        it->count++;
+    }
+
     // turn the bit to 1
-    it->table[set] |= (1 << entry);
-    it->count++;
+    it->table[set] |= (uint64_t)1 << entry;
 
     return 0;
 }
 
 int it_remove_entry(Index_Table *it, int id) {
-    if (it == NULL) {
+    if (it == NULL || id < 0) {
         return -1;
     }
 
-    unsigned set = id / SET_SIZE;
+    if (it->type == TABLE_ROARING) {
+        return rt_remove_entry(it->roaring, id);
+    }
+
+    unsigned set = id / WORD_BITS;
     if (set >= it->capacity) {
         return -1;
     }
 
-    unsigned entry = id % SET_SIZE;
+    unsigned entry = id % WORD_BITS;
 
     // check if the bit is set
     if ((it->table[set] >> entry) & 1) {
         // turn the bit to 0
-        it->table[set] &= ~(1 << entry);
+        it->table[set] &= ~((uint64_t)1 << entry);
+        it->count--;
         return id;
     }
 
@@ -115,90 +205,247 @@ int it_remove_entry(Index_Table *it, int id) {
 }
 
 int it_entry_is_valid(const Index_Table *it, int id) {
-    if (it == NULL) {
+    if (it == NULL || id < 0) {
         return 0;
     }
 
-    unsigned set = id / SET_SIZE;
+    if (it->type == TABLE_ROARING) {
+        return rt_entry_is_valid(it->roaring, id);
+    }
+
+    unsigned set = id / WORD_BITS;
     if (set >= it->capacity) {
         return 0;
     }
 
-    unsigned entry = id % SET_SIZE;
+    unsigned entry = id % WORD_BITS;
 
     // check if the bit is set
     return (it->table[set] >> entry) & 1;
 }
 
-unsigned it_size(const Index_Table *it) { return it == NULL ? 0 : it->count; }
+unsigned it_size(const Index_Table *it) {
+    if (it != NULL && it->type == TABLE_ROARING) {
+        return rt_size(it->roaring);
+    }
+
+    return it == NULL ? 0 : it->count;
+}
 
-bool it_is_empty(const Index_Table *it) { return it != NULL && it->count == 0; }
+bool it_is_empty(const Index_Table *it) { return it != NULL && it_size(it) == 0; }
 
 void it_show(const Index_Table *it) {
-    if (it != NULL) {
+    if (it != NULL && it->type == TABLE_ROARING) {
+        rt_show(it->roaring);
+    } else if (it != NULL) {
 
         printf("\n- INDEX TABLE [capacity: %5u, count: %5u]\n",
-               it->capacity * SET_SIZE, it->count);
-        printf("[INDEX, VALID, POSITION]\n");
+               it->capacity * WORD_BITS, it->count);
+        printf("[INDEX, VALID]\n");
 
         unsigned j = 0;
         for (unsigned i = 0; i < it->capacity; i++) {
-            for (j = 0; j < SET_SIZE; j++) {
-                printf("[%5u, %u, %8ld]\n", i * SET_SIZE + j,
-                       (it->table[i] >> j) & 1,
-                       (i * SET_SIZE + j) * sizeof(Document));
+            for (j = 0; j < WORD_BITS; j++) {
+                printf("[%5u, %u]\n", i * WORD_BITS + j,
+                       (unsigned)(it->table[i] >> j) & 1);
             }
         }
     }
 }
 
-Index_Table *it_upload(int file) {
-    Index_Table *it = it_create();
-    if (it == NULL) {
+Index_Table *it_upload(int file, Table_Type type) {
+    size_t size = 0, capacity = 4096;
+    char *data = (char *)malloc(capacity);
+    if (data == NULL) {
         return NULL;
     }
 
-    // read the number of entries recorded
-    ssize_t out = read(file, &(it->capacity), sizeof(it->capacity));
+    // the table is the rest of the file, a compressed one doesn't start
+    // with its size
+    ssize_t out = 0;
+    while ((out = read(file, data + size, capacity - size)) > 0) {
+        size += out;
+        if (size == capacity) {
+            char *other = (char *)realloc(data, capacity * 2);
+            if (other == NULL) {
+                break;
+            }
+            data = other;
+            capacity *= 2;
+        }
+    }
     if (out == -1) {
         perror("read()");
-        return it;
     }
 
-    if (out == 0) {
-        return it;
+    Index_Table *it = it_restore(data, size, type, NULL);
+    free(data);
+
+    return it != NULL ? it : it_create(type);
+}
+
+void it_record(const Index_Table *it, int file) {
+    if (it != NULL) {
+        size_t size = it_snapshot(it, NULL);
+        char *data = (char *)malloc(size);
+        if (data == NULL) {
+            return;
+        }
+
+        // capacity, count and the table in a single write
+        it_snapshot(it, data);
+        if (write(file, data, size) == -1) {
+            perror("write()");
+        }
+
+        free(data);
     }
+}
 
-    // read the number of valid documents
-    out = read(file, &(it->count), sizeof(it->count));
+size_t it_snapshot(const Index_Table *it, void *out) {
+    // a capacity of 0, which a table of words never has, marks a
+    // compressed table
+    if (it->type == TABLE_ROARING) {
+        unsigned marker = 0;
+        if (out != NULL) {
+            memcpy(out, &marker, sizeof(marker));
+            rt_snapshot(it->roaring, (char *)out + sizeof(marker));
+        }
+        return sizeof(marker) + rt_snapshot(it->roaring, NULL);
+    }
 
-    it->table = (char *)realloc(it->table, it->capacity * sizeof(char));
+    // the words are little-endian, so the bits are in the same bytes as
+    // in the byte array of the earlier format, and the size is in bytes
+    unsigned capacity = it->capacity * sizeof(uint64_t);
 
-    // read the valid bits into the table
-    out = read(file, it->table, it->capacity * sizeof(char));
+    if (out != NULL) {
+        char *cursor = (char *)out;
+        memcpy(cursor, &capacity, sizeof(capacity));
+        memcpy(cursor + sizeof(capacity), &(it->count), sizeof(it->count));
+        memcpy(cursor + sizeof(capacity) + sizeof(it->count), it->table,
+               capacity);
+    }
 
-    if (out == -1) {
-        perror("read()");
+    return sizeof(capacity) + sizeof(it->count) + capacity;
+}
+
+/**
+ * @brief Rebuilds a table of words from a copy made by it_snapshot()
+ */
+static Index_Table *restore_words(const char *bytes, size_t size,
+                                  size_t *used) {
+    unsigned capacity = 0, count = 0;
+
+    if (size < sizeof(capacity) + sizeof(count)) {
+        return NULL;
+    }
+
+    memcpy(&capacity, bytes, sizeof(capacity));
+    memcpy(&count, bytes + sizeof(capacity), sizeof(count));
+    size -= sizeof(capacity) + sizeof(count);
+
+    if (capacity == 0 || size < capacity) {
+        return NULL;
+    }
+
+    Index_Table *it = (Index_Table *)calloc(1, sizeof(Index_Table));
+    if (it == NULL) {
+        return NULL;
+    }
+
+    it->type = TABLE_BITMAP;
+
+    // older tables are sized in bytes, the last word is padded with zeros
+    it->capacity = (capacity + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    it->table = (uint64_t *)calloc(it->capacity, sizeof(uint64_t));
+    if (it->table == NULL) {
+        free(it);
+        return NULL;
+    }
+
+    // the valid bits are copied as they are, and counted again
+    memcpy(it->table, bytes + sizeof(capacity) + sizeof(count), capacity);
+    it->count = count_bits(it->table, it->capacity);
+
+    if (used != NULL) {
+        *used = sizeof(capacity) + sizeof(count) + capacity;
     }
 
     return it;
 }
 
-void it_record(const Index_Table *it, int file) {
-    if (it != NULL) {
-        // record the capacity of the table in the file
-        ssize_t out = write(file, &(it->capacity), sizeof(it->capacity));
+/**
+ * @brief Moves the valid identifiers of a table to a new one of another type
+ *
+ * @note The old table is destroyed, even on failure
+ */
+static Index_Table *convert(Index_Table *it, Table_Type type) {
+    Index_Table *other = it_create(type);
+    int *ids = it_get_valid_ids(it);
+    int status = other == NULL || (ids == NULL && it_size(it) > 0) ? -1 : 0;
 
-        // record the number of valid documents
-        out = write(file, &(it->count), sizeof(it->count));
+    for (unsigned i = 0; status == 0 && ids != NULL && ids[i] != -1; i++) {
+        status = it_add_entry(other, ids[i]);
+    }
 
-        // record the table in the file
-        out = write(file, it->table, it->capacity * sizeof(char));
+    free(ids);
+    it_destroy(it);
 
-        if (out == -1) {
-            perror("write()");
+    if (status != 0) {
+        it_destroy(other);
+        return NULL;
+    }
+
+    return other;
+}
+
+Index_Table *it_restore(const void *data, size_t size, Table_Type type,
+                        size_t *used) {
+    const char *bytes = (const char *)data;
+    unsigned capacity = 0;
+
+    if (size == 0) {
+        if (used != NULL) {
+            *used = 0;
         }
+        return it_create(type);
+    }
+
+    if (size < sizeof(capacity)) {
+        return NULL;
     }
+
+    memcpy(&capacity, bytes, sizeof(capacity));
+
+    Index_Table *it = NULL;
+    if (capacity == 0) {
+        Roaring_Table *roaring = rt_restore(
+            bytes + sizeof(capacity), size - sizeof(capacity), used);
+        if (roaring == NULL) {
+            return NULL;
+        }
+
+        it = (Index_Table *)calloc(1, sizeof(Index_Table));
+        if (it == NULL) {
+            rt_destroy(roaring);
+            return NULL;
+        }
+        it->type = TABLE_ROARING;
+        it->roaring = roaring;
+
+        if (used != NULL) {
+            *used += sizeof(capacity);
+        }
+    } else {
+        it = restore_words(bytes, size, used);
+    }
+
+    // a table saved by a server of the other type is converted
+    if (it != NULL && it->type != type) {
+        it = convert(it, type);
+    }
+
+    return it;
 }
 
 int *it_get_valid_ids(const Index_Table *it) {
@@ -206,26 +453,144 @@ int *it_get_valid_ids(const Index_Table *it) {
         return NULL;
     }
 
+    if (it->type == TABLE_ROARING) {
+        return rt_get_valid_ids(it->roaring);
+    }
+
     if (it->count == 0) {
         return NULL;
     }
 
-    // allocate space for the result
-    int *result = (int *)calloc(it->count, sizeof(int));
+    // allocate space for the result and the terminator
+    int *result = (int *)malloc((it->count + 1) * sizeof(int));
     if (result == NULL) {
         return NULL;
     }
 
-    unsigned i, j, m = 0;
-    // fill the array with valid indexes
-    for (i = 0; i < it->capacity; i++) {
-        for (j = 0; j < SET_SIZE; j++) {
-            // entry is valid
-            if ((it->table[i] >> j) & 1) {
-                result[m++] = i * SET_SIZE + j;
-            }
+    unsigned m = 0;
+    // fill the array with valid indexes, one word at a time
+    for (unsigned i = next_word(it->table, 0, it->capacity); i < it->capacity;
+         i = next_word(it->table, i + 1, it->capacity)) {
+        uint64_t bits = it->table[i];
+
+        // lowest valid entry first, then clear it
+        while (bits != 0) {
+            result[m++] = i * WORD_BITS + __builtin_ctzll(bits);
+            bits &= bits - 1;
         }
     }
+    result[m] = -1;
 
     return result;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Finds the first word, from an identifier, with a valid one
+ *
+ * @param it Pointer to the index table
+ * @param from First identifier to look at
+ * @param[out] base Receives the identifier of the lowest bit of the word
+ * @return Valid bits of the word, those below from are clear
+ * @retval 0 If no identifier from there is valid
+ */
+static uint64_t next_bits(const Index_Table *it, int from, int *base) {
+    if (it->type == TABLE_ROARING) {
+        return rt_next_bits(it->roaring, from, base);
+    }
+
+    unsigned word = (unsigned)from / WORD_BITS;
+    if (word >= it->capacity) {
+        return 0;
+    }
+
+    uint64_t bits = it->table[word] & (~(uint64_t)0 << (from % WORD_BITS));
+    if (bits == 0) {
+        word = next_word(it->table, word + 1, it->capacity);
+        if (word == it->capacity) {
+            return 0;
+        }
+        bits = it->table[word];
+    }
+
+    *base = word * WORD_BITS;
+    return bits;
+}
+
+void it_iter_begin(const Index_Table *it, int start, int end, It_Iter *iter) {
+    iter->it = it;
+    iter->next = start < 0 ? 0 : start;
+    iter->end = it == NULL ? 0 : end;
+    iter->base = 0;
+    iter->bits = 0;
+}
+
+int it_iter_next(It_Iter *iter) {
+    // load the next word with valid identifiers in the range
+    while (iter->bits == 0) {
+        int base = 0;
+        uint64_t bits = iter->next < iter->end
+                            ? next_bits(iter->it, iter->next, &base)
+                            : 0;
+
+        if (bits == 0 || base >= iter->end) {
+            iter->next = iter->end;
+            return -1;
+        }
+
+        // identifiers from the end of the range on are not returned
+        if (iter->end - base < WORD_BITS) {
+            bits &= ((uint64_t)1 << (iter->end - base)) - 1;
+        }
+
+        iter->base = base;
+        iter->bits = bits;
+        iter->next = iter->end - base <= WORD_BITS ? iter->end
+                                                   : base + WORD_BITS;
+    }
+
+    // lowest valid entry first, then clear it
+    int id = iter->base + __builtin_ctzll(iter->bits);
+    iter->bits &= iter->bits - 1;
+
+    return id;
+}
+
+int it_partition(const Index_Table *it, unsigned parts, int *bounds) {
+    if (it == NULL || parts == 0 || bounds == NULL) {
+        return -1;
+    }
+
+    unsigned long long count = it_size(it);
+    unsigned part = 1, seen = 0;
+    int from = 0, base = 0;
+    uint64_t bits = 0;
+
+    bounds[0] = 0;
+
+    // range i starts at the (count * i / parts)-th valid identifier, the
+    // valid identifiers are counted a word at a time
+    while (part < parts && (bits = next_bits(it, from, &base)) != 0) {
+        unsigned n = __builtin_popcountll(bits);
+
+        while (part < parts && seen + n > count * part / parts) {
+            uint64_t rest = bits;
+            for (unsigned skip = count * part / parts - seen; skip > 0;
+                 skip--) {
+                rest &= rest - 1;
+            }
+            bounds[part++] = base + __builtin_ctzll(rest);
+        }
+
+        seen += n;
+        if (base > INT_MAX - WORD_BITS) {
+            break;
+        }
+        from = base + WORD_BITS;
+    }
+
+    while (part <= parts) {
+        bounds[part++] = INT_MAX;
+    }
+
+    return 0;
+}
@@ -1,6 +1,8 @@
 
 #include "lru_cache.h"
 #include "defs.h"
+#include "slot_map.h"
+#include "storage.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -25,6 +27,12 @@ typedef struct lru {
      */
     int *identifiers;
 
+    /**
+     * @brief Slot of each cached identifier, kept in sync with identifiers.
+     * 
+     */
+    Slot_Map *map;
+
     /**
      * @brief Reference bits array indicating if a position was searched previously, 
      * used to approximate LRU behavior.
@@ -39,21 +47,21 @@ typedef struct lru {
     int size;
 
     /**
-     * @brief File descriptor used to retrieve data on a cache miss.
+     * @brief Storage of the metadata, used to retrieve data on a cache miss.
      * 
      */
-    int source;
+    const Storage *source;
 
     /**
-     * @brief Position index to start the next search or eviction attempt.
+     * @brief Clock hand, the position where the next eviction attempt starts.
      * 
      */
     int back;
 } LRU_Cache;
 
 
-void *lruc_create(int cache_size, int source) {
-    if (cache_size < 0 || source < 0) {
+void *lruc_create(int cache_size, const Storage *source) {
+    if (cache_size < 0 || source == NULL) {
         return NULL;
     }
 
@@ -86,13 +94,22 @@ void *lruc_create(int cache_size, int source) {
     lru->ref_bits = (char *)calloc(lru->size, sizeof(char));
     if (lru->ref_bits == NULL) {
         free(lru->documents);
-        free(lru->ref_bits);
+        free(lru->identifiers);
         free(lru);
         return NULL;
     }
 
     memset(lru->ref_bits, 0, lru->size * sizeof(char));
 
+    lru->map = sm_create(lru->size);
+    if (lru->map == NULL) {
+        free(lru->documents);
+        free(lru->identifiers);
+        free(lru->ref_bits);
+        free(lru);
+        return NULL;
+    }
+
     return lru;
 }
 
@@ -112,10 +129,50 @@ void lruc_destroy(void *cache) {
             free(lru->ref_bits);
         }
 
+        sm_destroy(lru->map);
         free(lru);
     }
 }
 
+static int is_chosen(const int *chosen, int count, int slot) {
+    for (int i = 0; i < count; i++) {
+        if (chosen[i] == slot) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Picks the slot of the next document to evict
+ *
+ * The clock hand sweeps the slots, an empty slot or one not referenced since
+ * the last sweep is taken, a referenced one has its bit cleared and gets a
+ * second chance. Slots already chosen for the same block are skipped.
+ *
+ * @param lru Cache
+ * @param chosen Slots already chosen, fewer than the size of the cache
+ * @param count Number of slots already chosen
+ * @return Slot to evict
+ */
+static int next_victim(LRU_Cache *lru, const int *chosen, int count) {
+    for (;;) {
+        int slot = lru->back;
+        lru->back = (lru->back + 1) % lru->size;
+
+        if (is_chosen(chosen, count, slot)) {
+            continue;
+        }
+
+        if (lru->identifiers[slot] == -1 || lru->ref_bits[slot] == 0) {
+            return slot;
+        }
+
+        lru->ref_bits[slot] = 0;
+    }
+}
+
 Document *lruc_get_document(void *cache, int identifier) {
     if (cache == NULL || identifier < 0) {
         return NULL;
@@ -125,77 +182,52 @@ Document *lruc_get_document(void *cache, int identifier) {
 
     printf("[CACHE INFO] searching in memory for %d\n", identifier);
 
-    int i;
-    // search the document in the cache
-    for (i = 0; i < lru->size && lru->identifiers[lru->back] != identifier;
-         i++) {
-        // set reference bit to 0
-        lru->ref_bits[lru->back] = 0;
-        lru->back = (lru->back + 1) % lru->size;
-    }
+    int i = sm_find(lru->map, identifier);
 
     // document is not in cache
-    if (i == lru->size) {
+    if (i == -1) {
         // get BLOCK_SIZE documents from metadata.bin
 
         printf("[CACHE INFO] going to disk for %d\n", identifier);
 
-        Document *docs = (Document *)calloc(BLOCK_SIZE, sizeof(Document));
-        if (docs == NULL) {
-            return NULL;
+        int wanted = storage_count(lru->source) - identifier;
+        if (wanted > BLOCK_SIZE) {
+            wanted = BLOCK_SIZE;
+        }
+        if (wanted > lru->size) {
+            wanted = lru->size;
         }
 
-        // go to the right position
-        lseek(lru->source, identifier * sizeof(Document), SEEK_SET);
-
-        // read the documents from disk
-        ssize_t out = read(lru->source, docs, BLOCK_SIZE * sizeof(Document));
-        if (out == -1) {
-            perror("read()");
-            return NULL;
+        // choose the slots of the block first, the documents are read
+        // straight into them
+        int chosen[BLOCK_SIZE];
+        int j;
+        for (j = 0; j < wanted; j++) {
+            chosen[j] = next_victim(lru, chosen, j);
         }
 
-        Document *result = clone_document(docs);
-
-        // number of documents read, less or equal than BLOCK_SIZE
-        int temp_size = out / sizeof(Document);
-
-        int j = 0;
-        // fill the cache with a new block
-        for (i = 0; i < lru->size && j < temp_size; i++) {
-            // fill the empty slots first
-            if (lru->identifiers[i] == -1) {
-                memcpy(lru->documents + i, docs + j, sizeof(docs[j]));
-                lru->identifiers[i] = identifier + j;
-                lru->ref_bits[i] = 1;
-                j++;
-            }
+        Document *slots[BLOCK_SIZE];
+        for (i = 0; i < j; i++) {
+            slots[i] = lru->documents + chosen[i];
+            lru->ref_bits[chosen[i]] = 1;
+            sm_set(lru->map, lru->identifiers, chosen[i], -1);
         }
 
-        // place the remaining in places with reference bits to 0
-        for (i = 0; i < lru->size && j < temp_size; i++) {
-            if (lru->ref_bits[i] == 0) {
-                memcpy(lru->documents + i, docs + j, sizeof(docs[j]));
-                lru->identifiers[i] = identifier + j;
-                lru->ref_bits[i] = 1;
-                j++;
-            }
+        int temp_size = storage_read_block(lru->source, identifier, slots, j);
+        if (temp_size <= 0) {
+            return NULL;
         }
 
-        // when the previous options don't work, place it at the front
-        for (i = 0; i < lru->size && j < temp_size; i++) {
-            memcpy(lru->documents + i, docs + j, sizeof(docs[j]));
-            lru->identifiers[i] = identifier + j;
-            lru->ref_bits[i] = 1;
-            j++;
+        for (i = 0; i < temp_size; i++) {
+            sm_set(lru->map, lru->identifiers, chosen[i], identifier + i);
         }
 
-        return result;
+        return clone_document(slots[0]);
     }
     
-    lru->ref_bits[lru->back] = 1;
+    lru->ref_bits[i] = 1;
 
-    return clone_document(lru->documents + lru->back);
+    return clone_document(lru->documents + i);
 }
 
 
@@ -203,25 +235,15 @@ void lruc_add_document(void *cache, int identifier, Document * doc) {
     if (cache != NULL && identifier >= 0 && doc != NULL) {
         LRU_Cache *lru = (LRU_Cache *)cache;
 
-        int i = 0;
-        // search for empty positions
-        for (; i < lru->size && lru->identifiers[i] != -1; i++);
-
-        int position = i;
-        if (position == lru->size) {
-            // cache is full, search for reference bits to 0
-            // does one more iteration, if the cache has no ref bit to 0, the last one will be 0
-            for (i = 0; i <= lru->size && lru->ref_bits[lru->back] != 0; i++) {
-                lru->ref_bits[lru->back] = 0;
-                lru->back = (lru->back + 1) % lru->size;
-            }
-
-            position = lru->back;
+        // a cached copy is replaced in place
+        int position = sm_find(lru->map, identifier);
+        if (position == -1) {
+            position = next_victim(lru, NULL, 0);
         }
 
         // place the document
         memcpy(lru->documents + position, doc, sizeof(Document));
-        lru->identifiers[position] = identifier;
+        sm_set(lru->map, lru->identifiers, position, identifier);
         lru->ref_bits[position] = 1;
     }
 }
@@ -230,13 +252,11 @@ void lruc_remove_document(void *cache, int identifier) {
     if (cache != NULL && identifier >= 0) {
         LRU_Cache *lru = (LRU_Cache *)cache;
 
-        int i = 0;
-        // search for the document
-        for (; i < lru->size && lru->identifiers[i] != identifier; i++);
+        int i = sm_find(lru->map, identifier);
 
-        if (i < lru->size) {
+        if (i != -1) {
             // found the document
-            lru->identifiers[i] = -1;
+            sm_set(lru->map, lru->identifiers, i, -1);
         }
     }
 }
@@ -0,0 +1,824 @@
+
+#include "meta_index.h"
+#include "defs.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define INITIAL_BUCKETS 64  /**< Buckets of an empty author or path table */
+
+/**
+ * @brief Identifiers of the documents of one key
+ *
+ * Kept in no particular order, queries sort their copy.
+ */
+typedef struct {
+    int *ids;               /**< Document identifiers */
+    unsigned count;         /**< Number of identifiers */
+    unsigned capacity;      /**< Capacity of ids */
+} Posting;
+
+/**
+ * @brief Author key, owned by the author table
+ */
+typedef struct {
+    char *name;             /**< Trimmed name of the author */
+    uint32_t hash;          /**< Hash of the name */
+    Posting posting;        /**< Documents of the author */
+} Author;
+
+/**
+ * @brief Year key, kept sorted by year
+ */
+typedef struct {
+    int year;               /**< Year of the documents */
+    Posting posting;        /**< Documents of the year */
+} Year;
+
+/**
+ * @brief Keys under which one identifier is indexed
+ */
+typedef struct {
+    int year;               /**< Year of the document, -1 if none */
+    unsigned n_authors;     /**< Number of authors */
+    unsigned *authors;      /**< Positions of the authors in the author table */
+    char *path;             /**< Path of the document, NULL if none */
+    uint32_t path_hash;     /**< Hash of the path */
+} Entry;
+
+typedef struct meta_index {
+    Author *authors;        /**< Every author ever indexed */
+    unsigned n_authors;     /**< Number of authors */
+    unsigned authors_capacity; /**< Capacity of authors */
+    int *buckets;           /**< Position of an author, -1 if empty */
+    unsigned n_buckets;     /**< Number of buckets, a power of two */
+    Year *years;            /**< Years with documents, in increasing order */
+    unsigned n_years;       /**< Number of years */
+    unsigned years_capacity; /**< Capacity of years */
+    Entry *entries;         /**< Keys of each identifier */
+    unsigned n_entries;     /**< Number of entries */
+    int *paths;             /**< Identifier owning a path, -1 if empty */
+    unsigned n_paths;       /**< Number of paths in the table */
+    unsigned n_path_buckets; /**< Number of buckets, a power of two */
+} Meta_Index;
+
+static uint32_t hash_name(const char *name, size_t length) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static const char *trim(const char *start, const char *end, size_t *length) {
+    while (start < end && (*start == ' ' || *start == '\t')) {
+        start++;
+    }
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+
+    *length = end - start;
+    return start;
+}
+
+static int parse_year(const char *year) {
+    int value = 0, digits = 0;
+
+    for (int i = 0; i < YEAR_SIZE && year[i] != '\0'; i++) {
+        if (year[i] < '0' || year[i] > '9') {
+            return -1;
+        }
+        value = value * 10 + year[i] - '0';
+        digits++;
+    }
+
+    return digits > 0 ? value : -1;
+}
+
+static int posting_add(Posting *posting, int id) {
+    if (posting->count == posting->capacity) {
+        unsigned capacity = posting->capacity == 0 ? 4 : posting->capacity * 2;
+        int *other = (int *)realloc(posting->ids, capacity * sizeof(int));
+        if (other == NULL) {
+            return -1;
+        }
+
+        posting->ids = other;
+        posting->capacity = capacity;
+    }
+
+    posting->ids[posting->count++] = id;
+    return 0;
+}
+
+static void posting_remove(Posting *posting, int id) {
+    // the order doesn't matter, the last one takes its place
+    for (unsigned i = 0; i < posting->count; i++) {
+        if (posting->ids[i] == id) {
+            posting->ids[i] = posting->ids[--posting->count];
+            return;
+        }
+    }
+}
+
+static int find_author(const Meta_Index *mi, const char *name, size_t length,
+                       uint32_t hash) {
+    unsigned mask = mi->n_buckets - 1;
+
+    // linear probing, the table is never full
+    for (unsigned i = hash & mask; mi->buckets[i] != -1; i = (i + 1) & mask) {
+        const Author *author = mi->authors + mi->buckets[i];
+        if (author->hash == hash && strlen(author->name) == length &&
+            memcmp(author->name, name, length) == 0) {
+            return mi->buckets[i];
+        }
+    }
+
+    return -1;
+}
+
+static int grow_buckets(Meta_Index *mi) {
+    unsigned n_buckets = mi->n_buckets * 2;
+    int *buckets = (int *)malloc(n_buckets * sizeof(int));
+    if (buckets == NULL) {
+        return -1;
+    }
+
+    memset(buckets, -1, n_buckets * sizeof(int));
+    for (unsigned i = 0; i < mi->n_authors; i++) {
+        unsigned j = mi->authors[i].hash & (n_buckets - 1);
+        while (buckets[j] != -1) {
+            j = (j + 1) & (n_buckets - 1);
+        }
+        buckets[j] = i;
+    }
+
+    free(mi->buckets);
+    mi->buckets = buckets;
+    mi->n_buckets = n_buckets;
+
+    return 0;
+}
+
+static int intern_author(Meta_Index *mi, const char *name, size_t length) {
+    uint32_t hash = hash_name(name, length);
+    int found = find_author(mi, name, length, hash);
+    if (found != -1) {
+        return found;
+    }
+
+    // keep the load factor under 3/4
+    if ((mi->n_authors + 1) * 4 > mi->n_buckets * 3 && grow_buckets(mi) != 0) {
+        return -1;
+    }
+
+    if (mi->n_authors == mi->authors_capacity) {
+        unsigned capacity =
+            mi->authors_capacity == 0 ? 64 : mi->authors_capacity * 2;
+        Author *other =
+            (Author *)realloc(mi->authors, capacity * sizeof(Author));
+        if (other == NULL) {
+            return -1;
+        }
+
+        mi->authors = other;
+        mi->authors_capacity = capacity;
+    }
+
+    Author *author = mi->authors + mi->n_authors;
+    memset(author, 0, sizeof(Author));
+    author->name = strndup(name, length);
+    if (author->name == NULL) {
+        return -1;
+    }
+    author->hash = hash;
+
+    unsigned i = hash & (mi->n_buckets - 1);
+    while (mi->buckets[i] != -1) {
+        i = (i + 1) & (mi->n_buckets - 1);
+    }
+    mi->buckets[i] = mi->n_authors;
+
+    return mi->n_authors++;
+}
+
+static unsigned lower_year(const Meta_Index *mi, int year) {
+    unsigned low = 0, high = mi->n_years;
+
+    while (low < high) {
+        unsigned middle = low + (high - low) / 2;
+        if (mi->years[middle].year < year) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static Year *intern_year(Meta_Index *mi, int year) {
+    unsigned i = lower_year(mi, year);
+    if (i < mi->n_years && mi->years[i].year == year) {
+        return mi->years + i;
+    }
+
+    if (mi->n_years == mi->years_capacity) {
+        unsigned capacity = mi->years_capacity == 0 ? 64 : mi->years_capacity * 2;
+        Year *other = (Year *)realloc(mi->years, capacity * sizeof(Year));
+        if (other == NULL) {
+            return NULL;
+        }
+
+        mi->years = other;
+        mi->years_capacity = capacity;
+    }
+
+    // new years are rare, keep the array sorted
+    memmove(mi->years + i + 1, mi->years + i,
+            (mi->n_years - i) * sizeof(Year));
+    memset(mi->years + i, 0, sizeof(Year));
+    mi->years[i].year = year;
+    mi->n_years++;
+
+    return mi->years + i;
+}
+
+static Entry *get_entry(Meta_Index *mi, int id) {
+    if ((unsigned)id >= mi->n_entries) {
+        unsigned n_entries = mi->n_entries == 0 ? 256 : mi->n_entries;
+        while (n_entries <= (unsigned)id) {
+            n_entries *= 2;
+        }
+
+        Entry *other = (Entry *)realloc(mi->entries, n_entries * sizeof(Entry));
+        if (other == NULL) {
+            return NULL;
+        }
+
+        memset(other + mi->n_entries, 0,
+               (n_entries - mi->n_entries) * sizeof(Entry));
+        for (unsigned i = mi->n_entries; i < n_entries; i++) {
+            other[i].year = -1;
+        }
+
+        mi->entries = other;
+        mi->n_entries = n_entries;
+    }
+
+    return mi->entries + id;
+}
+
+static int link_author(Meta_Index *mi, int id, unsigned author) {
+    Entry *entry = get_entry(mi, id);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    // an author listed twice in the same document is indexed once
+    for (unsigned i = 0; i < entry->n_authors; i++) {
+        if (entry->authors[i] == author) {
+            return 0;
+        }
+    }
+
+    unsigned *other = (unsigned *)realloc(
+        entry->authors, (entry->n_authors + 1) * sizeof(unsigned));
+    if (other == NULL) {
+        return -1;
+    }
+
+    entry->authors = other;
+    entry->authors[entry->n_authors++] = author;
+
+    return posting_add(&mi->authors[author].posting, id);
+}
+
+static int link_year(Meta_Index *mi, int id, int year) {
+    Entry *entry = get_entry(mi, id);
+    Year *key = entry == NULL ? NULL : intern_year(mi, year);
+    if (key == NULL) {
+        return -1;
+    }
+
+    entry->year = year;
+    return posting_add(&key->posting, id);
+}
+
+static int find_path(const Meta_Index *mi, const char *path, uint32_t hash) {
+    unsigned mask = mi->n_path_buckets - 1;
+
+    for (unsigned i = hash & mask; mi->paths[i] != -1; i = (i + 1) & mask) {
+        const Entry *entry = mi->entries + mi->paths[i];
+        if (entry->path_hash == hash && strcmp(entry->path, path) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int grow_paths(Meta_Index *mi) {
+    unsigned n_buckets = mi->n_path_buckets * 2;
+    int *paths = (int *)malloc(n_buckets * sizeof(int));
+    if (paths == NULL) {
+        return -1;
+    }
+
+    memset(paths, -1, n_buckets * sizeof(int));
+    for (unsigned i = 0; i < mi->n_path_buckets; i++) {
+        if (mi->paths[i] == -1) {
+            continue;
+        }
+
+        unsigned j = mi->entries[mi->paths[i]].path_hash & (n_buckets - 1);
+        while (paths[j] != -1) {
+            j = (j + 1) & (n_buckets - 1);
+        }
+        paths[j] = mi->paths[i];
+    }
+
+    free(mi->paths);
+    mi->paths = paths;
+    mi->n_path_buckets = n_buckets;
+
+    return 0;
+}
+
+static int link_path(Meta_Index *mi, int id, const char *path) {
+    Entry *entry = get_entry(mi, id);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    size_t length = strnlen(path, PATH_SIZE);
+    entry->path = strndup(path, length);
+    if (entry->path == NULL) {
+        return -1;
+    }
+    entry->path_hash = hash_name(entry->path, length);
+
+    // the last document indexed with a path owns it
+    int found = find_path(mi, entry->path, entry->path_hash);
+    if (found != -1) {
+        mi->paths[found] = id;
+        return 0;
+    }
+
+    if ((mi->n_paths + 1) * 4 > mi->n_path_buckets * 3 && grow_paths(mi) != 0) {
+        return -1;
+    }
+
+    unsigned mask = mi->n_path_buckets - 1;
+    unsigned i = entry->path_hash & mask;
+    while (mi->paths[i] != -1) {
+        i = (i + 1) & mask;
+    }
+    mi->paths[i] = id;
+    mi->n_paths++;
+
+    return 0;
+}
+
+static void unlink_path(Meta_Index *mi, int id) {
+    const Entry *entry = mi->entries + id;
+    unsigned mask = mi->n_path_buckets - 1;
+
+    // another document may own the path now
+    int i = find_path(mi, entry->path, entry->path_hash);
+    if (i == -1 || mi->paths[i] != id) {
+        return;
+    }
+
+    // shift back the entries that probed past the freed bucket, so no
+    // probe sequence is cut short
+    mi->paths[i] = -1;
+    mi->n_paths--;
+    for (unsigned j = (i + 1) & mask; mi->paths[j] != -1; j = (j + 1) & mask) {
+        unsigned home = mi->entries[mi->paths[j]].path_hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            mi->paths[i] = mi->paths[j];
+            mi->paths[j] = -1;
+            i = j;
+        }
+    }
+}
+
+Meta_Index *mi_create(void) {
+    Meta_Index *mi = (Meta_Index *)calloc(1, sizeof(Meta_Index));
+    if (mi == NULL) {
+        return NULL;
+    }
+
+    mi->buckets = (int *)malloc(INITIAL_BUCKETS * sizeof(int));
+    mi->paths = (int *)malloc(INITIAL_BUCKETS * sizeof(int));
+    if (mi->buckets == NULL || mi->paths == NULL) {
+        free(mi->buckets);
+        free(mi->paths);
+        free(mi);
+        return NULL;
+    }
+
+    memset(mi->buckets, -1, INITIAL_BUCKETS * sizeof(int));
+    mi->n_buckets = INITIAL_BUCKETS;
+    memset(mi->paths, -1, INITIAL_BUCKETS * sizeof(int));
+    mi->n_path_buckets = INITIAL_BUCKETS;
+
+    return mi;
+}
+
+void mi_destroy(Meta_Index *mi) {
+    if (mi == NULL) {
+        return;
+    }
+
+    for (unsigned i = 0; i < mi->n_authors; i++) {
+        free(mi->authors[i].name);
+        free(mi->authors[i].posting.ids);
+    }
+    for (unsigned i = 0; i < mi->n_years; i++) {
+        free(mi->years[i].posting.ids);
+    }
+    for (unsigned i = 0; i < mi->n_entries; i++) {
+        free(mi->entries[i].authors);
+        free(mi->entries[i].path);
+    }
+
+    free(mi->authors);
+    free(mi->buckets);
+    free(mi->paths);
+    free(mi->years);
+    free(mi->entries);
+    free(mi);
+}
+
+int mi_add(Meta_Index *mi, int id, const char *authors, const char *year,
+           const char *path) {
+    if (mi == NULL || id < 0 || authors == NULL || year == NULL ||
+        path == NULL) {
+        return -1;
+    }
+
+    // a reused identifier loses the keys of its previous document
+    mi_remove(mi, id);
+
+    const char *end = authors + strnlen(authors, AUTHORS_SIZE);
+    const char *start = authors;
+
+    while (start <= end) {
+        const char *next = memchr(start, ';', end - start);
+        if (next == NULL) {
+            next = end;
+        }
+
+        size_t length = 0;
+        const char *name = trim(start, next, &length);
+        if (length > 0) {
+            int author = intern_author(mi, name, length);
+            if (author == -1 || link_author(mi, id, author) != 0) {
+                return -1;
+            }
+        }
+
+        start = next + 1;
+    }
+
+    int value = parse_year(year);
+    if (value != -1 && link_year(mi, id, value) != 0) {
+        return -1;
+    }
+
+    return link_path(mi, id, path);
+}
+
+void mi_remove(Meta_Index *mi, int id) {
+    if (mi == NULL || id < 0 || (unsigned)id >= mi->n_entries) {
+        return;
+    }
+
+    Entry *entry = mi->entries + id;
+
+    for (unsigned i = 0; i < entry->n_authors; i++) {
+        posting_remove(&mi->authors[entry->authors[i]].posting, id);
+    }
+
+    if (entry->year != -1) {
+        unsigned i = lower_year(mi, entry->year);
+        if (i < mi->n_years && mi->years[i].year == entry->year) {
+            posting_remove(&mi->years[i].posting, id);
+        }
+    }
+
+    if (entry->path != NULL) {
+        unlink_path(mi, id);
+        free(entry->path);
+        entry->path = NULL;
+    }
+
+    free(entry->authors);
+    entry->authors = NULL;
+    entry->n_authors = 0;
+    entry->year = -1;
+}
+
+int mi_find_path(const Meta_Index *mi, const char *path) {
+    if (mi == NULL || path == NULL) {
+        return -1;
+    }
+
+    size_t length = strnlen(path, PATH_SIZE);
+    char key[PATH_SIZE + 1];
+    memcpy(key, path, length);
+    key[length] = '\0';
+
+    int i = find_path(mi, key, hash_name(key, length));
+    return i == -1 ? -1 : mi->paths[i];
+}
+
+static int compare_ids(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+int *mi_by_author(const Meta_Index *mi, const char *author, unsigned *count) {
+    *count = 0;
+    if (mi == NULL || author == NULL) {
+        return NULL;
+    }
+
+    size_t length = 0;
+    const char *name = trim(author, author + strlen(author), &length);
+
+    int found = find_author(mi, name, length, hash_name(name, length));
+    if (found == -1 || mi->authors[found].posting.count == 0) {
+        return NULL;
+    }
+
+    const Posting *posting = &mi->authors[found].posting;
+    int *ids = (int *)malloc(posting->count * sizeof(int));
+    if (ids == NULL) {
+        return NULL;
+    }
+
+    memcpy(ids, posting->ids, posting->count * sizeof(int));
+    qsort(ids, posting->count, sizeof(int), compare_ids);
+    *count = posting->count;
+
+    return ids;
+}
+
+int *mi_by_years(const Meta_Index *mi, int from, int to, unsigned *count) {
+    *count = 0;
+    if (mi == NULL || from > to) {
+        return NULL;
+    }
+
+    // the years of the range are adjacent
+    unsigned first = lower_year(mi, from), last = first, total = 0;
+    while (last < mi->n_years && mi->years[last].year <= to) {
+        total += mi->years[last++].posting.count;
+    }
+
+    if (total == 0) {
+        return NULL;
+    }
+
+    int *ids = (int *)malloc(total * sizeof(int));
+    if (ids == NULL) {
+        return NULL;
+    }
+
+    for (unsigned i = first; i < last; i++) {
+        const Posting *posting = &mi->years[i].posting;
+        memcpy(ids + *count, posting->ids, posting->count * sizeof(int));
+        *count += posting->count;
+    }
+
+    qsort(ids, total, sizeof(int), compare_ids);
+    return ids;
+}
+
+size_t mi_snapshot(const Meta_Index *mi, void *out) {
+    char *cursor = (char *)out;
+    size_t size = 3 * sizeof(uint32_t);
+    uint32_t n_authors = 0, n_years = 0, n_paths = 0;
+
+    if (mi == NULL) {
+        if (cursor != NULL) {
+            memset(cursor, 0, size);
+        }
+        return size;
+    }
+
+    n_paths = mi->n_paths;
+
+    // authors without documents are left out
+    for (unsigned i = 0; i < mi->n_authors; i++) {
+        const Author *author = mi->authors + i;
+        if (author->posting.count > 0) {
+            n_authors++;
+            size += sizeof(uint16_t) + strlen(author->name) +
+                    sizeof(uint32_t) + author->posting.count * sizeof(int32_t);
+        }
+    }
+    for (unsigned i = 0; i < mi->n_years; i++) {
+        if (mi->years[i].posting.count > 0) {
+            n_years++;
+            size += 2 * sizeof(uint32_t) +
+                    mi->years[i].posting.count * sizeof(int32_t);
+        }
+    }
+    for (unsigned i = 0; i < mi->n_path_buckets; i++) {
+        if (mi->paths[i] != -1) {
+            size += sizeof(int32_t) + sizeof(uint16_t) +
+                    strlen(mi->entries[mi->paths[i]].path);
+        }
+    }
+
+    if (cursor == NULL) {
+        return size;
+    }
+
+    // number of authors, then name, count and ids of each
+    memcpy(cursor, &n_authors, sizeof(n_authors));
+    cursor += sizeof(n_authors);
+    for (unsigned i = 0; i < mi->n_authors; i++) {
+        const Author *author = mi->authors + i;
+        if (author->posting.count == 0) {
+            continue;
+        }
+
+        uint16_t length = strlen(author->name);
+        memcpy(cursor, &length, sizeof(length));
+        memcpy(cursor + sizeof(length), author->name, length);
+        cursor += sizeof(length) + length;
+
+        memcpy(cursor, &author->posting.count, sizeof(uint32_t));
+        memcpy(cursor + sizeof(uint32_t), author->posting.ids,
+               author->posting.count * sizeof(int32_t));
+        cursor += sizeof(uint32_t) + author->posting.count * sizeof(int32_t);
+    }
+
+    // number of years, then year, count and ids of each
+    memcpy(cursor, &n_years, sizeof(n_years));
+    cursor += sizeof(n_years);
+    for (unsigned i = 0; i < mi->n_years; i++) {
+        const Year *year = mi->years + i;
+        if (year->posting.count == 0) {
+            continue;
+        }
+
+        memcpy(cursor, &year->year, sizeof(int32_t));
+        memcpy(cursor + sizeof(int32_t), &year->posting.count,
+               sizeof(uint32_t));
+        memcpy(cursor + 2 * sizeof(uint32_t), year->posting.ids,
+               year->posting.count * sizeof(int32_t));
+        cursor += 2 * sizeof(uint32_t) + year->posting.count * sizeof(int32_t);
+    }
+
+    // number of paths, then identifier and path of each
+    memcpy(cursor, &n_paths, sizeof(n_paths));
+    cursor += sizeof(n_paths);
+    for (unsigned i = 0; i < mi->n_path_buckets; i++) {
+        if (mi->paths[i] == -1) {
+            continue;
+        }
+
+        const char *path = mi->entries[mi->paths[i]].path;
+        uint16_t length = strlen(path);
+        memcpy(cursor, mi->paths + i, sizeof(int32_t));
+        memcpy(cursor + sizeof(int32_t), &length, sizeof(length));
+        memcpy(cursor + sizeof(int32_t) + sizeof(length), path, length);
+        cursor += sizeof(int32_t) + sizeof(length) + length;
+    }
+
+    return size;
+}
+
+static int read_count(const char **cursor, const char *end, uint32_t *count,
+                      size_t item) {
+    if (end - *cursor < (ptrdiff_t)sizeof(uint32_t)) {
+        return -1;
+    }
+
+    memcpy(count, *cursor, sizeof(uint32_t));
+    *cursor += sizeof(uint32_t);
+
+    // every item takes at least `item` bytes of what is left
+    return (size_t)(end - *cursor) / item < *count ? -1 : 0;
+}
+
+Meta_Index *mi_restore(const void *data, size_t size, size_t *used) {
+    const char *cursor = (const char *)data;
+    const char *end = cursor + size;
+    uint32_t n_keys = 0, count = 0;
+    int id = 0;
+
+    Meta_Index *mi = mi_create();
+    if (mi == NULL ||
+        read_count(&cursor, end, &n_keys, sizeof(uint32_t)) != 0) {
+        mi_destroy(mi);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < n_keys; i++) {
+        uint16_t length = 0;
+        if (end - cursor < (ptrdiff_t)sizeof(length)) {
+            mi_destroy(mi);
+            return NULL;
+        }
+
+        memcpy(&length, cursor, sizeof(length));
+        cursor += sizeof(length);
+        if (end - cursor < length) {
+            mi_destroy(mi);
+            return NULL;
+        }
+
+        int author = intern_author(mi, cursor, length);
+        cursor += length;
+        if (author == -1 ||
+            read_count(&cursor, end, &count, sizeof(int32_t)) != 0) {
+            mi_destroy(mi);
+            return NULL;
+        }
+
+        for (uint32_t j = 0; j < count; j++, cursor += sizeof(int32_t)) {
+            memcpy(&id, cursor, sizeof(id));
+            if (id < 0 || link_author(mi, id, author) != 0) {
+                mi_destroy(mi);
+                return NULL;
+            }
+        }
+    }
+
+    if (read_count(&cursor, end, &n_keys, sizeof(uint32_t)) != 0) {
+        mi_destroy(mi);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < n_keys; i++) {
+        int year = 0;
+        if (end - cursor < (ptrdiff_t)sizeof(year)) {
+            mi_destroy(mi);
+            return NULL;
+        }
+
+        memcpy(&year, cursor, sizeof(year));
+        cursor += sizeof(year);
+        if (read_count(&cursor, end, &count, sizeof(int32_t)) != 0) {
+            mi_destroy(mi);
+            return NULL;
+        }
+
+        for (uint32_t j = 0; j < count; j++, cursor += sizeof(int32_t)) {
+            memcpy(&id, cursor, sizeof(id));
+            if (id < 0 || link_year(mi, id, year) != 0) {
+                mi_destroy(mi);
+                return NULL;
+            }
+        }
+    }
+
+    if (read_count(&cursor, end, &n_keys, sizeof(int32_t)) != 0) {
+        mi_destroy(mi);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < n_keys; i++) {
+        uint16_t length = 0;
+        char path[PATH_SIZE + 1];
+        if (end - cursor < (ptrdiff_t)(sizeof(id) + sizeof(length))) {
+            mi_destroy(mi);
+            return NULL;
+        }
+
+        memcpy(&id, cursor, sizeof(id));
+        memcpy(&length, cursor + sizeof(id), sizeof(length));
+        cursor += sizeof(id) + sizeof(length);
+        if (end - cursor < length || length > PATH_SIZE || id < 0) {
+            mi_destroy(mi);
+            return NULL;
+        }
+
+        memcpy(path, cursor, length);
+        path[length] = '\0';
+        cursor += length;
+        if (link_path(mi, id, path) != 0) {
+            mi_destroy(mi);
+            return NULL;
+        }
+    }
+
+    if (used != NULL) {
+        *used = cursor - (const char *)data;
+    }
+
+    return mi;
+}
@@ -0,0 +1,513 @@
+#include "protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * @brief Cursor over a payload being built or parsed
+ */
+typedef struct {
+    char *data;         /**< Payload bytes */
+    size_t size;        /**< Capacity (writing) or length (reading) */
+    size_t used;        /**< Bytes written or consumed so far */
+    int failed;         /**< Set when the payload overflows or is truncated */
+} Cursor;
+
+static void put_bytes(Cursor *cursor, const void *bytes, size_t length) {
+    if (cursor->failed || cursor->used + length > cursor->size) {
+        cursor->failed = 1;
+        return;
+    }
+
+    memcpy(cursor->data + cursor->used, bytes, length);
+    cursor->used += length;
+}
+
+static void put_int(Cursor *cursor, int32_t value) {
+    put_bytes(cursor, &value, sizeof(value));
+}
+
+static void put_string(Cursor *cursor, const char *string, size_t max) {
+    uint16_t length = strnlen(string, max);
+
+    put_bytes(cursor, &length, sizeof(length));
+    put_bytes(cursor, string, length);
+}
+
+static void get_bytes(Cursor *cursor, void *bytes, size_t length) {
+    if (cursor->failed || cursor->used + length > cursor->size) {
+        cursor->failed = 1;
+        return;
+    }
+
+    memcpy(bytes, cursor->data + cursor->used, length);
+    cursor->used += length;
+}
+
+static int32_t get_int(Cursor *cursor) {
+    int32_t value = 0;
+    get_bytes(cursor, &value, sizeof(value));
+
+    return value;
+}
+
+static void get_string(Cursor *cursor, char *string, size_t max) {
+    uint16_t length = 0;
+    get_bytes(cursor, &length, sizeof(length));
+
+    // the field must fit, the null terminator is optional when it is full
+    if (length > max) {
+        cursor->failed = 1;
+        return;
+    }
+
+    memset(string, 0, max);
+    get_bytes(cursor, string, length);
+}
+
+static void put_document(Cursor *cursor, const char *title,
+                         const char *authors, const char *year,
+                         const char *path) {
+    put_string(cursor, title, TITLE_SIZE);
+    put_string(cursor, authors, AUTHORS_SIZE);
+    put_string(cursor, year, YEAR_SIZE);
+    put_string(cursor, path, PATH_SIZE);
+}
+
+size_t encode_request(const Request *request, char *frame, size_t size) {
+    if (request == NULL || frame == NULL || size < sizeof(Header)) {
+        return 0;
+    }
+
+    Cursor cursor = {frame + sizeof(Header), size - sizeof(Header), 0, 0};
+
+    switch (request->operation) {
+        case INDEX:
+            put_document(&cursor, request->title, request->authors,
+                         request->year, request->path);
+            break;
+        case REMOVE:
+        case CONSULT:
+            put_int(&cursor, request->key);
+            break;
+        case COUNT_WORD:
+            put_int(&cursor, request->key);
+            put_string(&cursor, request->keyword, KEYWORD_SIZE);
+            break;
+        case LIST_WORD:
+            put_int(&cursor, request->n_procs);
+            put_string(&cursor, request->keyword, KEYWORD_SIZE);
+            break;
+        case INDEX_BULK:
+            put_int(&cursor, request->n_records);
+            for (unsigned i = 0; i < request->n_records; i++) {
+                Document *doc = (Document *)request->records + i;
+                put_document(&cursor, doc->title, doc->authors, doc->year,
+                             doc->path);
+            }
+            break;
+        case QUERY_AUTHOR:
+            put_string(&cursor, request->authors, AUTHORS_SIZE);
+            break;
+        case QUERY_YEAR:
+            put_int(&cursor, request->key);
+            put_int(&cursor, request->key_last);
+            break;
+        case LOOKUP_PATH:
+            put_string(&cursor, request->path, PATH_SIZE);
+            break;
+        default:
+            break;
+    }
+
+    if (cursor.failed) {
+        return 0;
+    }
+
+    Header header = {PROTOCOL_MAGIC, request->operation, request->flags,
+                     request->sequence, request->client, cursor.used};
+    memcpy(frame, &header, sizeof(header));
+
+    return sizeof(Header) + cursor.used;
+}
+
+int decode_request(const Header *header, const char *payload,
+                   Request *request) {
+    if (header == NULL || request == NULL) {
+        return 1;
+    }
+
+    memset(request, 0, sizeof(Request));
+    request->client = header->client;
+    request->operation = header->opcode;
+    request->sequence = header->sequence;
+    request->flags = header->flags;
+    request->channel = -1;
+
+    Cursor cursor = {(char *)payload, header->length, 0, 0};
+
+    switch (request->operation) {
+        case INDEX:
+            get_string(&cursor, request->title, TITLE_SIZE - 1);
+            get_string(&cursor, request->authors, AUTHORS_SIZE - 1);
+            get_string(&cursor, request->year, YEAR_SIZE);
+            get_string(&cursor, request->path, PATH_SIZE - 1);
+            break;
+        case REMOVE:
+        case CONSULT:
+            request->key = get_int(&cursor);
+            break;
+        case COUNT_WORD:
+            request->key = get_int(&cursor);
+            get_string(&cursor, request->keyword, KEYWORD_SIZE - 1);
+            break;
+        case LIST_WORD:
+            request->n_procs = get_int(&cursor);
+            get_string(&cursor, request->keyword, KEYWORD_SIZE - 1);
+            break;
+        case INDEX_BULK:
+            request->n_records = get_int(&cursor);
+
+            // every document takes at least its four length prefixes
+            if (request->n_records > header->length / (4 * sizeof(uint16_t))) {
+                return 1;
+            }
+
+            request->records = calloc(request->n_records, sizeof(Document));
+            if (request->records == NULL) {
+                return 1;
+            }
+
+            for (unsigned i = 0; i < request->n_records; i++) {
+                Document *doc = (Document *)request->records + i;
+                get_string(&cursor, doc->title, TITLE_SIZE - 1);
+                get_string(&cursor, doc->authors, AUTHORS_SIZE - 1);
+                get_string(&cursor, doc->year, YEAR_SIZE);
+                get_string(&cursor, doc->path, PATH_SIZE - 1);
+            }
+            break;
+        case QUERY_AUTHOR:
+            get_string(&cursor, request->authors, AUTHORS_SIZE - 1);
+            break;
+        case QUERY_YEAR:
+            request->key = get_int(&cursor);
+            request->key_last = get_int(&cursor);
+            break;
+        case LOOKUP_PATH:
+            get_string(&cursor, request->path, PATH_SIZE - 1);
+            break;
+        case SHUTDOWN:
+        case SESSION_OPEN:
+        case SESSION_CLOSE:
+        case COMPACT:
+            break;
+        default:
+            return 1;
+    }
+
+    if (cursor.failed) {
+        release_request(request);
+    }
+
+    return cursor.failed;
+}
+
+void release_request(Request *request) {
+    if (request != NULL && request->records != NULL) {
+        free(request->records);
+        request->records = NULL;
+        request->n_records = 0;
+    }
+}
+
+size_t record_length(const Document *doc) {
+    return 4 * sizeof(uint16_t) + strnlen(doc->title, TITLE_SIZE) +
+           strnlen(doc->authors, AUTHORS_SIZE) +
+           strnlen(doc->year, YEAR_SIZE) + strnlen(doc->path, PATH_SIZE);
+}
+
+int decode_legacy_request(const Legacy_Request *old, Request *request) {
+    if (old == NULL || request == NULL) {
+        return 1;
+    }
+
+    memset(request, 0, sizeof(Request));
+    request->client = old->client;
+    request->operation = old->operation;
+    request->legacy = 1;
+    request->channel = -1;
+
+    switch (old->operation) {
+        case INDEX:
+            strncpy(request->title, old->title, LEGACY_TITLE_SIZE - 1);
+            strncpy(request->authors, old->authors, LEGACY_AUTHORS_SIZE - 1);
+            strncpy(request->year, old->year, YEAR_SIZE);
+            strncpy(request->path, old->path, LEGACY_PATH_SIZE - 1);
+            break;
+        case REMOVE:
+        case CONSULT:
+            request->key = atoi(old->title);
+            break;
+        case COUNT_WORD:
+            request->key = atoi(old->title);
+            strncpy(request->keyword, old->authors, KEYWORD_SIZE - 1);
+            break;
+        case LIST_WORD:
+            // the keyword was in the title, the number of processes in the authors
+            strncpy(request->keyword, old->title, KEYWORD_SIZE - 1);
+            request->n_procs = atoi(old->authors);
+            break;
+        case SHUTDOWN:
+        case SESSION_OPEN:
+        case SESSION_CLOSE:
+            break;
+        default:
+            return 1;
+    }
+
+    return 0;
+}
+
+static int read_full(int fd, void *buffer, size_t size) {
+    size_t total = 0;
+    ssize_t out = 0;
+
+    while (total < size &&
+           (out = read(fd, (char *)buffer + total, size - total)) > 0) {
+        total += out;
+    }
+
+    if (out == -1) {
+        perror("read()");
+        return -1;
+    }
+
+    // end of file before the first byte
+    if (total == 0) {
+        return 1;
+    }
+
+    return total == size ? 0 : -1;
+}
+
+int receive_request(int fd, Request *request) {
+    union {
+        Header header;
+        Legacy_Request legacy;
+    } message;
+    char payload[MAX_REQUEST];
+
+    int status = read_full(fd, &message.header, sizeof(Header));
+    if (status != 0) {
+        return status;
+    }
+
+    if (message.header.magic != PROTOCOL_MAGIC) {
+        // old fixed size request, read the rest of it
+        status = read_full(fd, (char *)&message + sizeof(Header),
+                           sizeof(Legacy_Request) - sizeof(Header));
+        if (status != 0) {
+            return -1;
+        }
+
+        return decode_legacy_request(&message.legacy, request) == 0 ? 0 : -1;
+    }
+
+    if (message.header.length > sizeof(payload) - sizeof(Header)) {
+        printf("[PROTOCOL] request of %u bytes is too large\n",
+               message.header.length);
+        return -1;
+    }
+
+    // a request without a payload is complete after the header
+    if (message.header.length > 0 &&
+        read_full(fd, payload, message.header.length) != 0) {
+        return -1;
+    }
+
+    return decode_request(&message.header, payload, request) == 0 ? 0 : -1;
+}
+
+char *encode_reply(const Request *request, const void *payload, size_t length,
+                   size_t *size) {
+    char *frame = (char *)malloc(sizeof(Header) + length);
+    if (frame == NULL) {
+        return NULL;
+    }
+
+    Header header = {PROTOCOL_MAGIC, request->operation, 0, request->sequence,
+                     request->client, length};
+    memcpy(frame, &header, sizeof(header));
+    if (length > 0) {
+        memcpy(frame + sizeof(header), payload, length);
+    }
+
+    *size = sizeof(Header) + length;
+    return frame;
+}
+
+char *encode_int_reply(const Request *request, int value, size_t *size) {
+    if (request->legacy) {
+        char *reply = (char *)malloc(sizeof(value));
+        if (reply != NULL) {
+            memcpy(reply, &value, sizeof(value));
+            *size = sizeof(value);
+        }
+
+        return reply;
+    }
+
+    int32_t payload = value;
+    return encode_reply(request, &payload, sizeof(payload), size);
+}
+
+char *encode_document_reply(const Request *request, const Document *doc,
+                            size_t *size) {
+    if (request->legacy) {
+        Legacy_Document *reply =
+            (Legacy_Document *)calloc(1, sizeof(Legacy_Document));
+        if (reply == NULL) {
+            return NULL;
+        }
+
+        if (doc != NULL) {
+            strncpy(reply->title, doc->title, LEGACY_TITLE_SIZE - 1);
+            strncpy(reply->authors, doc->authors, LEGACY_AUTHORS_SIZE - 1);
+            memcpy(reply->year, doc->year, YEAR_SIZE);
+            strncpy(reply->path, doc->path, LEGACY_PATH_SIZE - 1);
+        } else {
+            sprintf(reply->title, "Document was not found");
+        }
+
+        *size = sizeof(Legacy_Document);
+        return (char *)reply;
+    }
+
+    if (doc == NULL) {
+        return encode_reply(request, NULL, 0, size);
+    }
+
+    char payload[sizeof(Document) + 4 * sizeof(uint16_t)];
+    Cursor cursor = {payload, sizeof(payload), 0, 0};
+    put_document(&cursor, doc->title, doc->authors, doc->year, doc->path);
+
+    return encode_reply(request, payload, cursor.used, size);
+}
+
+char *encode_list_reply(const Request *request, const int *ids,
+                        unsigned count, size_t *size) {
+    if (request->legacy) {
+        char *reply = (char *)calloc(BUFSIZ, sizeof(char));
+        if (reply == NULL) {
+            return NULL;
+        }
+
+        size_t used = 1;
+        reply[0] = '[';
+
+        // old clients read at most BUFSIZ bytes
+        for (unsigned i = 0; i < count && used < BUFSIZ - 16; i++) {
+            used += sprintf(reply + used, i == 0 ? "%d" : ", %d", ids[i]);
+        }
+
+        reply[used++] = ']';
+        *size = used + 1;
+        return reply;
+    }
+
+    // frames of at most MAX_REQUEST bytes, an empty list is one empty frame
+    unsigned frames =
+        count == 0 ? 1 : (count + MAX_LIST_BATCH - 1) / MAX_LIST_BATCH;
+    char *reply = (char *)malloc(frames * sizeof(Header) +
+                                 count * sizeof(int32_t));
+    if (reply == NULL) {
+        return NULL;
+    }
+
+    size_t used = 0;
+    for (unsigned i = 0; i < frames; i++) {
+        unsigned first = i * MAX_LIST_BATCH;
+        unsigned n = count - first < MAX_LIST_BATCH ? count - first
+                                                    : MAX_LIST_BATCH;
+        Header header = {PROTOCOL_MAGIC, request->operation,
+                         i + 1 < frames ? FRAME_MORE : 0, request->sequence,
+                         request->client, n * sizeof(int32_t)};
+
+        memcpy(reply + used, &header, sizeof(header));
+        if (n > 0) {
+            memcpy(reply + used + sizeof(header), ids + first,
+                   n * sizeof(int32_t));
+        }
+        used += sizeof(header) + n * sizeof(int32_t);
+    }
+
+    *size = used;
+    return reply;
+}
+
+size_t reply_frame(const Request *request, const char *reply, size_t size) {
+    if (request->legacy || size < sizeof(Header)) {
+        return size;
+    }
+
+    Header header;
+    memcpy(&header, reply, sizeof(header));
+
+    size_t length = sizeof(Header) + header.length;
+    return length < size ? length : size;
+}
+
+char *encode_list_batch(const Request *request, const int *ids,
+                        unsigned count, int more, size_t *size) {
+    char *frame = encode_reply(request, ids, count * sizeof(int32_t), size);
+    if (frame != NULL && more) {
+        ((Header *)frame)->flags = FRAME_MORE;
+    }
+
+    return frame;
+}
+
+int receive_frame(int fd, Header *header, char **payload) {
+    *payload = NULL;
+
+    int status = read_full(fd, header, sizeof(Header));
+    if (status != 0) {
+        return status;
+    }
+
+    if (header->magic != PROTOCOL_MAGIC) {
+        printf("[PROTOCOL] invalid frame\n");
+        return -1;
+    }
+
+    if (header->length == 0) {
+        return 0;
+    }
+
+    *payload = (char *)malloc(header->length);
+    if (*payload == NULL) {
+        return -1;
+    }
+
+    if (read_full(fd, *payload, header->length) != 0) {
+        free(*payload);
+        *payload = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int decode_document(const char *payload, size_t length, Document *doc) {
+    Cursor cursor = {(char *)payload, length, 0, 0};
+
+    memset(doc, 0, sizeof(Document));
+    get_string(&cursor, doc->title, TITLE_SIZE - 1);
+    get_string(&cursor, doc->authors, AUTHORS_SIZE - 1);
+    get_string(&cursor, doc->year, YEAR_SIZE);
+    get_string(&cursor, doc->path, PATH_SIZE - 1);
+
+    return cursor.failed;
+}
@@ -1,6 +1,8 @@
 
 #include "rand_cache.h"
 #include "defs.h"
+#include "slot_map.h"
+#include "storage.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -30,22 +32,32 @@ typedef struct rand {
      */
     int *identifiers;
 
+    /**
+     * @brief Slot of each cached identifier, kept in sync with identifiers.
+     */
+    Slot_Map *map;
+
+    /**
+     * @brief Slot where the search for an empty slot starts.
+     */
+    int empty;
+
     /**
      * @brief Maximum number of documents the cache can hold.
      */
     int size;
 
     /**
-     * @brief File descriptor for the source document file.
+     * @brief Storage of the metadata.
      *
-     * Used to retrieve documents from disk in the event of a cache miss.
+     * Used to retrieve documents from the mapping in the event of a cache miss.
      */
-    int source;
+    const Storage *source;
 } RAND_Cache;
 
 
-void *randc_create(int cache_size, int source) {
-    if (cache_size < 0 || source < 0) {
+void *randc_create(int cache_size, const Storage *source) {
+    if (cache_size < 0 || source == NULL) {
         return NULL;
     }
 
@@ -75,6 +87,14 @@ void *randc_create(int cache_size, int source) {
     // ids also work as valid bits, -1 is invalid
     memset(cache->identifiers, -1, cache->size * sizeof(int));
 
+    cache->map = sm_create(cache->size);
+    if (cache->map == NULL) {
+        free(cache->identifiers);
+        free(cache->documents);
+        free(cache);
+        return NULL;
+    }
+
     return cache;
 }
 
@@ -90,12 +110,13 @@ void randc_destroy(void *cache) {
             free(rc->identifiers);
         }
 
+        sm_destroy(rc->map);
         free(rc);
     }
 }
 
 Document *randc_get_document(void *cache, int identifier) {
-    if (cache == NULL && identifier < 0) {
+    if (cache == NULL || identifier < 0) {
         return NULL;
     }
 
@@ -103,50 +124,41 @@ Document *randc_get_document(void *cache, int identifier) {
 
     printf("[CACHE INFO] searching in memory for %d\n", identifier);
 
-    int i;
-    // search the document in the cache
-    for (i = 0; i < rc->size && rc->identifiers[i] != identifier; i++)
-        ;
+    int i = sm_find(rc->map, identifier);
 
     // document is not in cache
-    if (i == rc->size) {
+    if (i == -1) {
         // get BLOCK_SIZE documents from metadata.bin
 
         printf("[CACHE INFO] going to disk for %d\n", identifier);
 
-        Document *docs = (Document *)calloc(BLOCK_SIZE, sizeof(Document));
-        if (docs == NULL) {
-            return NULL;
-        }
-
-        // go to the right position
-        lseek(rc->source, identifier * sizeof(Document), SEEK_SET);
-
-        // read the documents from disk
-        ssize_t out = read(rc->source, docs, BLOCK_SIZE * sizeof(Document));
-        if (out == -1) {
-            perror("read()");
-            return NULL;
-        }
-
-        Document *result = clone_document(docs);
-
-        // number of documents read, less or equal than BLOCK_SIZE
-        int temp_size = out / sizeof(Document);
-
         srand(time(0));
 
         int rand_position = rand() % rc->size;
 
         // place the documents in a random place
         // will replace documents, whether the cache is full or not!!!
-        for (int i = 0; i < temp_size; i++) {
-            memcpy(rc->documents + rand_position, docs + i, sizeof(docs[i]));
-            rc->identifiers[rand_position] = identifier + i;
-            rand_position = (rand_position + 1) % rc->size;
+        int wanted = BLOCK_SIZE < rc->size ? BLOCK_SIZE : rc->size;
+        Document *slots[BLOCK_SIZE];
+        for (i = 0; i < wanted; i++) {
+            int slot = (rand_position + i) % rc->size;
+            slots[i] = rc->documents + slot;
+            sm_set(rc->map, rc->identifiers, slot, -1);
         }
 
-        return result;
+        // read the block straight into the cache slots
+        int temp_size = storage_read_block(rc->source, identifier, slots,
+                                           wanted);
+        if (temp_size <= 0) {
+            return NULL;
+        }
+
+        for (i = 0; i < temp_size; i++) {
+            sm_set(rc->map, rc->identifiers, (rand_position + i) % rc->size,
+                   identifier + i);
+        }
+
+        return clone_document(slots[0]);
     }
 
     return clone_document(rc->documents + i);
@@ -156,20 +168,25 @@ void randc_add_document(void *cache, int identifier, Document * doc) {
     if (cache != NULL && identifier >= 0 && doc != NULL) {
         RAND_Cache *rc = (RAND_Cache *)cache;
 
-        int i = 0;
-        // search for empty positions
-        for (; i < rc->size && rc->identifiers[i] != -1; i++);
-
-        int position = i;
-        // cache is full, replace one document in a random place
-        if (position == rc->size) {
+        // a cached copy is replaced in place
+        int position = sm_find(rc->map, identifier);
+
+        if (position == -1 && sm_count(rc->map) < rc->size) {
+            // search for empty positions, from where the last one was found
+            position = rc->empty;
+            while (rc->identifiers[position] != -1) {
+                position = (position + 1) % rc->size;
+            }
+            rc->empty = (position + 1) % rc->size;
+        } else if (position == -1) {
+            // cache is full, replace one document in a random place
             srand(time(0));
             position = rand() % rc->size;
         }
 
         // place the document in the position
         memcpy(rc->documents + position, doc, sizeof(Document));
-        rc->identifiers[position] = identifier;
+        sm_set(rc->map, rc->identifiers, position, identifier);
     }
 }
 
@@ -178,13 +195,11 @@ void randc_remove_document(void *cache, int identifier) {
     if (cache != NULL && identifier >= 0) {
         RAND_Cache *rc = (RAND_Cache *)cache;
 
-        int i = 0;
-        // search for the document
-        for (; i < rc->size && rc->identifiers[i] != identifier; i++);
+        int i = sm_find(rc->map, identifier);
 
-        if (i < rc->size) {
+        if (i != -1) {
             // mark the position as invalid
-            rc->identifiers[i] = -1;
+            sm_set(rc->map, rc->identifiers, i, -1);
         }
     }
 }
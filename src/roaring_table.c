@@ -0,0 +1,835 @@
+
+#include "roaring_table.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define LOW_BITS 16         /**< Bits of an identifier inside its container */
+#define LOW_MASK 0xFFFF     /**< Mask of the bits inside a container */
+#define MAX_KEY 0x7FFF      /**< Key of the container of the largest int */
+#define BITMAP_WORDS 1024   /**< Words of a bitmap container */
+#define BITMAP_BYTES (BITMAP_WORDS * sizeof(uint64_t))
+#define INIT_ENTRIES 4      /**< First allocation of arrays and runs */
+
+/**
+ * @brief Forms of a container
+ */
+typedef enum {
+    KIND_ARRAY,             /**< Sorted low bits of the valid identifiers */
+    KIND_BITMAP,            /**< One bit per identifier of the container */
+    KIND_RUN                /**< Sorted runs of consecutive identifiers */
+} Kind;
+
+static const char *kind_names[] = {"array", "bitmap", "run"};
+
+/**
+ * @brief Consecutive valid identifiers, both ends included
+ */
+typedef struct {
+    uint16_t start;         /**< First identifier of the run */
+    uint16_t last;          /**< Last identifier of the run */
+} Run;
+
+/**
+ * @brief Valid identifiers sharing the 16 high bits
+ */
+typedef struct {
+    uint16_t key;           /**< High bits of the identifiers */
+    uint16_t kind;          /**< Form of data */
+    unsigned count;         /**< Number of valid identifiers */
+    unsigned runs;          /**< Number of runs of consecutive identifiers */
+    unsigned capacity;      /**< Entries allocated for arrays and runs */
+    void *data;             /**< Low bits, bitmap or runs */
+} Container;
+
+/**
+ * @brief Compressed table of valid identifiers
+ */
+typedef struct roaring_table {
+    Container *containers;  /**< Containers sorted by key */
+    unsigned n_containers;  /**< Number of containers */
+    unsigned capacity;      /**< Containers allocated */
+    unsigned count;         /**< Number of valid identifiers */
+} Roaring_Table;
+
+
+static size_t kind_size(unsigned kind, unsigned count, unsigned runs) {
+    switch (kind) {
+        case KIND_ARRAY:
+            return count * sizeof(uint16_t);
+        case KIND_BITMAP:
+            return BITMAP_BYTES;
+        default:
+            return runs * sizeof(Run);
+    }
+}
+
+/**
+ * @brief Position of the first value not below low
+ */
+static unsigned lower_value(const uint16_t *values, unsigned count,
+                            unsigned low) {
+    unsigned lo = 0, hi = count;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (values[mid] < low) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * @brief Position of the first run starting after low
+ */
+static unsigned upper_run(const Run *runs, unsigned count, unsigned low) {
+    unsigned lo = 0, hi = count;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (runs[mid].start <= low) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * @brief Position of the container of a key, or where it would be
+ */
+static unsigned lower_key(const Roaring_Table *rt, unsigned key) {
+    unsigned lo = 0, hi = rt->n_containers;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (rt->containers[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static int contains(const Container *c, unsigned low) {
+    switch (c->kind) {
+        case KIND_ARRAY: {
+            const uint16_t *values = (const uint16_t *)c->data;
+            unsigned i = lower_value(values, c->count, low);
+            return i < c->count && values[i] == low;
+        }
+        case KIND_BITMAP: {
+            const uint64_t *words = (const uint64_t *)c->data;
+            return (words[low / 64] >> (low % 64)) & 1;
+        }
+        default: {
+            const Run *runs = (const Run *)c->data;
+            unsigned i = upper_run(runs, c->runs, low);
+            return i > 0 && runs[i - 1].last >= low;
+        }
+    }
+}
+
+/**
+ * @brief Makes room for a number of entries of an array or runs
+ */
+static int reserve(Container *c, unsigned entries, size_t item) {
+    if (entries <= c->capacity) {
+        return 0;
+    }
+
+    unsigned capacity = c->capacity == 0 ? INIT_ENTRIES : c->capacity * 2;
+    while (capacity < entries) {
+        capacity *= 2;
+    }
+
+    void *other = realloc(c->data, capacity * item);
+    if (other == NULL) {
+        return -1;
+    }
+
+    c->data = other;
+    c->capacity = capacity;
+    return 0;
+}
+
+/**
+ * @brief Gives back half of an array or runs when a quarter is used
+ */
+static void shrink(Container *c, unsigned entries, size_t item) {
+    if (c->capacity > INIT_ENTRIES && entries < c->capacity / 4) {
+        unsigned capacity = c->capacity / 2;
+        void *other = realloc(c->data, capacity * item);
+        if (other != NULL) {
+            c->data = other;
+            c->capacity = capacity;
+        }
+    }
+}
+
+/**
+ * @brief Expands a container of any form to a bitmap
+ */
+static void to_words(const Container *c, uint64_t *words) {
+    switch (c->kind) {
+        case KIND_ARRAY: {
+            const uint16_t *values = (const uint16_t *)c->data;
+            memset(words, 0, BITMAP_BYTES);
+            for (unsigned i = 0; i < c->count; i++) {
+                words[values[i] / 64] |= (uint64_t)1 << (values[i] % 64);
+            }
+            break;
+        }
+        case KIND_BITMAP:
+            memcpy(words, c->data, BITMAP_BYTES);
+            break;
+        default: {
+            const Run *runs = (const Run *)c->data;
+            memset(words, 0, BITMAP_BYTES);
+            for (unsigned i = 0; i < c->runs; i++) {
+                for (unsigned v = runs[i].start; v <= runs[i].last; v++) {
+                    words[v / 64] |= (uint64_t)1 << (v % 64);
+                }
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Replaces the data of a container by a bitmap in another form
+ */
+static int encode(Container *c, const uint64_t *words, unsigned kind) {
+    void *data = NULL;
+    unsigned capacity = 0, m = 0;
+
+    if (kind == KIND_BITMAP) {
+        data = malloc(BITMAP_BYTES);
+        if (data != NULL) {
+            memcpy(data, words, BITMAP_BYTES);
+        }
+    } else if (kind == KIND_ARRAY) {
+        capacity = c->count;
+        uint16_t *values = (uint16_t *)malloc(capacity * sizeof(uint16_t));
+        for (unsigned i = 0; values != NULL && i < BITMAP_WORDS; i++) {
+            for (uint64_t bits = words[i]; bits != 0; bits &= bits - 1) {
+                values[m++] = i * 64 + __builtin_ctzll(bits);
+            }
+        }
+        data = values;
+    } else {
+        capacity = c->runs;
+        Run *runs = (Run *)malloc(capacity * sizeof(Run));
+        for (unsigned i = 0; runs != NULL && i < BITMAP_WORDS; i++) {
+            for (uint64_t bits = words[i]; bits != 0; bits &= bits - 1) {
+                unsigned v = i * 64 + __builtin_ctzll(bits);
+                if (m > 0 && runs[m - 1].last + 1u == v) {
+                    runs[m - 1].last = v;
+                } else {
+                    runs[m].start = v;
+                    runs[m++].last = v;
+                }
+            }
+        }
+        data = runs;
+    }
+
+    if (data == NULL) {
+        return -1;
+    }
+
+    free(c->data);
+    c->data = data;
+    c->capacity = capacity;
+    c->kind = kind;
+    return 0;
+}
+
+/**
+ * @brief Moves a container to its smallest form, if it is much smaller
+ */
+static void fit(Container *c) {
+    unsigned best = KIND_ARRAY;
+    size_t best_size = kind_size(KIND_ARRAY, c->count, c->runs);
+
+    if (kind_size(KIND_BITMAP, c->count, c->runs) < best_size) {
+        best = KIND_BITMAP;
+        best_size = kind_size(KIND_BITMAP, c->count, c->runs);
+    }
+    if (kind_size(KIND_RUN, c->count, c->runs) < best_size) {
+        best = KIND_RUN;
+        best_size = kind_size(KIND_RUN, c->count, c->runs);
+    }
+
+    // an eighth of slack, so a container on the edge stays as it is
+    size_t size = kind_size(c->kind, c->count, c->runs);
+    if (best == c->kind || size <= best_size + best_size / 8) {
+        return;
+    }
+
+    // on failure the container keeps its form
+    uint64_t words[BITMAP_WORDS];
+    to_words(c, words);
+    encode(c, words, best);
+}
+
+static int insert_container(Roaring_Table *rt, unsigned pos, unsigned key) {
+    if (rt->n_containers == rt->capacity) {
+        unsigned capacity = rt->capacity == 0 ? INIT_ENTRIES : rt->capacity * 2;
+        Container *other = (Container *)realloc(
+            rt->containers, capacity * sizeof(Container));
+        if (other == NULL) {
+            return -1;
+        }
+        rt->containers = other;
+        rt->capacity = capacity;
+    }
+
+    memmove(rt->containers + pos + 1, rt->containers + pos,
+            (rt->n_containers - pos) * sizeof(Container));
+    memset(rt->containers + pos, 0, sizeof(Container));
+    rt->containers[pos].key = key;
+    rt->containers[pos].kind = KIND_ARRAY;
+    rt->n_containers++;
+
+    return 0;
+}
+
+static void remove_container(Roaring_Table *rt, unsigned pos) {
+    free(rt->containers[pos].data);
+    memmove(rt->containers + pos, rt->containers + pos + 1,
+            (rt->n_containers - pos - 1) * sizeof(Container));
+    rt->n_containers--;
+
+    if (rt->capacity > INIT_ENTRIES && rt->n_containers < rt->capacity / 4) {
+        unsigned capacity = rt->capacity / 2;
+        Container *other = (Container *)realloc(
+            rt->containers, capacity * sizeof(Container));
+        if (other != NULL) {
+            rt->containers = other;
+            rt->capacity = capacity;
+        }
+    }
+}
+
+Roaring_Table *rt_create(void) {
+    return (Roaring_Table *)calloc(1, sizeof(Roaring_Table));
+}
+
+void rt_destroy(Roaring_Table *rt) {
+    if (rt != NULL) {
+        for (unsigned i = 0; i < rt->n_containers; i++) {
+            free(rt->containers[i].data);
+        }
+        free(rt->containers);
+        free(rt);
+    }
+}
+
+int rt_add_entry(Roaring_Table *rt, int id) {
+    if (rt == NULL || id < 0) {
+        return -1;
+    }
+
+    unsigned key = (unsigned)id >> LOW_BITS;
+    unsigned low = (unsigned)id & LOW_MASK;
+
+    unsigned pos = lower_key(rt, key);
+    if (pos == rt->n_containers || rt->containers[pos].key != key) {
+        if (insert_container(rt, pos, key) != 0) {
+            return 1;
+        }
+    }
+
+    Container *c = &(rt->containers[pos]);
+    if (contains(c, low)) {
+        return 0;
+    }
+
+    int left = low > 0 && contains(c, low - 1);
+    int right = low < LOW_MASK && contains(c, low + 1);
+
+    switch (c->kind) {
+        case KIND_ARRAY: {
+            if (reserve(c, c->count + 1, sizeof(uint16_t)) != 0) {
+                goto fail;
+            }
+            uint16_t *values = (uint16_t *)c->data;
+            unsigned i = lower_value(values, c->count, low);
+            memmove(values + i + 1, values + i,
+                    (c->count - i) * sizeof(uint16_t));
+            values[i] = low;
+            break;
+        }
+        case KIND_BITMAP: {
+            uint64_t *words = (uint64_t *)c->data;
+            words[low / 64] |= (uint64_t)1 << (low % 64);
+            break;
+        }
+        default: {
+            if (left == 0 && right == 0 &&
+                reserve(c, c->runs + 1, sizeof(Run)) != 0) {
+                goto fail;
+            }
+            Run *runs = (Run *)c->data;
+            unsigned i = upper_run(runs, c->runs, low);
+
+            if (left && right) {
+                // the identifier joins the runs around it
+                runs[i - 1].last = runs[i].last;
+                memmove(runs + i, runs + i + 1,
+                        (c->runs - i - 1) * sizeof(Run));
+            } else if (left) {
+                runs[i - 1].last = low;
+            } else if (right) {
+                runs[i].start = low;
+            } else {
+                memmove(runs + i + 1, runs + i, (c->runs - i) * sizeof(Run));
+                runs[i].start = low;
+                runs[i].last = low;
+            }
+            break;
+        }
+    }
+
+    c->count++;
+    c->runs = c->runs + 1 - left - right;
+    rt->count++;
+
+    fit(c);
+    return 0;
+
+fail:
+    if (c->count == 0) {
+        remove_container(rt, pos);
+    }
+    return 1;
+}
+
+int rt_remove_entry(Roaring_Table *rt, int id) {
+    if (rt == NULL || id < 0) {
+        return -1;
+    }
+
+    unsigned key = (unsigned)id >> LOW_BITS;
+    unsigned low = (unsigned)id & LOW_MASK;
+
+    unsigned pos = lower_key(rt, key);
+    if (pos == rt->n_containers || rt->containers[pos].key != key) {
+        return -1;
+    }
+
+    Container *c = &(rt->containers[pos]);
+    if (contains(c, low) == 0) {
+        return -1;
+    }
+
+    int left = low > 0 && contains(c, low - 1);
+    int right = low < LOW_MASK && contains(c, low + 1);
+
+    switch (c->kind) {
+        case KIND_ARRAY: {
+            uint16_t *values = (uint16_t *)c->data;
+            unsigned i = lower_value(values, c->count, low);
+            memmove(values + i, values + i + 1,
+                    (c->count - i - 1) * sizeof(uint16_t));
+            shrink(c, c->count - 1, sizeof(uint16_t));
+            break;
+        }
+        case KIND_BITMAP: {
+            uint64_t *words = (uint64_t *)c->data;
+            words[low / 64] &= ~((uint64_t)1 << (low % 64));
+            break;
+        }
+        default: {
+            // splitting a run needs one more, if there is no room the
+            // identifier stays valid
+            if (left && right && reserve(c, c->runs + 1, sizeof(Run)) != 0) {
+                return -1;
+            }
+            Run *runs = (Run *)c->data;
+            unsigned i = upper_run(runs, c->runs, low) - 1;
+
+            if (left && right) {
+                memmove(runs + i + 2, runs + i + 1,
+                        (c->runs - i - 1) * sizeof(Run));
+                runs[i + 1].start = low + 1;
+                runs[i + 1].last = runs[i].last;
+                runs[i].last = low - 1;
+            } else if (left) {
+                runs[i].last = low - 1;
+            } else if (right) {
+                runs[i].start = low + 1;
+            } else {
+                memmove(runs + i, runs + i + 1,
+                        (c->runs - i - 1) * sizeof(Run));
+                shrink(c, c->runs - 1, sizeof(Run));
+            }
+            break;
+        }
+    }
+
+    c->count--;
+    c->runs = c->runs + left + right - 1;
+    rt->count--;
+
+    if (c->count == 0) {
+        remove_container(rt, pos);
+    } else {
+        fit(c);
+    }
+
+    return id;
+}
+
+int rt_entry_is_valid(const Roaring_Table *rt, int id) {
+    if (rt == NULL || id < 0) {
+        return 0;
+    }
+
+    unsigned key = (unsigned)id >> LOW_BITS;
+    unsigned pos = lower_key(rt, key);
+    if (pos == rt->n_containers || rt->containers[pos].key != key) {
+        return 0;
+    }
+
+    return contains(&(rt->containers[pos]), (unsigned)id & LOW_MASK);
+}
+
+unsigned rt_size(const Roaring_Table *rt) { return rt == NULL ? 0 : rt->count; }
+
+void rt_show(const Roaring_Table *rt) {
+    if (rt != NULL) {
+        printf("\n- ROARING TABLE [containers: %5u, count: %5u]\n",
+               rt->n_containers, rt->count);
+        printf("[KEY, KIND, COUNT, RUNS, BYTES]\n");
+
+        for (unsigned i = 0; i < rt->n_containers; i++) {
+            const Container *c = &(rt->containers[i]);
+            printf("[%5u, %6s, %5u, %5u, %5zu]\n", c->key,
+                   kind_names[c->kind], c->count, c->runs,
+                   kind_size(c->kind, c->count, c->runs));
+        }
+    }
+}
+
+size_t rt_snapshot(const Roaring_Table *rt, void *out) {
+    // count and number of containers, then key, kind and number of
+    // entries of every container, followed by its data
+    size_t size = 2 * sizeof(unsigned);
+    char *cursor = (char *)out;
+
+    if (cursor != NULL) {
+        memcpy(cursor, &(rt->count), sizeof(unsigned));
+        memcpy(cursor + sizeof(unsigned), &(rt->n_containers),
+               sizeof(unsigned));
+    }
+
+    for (unsigned i = 0; i < rt->n_containers; i++) {
+        const Container *c = &(rt->containers[i]);
+        uint16_t head[2] = {c->key, c->kind};
+        uint32_t entries = c->kind == KIND_RUN ? c->runs : c->count;
+        size_t bytes = kind_size(c->kind, c->count, c->runs);
+
+        if (cursor != NULL) {
+            memcpy(cursor + size, head, sizeof(head));
+            memcpy(cursor + size + sizeof(head), &entries, sizeof(entries));
+            memcpy(cursor + size + sizeof(head) + sizeof(entries), c->data,
+                   bytes);
+        }
+        size += sizeof(head) + sizeof(entries) + bytes;
+    }
+
+    return size;
+}
+
+/**
+ * @brief Checks the data of a restored container and counts it
+ *
+ * @retval 0 Container is sound
+ * @retval -1 Container is damaged
+ */
+static int check_container(Container *c, uint32_t entries) {
+    c->count = 0;
+    c->runs = 0;
+
+    switch (c->kind) {
+        case KIND_ARRAY: {
+            const uint16_t *values = (const uint16_t *)c->data;
+            for (unsigned i = 0; i < entries; i++) {
+                if (i > 0 && values[i] <= values[i - 1]) {
+                    return -1;
+                }
+                if (i == 0 || values[i] != values[i - 1] + 1) {
+                    c->runs++;
+                }
+            }
+            c->count = entries;
+            break;
+        }
+        case KIND_BITMAP: {
+            const uint64_t *words = (const uint64_t *)c->data;
+            uint64_t carry = 0;
+            for (unsigned i = 0; i < BITMAP_WORDS; i++) {
+                // a run starts at every valid bit after an invalid one
+                uint64_t starts = words[i] & ~((words[i] << 1) | carry);
+                c->count += __builtin_popcountll(words[i]);
+                c->runs += __builtin_popcountll(starts);
+                carry = words[i] >> 63;
+            }
+            break;
+        }
+        default: {
+            const Run *runs = (const Run *)c->data;
+            for (unsigned i = 0; i < entries; i++) {
+                if (runs[i].last < runs[i].start ||
+                    (i > 0 && runs[i].start <= runs[i - 1].last + 1u)) {
+                    return -1;
+                }
+                c->count += runs[i].last - runs[i].start + 1u;
+            }
+            c->runs = entries;
+            break;
+        }
+    }
+
+    return c->count > 0 ? 0 : -1;
+}
+
+Roaring_Table *rt_restore(const void *data, size_t size, size_t *used) {
+    const char *bytes = (const char *)data;
+    unsigned count = 0, n_containers = 0;
+    size_t offset = 2 * sizeof(unsigned);
+
+    if (size < offset) {
+        return NULL;
+    }
+
+    memcpy(&count, bytes, sizeof(unsigned));
+    memcpy(&n_containers, bytes + sizeof(unsigned), sizeof(unsigned));
+
+    // every container takes at least its head
+    if (n_containers > MAX_KEY + 1 ||
+        n_containers > (size - offset) / (2 * sizeof(uint16_t) + 4)) {
+        return NULL;
+    }
+
+    Roaring_Table *rt = rt_create();
+    if (rt == NULL) {
+        return NULL;
+    }
+
+    if (n_containers > 0) {
+        rt->containers = (Container *)calloc(n_containers, sizeof(Container));
+        if (rt->containers == NULL) {
+            free(rt);
+            return NULL;
+        }
+        rt->capacity = n_containers;
+    }
+
+    for (unsigned i = 0; i < n_containers; i++) {
+        uint16_t head[2];
+        uint32_t entries = 0;
+
+        if (size - offset < sizeof(head) + sizeof(entries)) {
+            rt_destroy(rt);
+            return NULL;
+        }
+        memcpy(head, bytes + offset, sizeof(head));
+        memcpy(&entries, bytes + offset + sizeof(head), sizeof(entries));
+        offset += sizeof(head) + sizeof(entries);
+
+        Container *c = &(rt->containers[i]);
+        c->key = head[0];
+        c->kind = head[1];
+
+        // keys must increase, and a container holds at most 65536 entries
+        if (c->key > MAX_KEY || (i > 0 && c->key <= c[-1].key) ||
+            c->kind > KIND_RUN || entries == 0 || entries > LOW_MASK + 1u) {
+            rt_destroy(rt);
+            return NULL;
+        }
+
+        size_t length = c->kind == KIND_BITMAP
+                            ? BITMAP_BYTES
+                            : entries * (c->kind == KIND_ARRAY
+                                             ? sizeof(uint16_t)
+                                             : sizeof(Run));
+        if (size - offset < length) {
+            rt_destroy(rt);
+            return NULL;
+        }
+
+        c->data = malloc(length);
+        rt->n_containers++;
+        if (c->data == NULL) {
+            rt_destroy(rt);
+            return NULL;
+        }
+        memcpy(c->data, bytes + offset, length);
+        c->capacity = c->kind == KIND_BITMAP ? 0 : entries;
+        offset += length;
+
+        if (check_container(c, entries) != 0) {
+            rt_destroy(rt);
+            return NULL;
+        }
+        rt->count += c->count;
+    }
+
+    if (rt->count != count) {
+        rt_destroy(rt);
+        return NULL;
+    }
+
+    if (used != NULL) {
+        *used = offset;
+    }
+
+    return rt;
+}
+
+int *rt_get_valid_ids(const Roaring_Table *rt) {
+    if (rt == NULL || rt->count == 0) {
+        return NULL;
+    }
+
+    // allocate space for the result and the terminator
+    int *result = (int *)malloc((rt->count + 1) * sizeof(int));
+    if (result == NULL) {
+        return NULL;
+    }
+
+    unsigned m = 0;
+    for (unsigned i = 0; i < rt->n_containers; i++) {
+        const Container *c = &(rt->containers[i]);
+        int base = (int)c->key << LOW_BITS;
+
+        switch (c->kind) {
+            case KIND_ARRAY: {
+                const uint16_t *values = (const uint16_t *)c->data;
+                for (unsigned j = 0; j < c->count; j++) {
+                    result[m++] = base + values[j];
+                }
+                break;
+            }
+            case KIND_BITMAP: {
+                const uint64_t *words = (const uint64_t *)c->data;
+                for (unsigned j = 0; j < BITMAP_WORDS; j++) {
+                    for (uint64_t bits = words[j]; bits != 0;
+                         bits &= bits - 1) {
+                        result[m++] = base + j * 64 + __builtin_ctzll(bits);
+                    }
+                }
+                break;
+            }
+            default: {
+                const Run *runs = (const Run *)c->data;
+                for (unsigned j = 0; j < c->runs; j++) {
+                    for (unsigned v = runs[j].start; v <= runs[j].last; v++) {
+                        result[m++] = base + v;
+                    }
+                }
+                break;
+            }
+        }
+    }
+    result[m] = -1;
+
+    return result;
+}
+
+/**
+ * @brief First 64 aligned identifiers of a container, from low, with a
+ *        valid one
+ */
+static uint64_t container_bits(const Container *c, unsigned low,
+                               unsigned *first) {
+    uint64_t bits = 0;
+
+    switch (c->kind) {
+        case KIND_ARRAY: {
+            const uint16_t *values = (const uint16_t *)c->data;
+            unsigned i = lower_value(values, c->count, low);
+            if (i == c->count) {
+                return 0;
+            }
+
+            *first = values[i] & ~63u;
+            for (; i < c->count && values[i] < *first + 64; i++) {
+                bits |= (uint64_t)1 << (values[i] - *first);
+            }
+            break;
+        }
+        case KIND_BITMAP: {
+            const uint64_t *words = (const uint64_t *)c->data;
+            unsigned w = low / 64;
+
+            bits = words[w] & (~(uint64_t)0 << (low % 64));
+            while (bits == 0 && ++w < BITMAP_WORDS) {
+                bits = words[w];
+            }
+            *first = w * 64;
+            break;
+        }
+        default: {
+            const Run *runs = (const Run *)c->data;
+            unsigned i = upper_run(runs, c->runs, low);
+
+            // the run holding low, if there is one
+            if (i > 0 && runs[i - 1].last >= low) {
+                i--;
+            }
+            if (i == c->runs) {
+                return 0;
+            }
+
+            unsigned from = runs[i].start > low ? runs[i].start : low;
+            *first = from & ~63u;
+            for (; i < c->runs && runs[i].start < *first + 64; i++) {
+                unsigned lo = runs[i].start > from ? runs[i].start : from;
+                unsigned hi = runs[i].last < *first + 63 ? runs[i].last
+                                                         : *first + 63;
+                uint64_t upto = hi - *first == 63
+                                    ? ~(uint64_t)0
+                                    : ((uint64_t)1 << (hi - *first + 1)) - 1;
+                bits |= upto & (~(uint64_t)0 << (lo - *first));
+            }
+            break;
+        }
+    }
+
+    return bits;
+}
+
+uint64_t rt_next_bits(const Roaring_Table *rt, int from, int *base) {
+    if (rt == NULL || from < 0) {
+        return 0;
+    }
+
+    unsigned key = (unsigned)from >> LOW_BITS;
+    unsigned low = (unsigned)from & LOW_MASK;
+
+    for (unsigned pos = lower_key(rt, key); pos < rt->n_containers; pos++) {
+        const Container *c = &(rt->containers[pos]);
+        unsigned first = 0;
+
+        // later containers are looked at from their start
+        uint64_t bits = container_bits(c, c->key == key ? low : 0, &first);
+        if (bits != 0) {
+            *base = ((int)c->key << LOW_BITS) + (int)first;
+            return bits;
+        }
+    }
+
+    return 0;
+}
@@ -1,18 +1,46 @@
 #include "server_ops.h"
 #include "cache.h"
+#include "checkpoint.h"
 #include "defs.h"
 #include "document.h"
 #include "free_list.h"
 #include "index_table.h"
+#include "meta_index.h"
+#include "protocol.h"
+#include "shared_memory.h"
+#include "storage.h"
+#include "thread_pool.h"
+#include "uring.h"
 #include "utils.h"
+#include "wal.h"
+#include "worker_pool.h"
 
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <regex.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+/**
+ * @brief Open client session
+ *
+ * Keeps the writing side of a client FIFO open, so that replies to the
+ * same client don't need to reopen it.
+ */
+typedef struct session {
+    pid_t client;               /**< Client process ID, 0 if the slot is free */
+    int channel;                /**< Writing side of the client FIFO, or the connection */
+    int owned;                  /**< The server opened the channel and must close it */
+    int *bulk_ids;              /**< Identifiers assigned to an unfinished INDEX_BULK */
+    unsigned bulk_count;        /**< Number of identifiers in bulk_ids */
+    unsigned bulk_capacity;     /**< Capacity of bulk_ids */
+} Session;
+
 /**
  * @brief Server core data structure
  *
@@ -21,13 +49,53 @@
  */
 typedef struct server {
     char *document_folder;      /**< Directory containing the indexed documents */
-    int metadata_file;          /**< File descriptor for the storage file */
+    Storage *storage;           /**< Mapping of the metadata file */
     int requests_log_pipe;      /**< Channel to register operations made by the server */
     Free_List *free_list;       /**< Pointer to a Free List */
     Index_Table *index_table;   /**< Pointer to am Index Table */
+    Meta_Index *meta_index;     /**< Documents of each author and year */
     Cache *cache;               /**< Pointer to the Cache */
+    Wal *wal;                   /**< Log of the changes since the last checkpoint */
+    pid_t checkpointer;         /**< Process writing a checkpoint, 0 if none */
+    unsigned changes;           /**< Changes logged since the last checkpoint */
+    unsigned checkpoint_every;  /**< Changes between checkpoints, 0 for none */
+    time_t checkpoint_time;     /**< When the last checkpoint started */
+    pid_t compactor;            /**< Process copying the live records, 0 if none */
+    Request compact_request;    /**< COMPACT request answered when the copy ends */
+    int compact_reachable;      /**< The client of compact_request is still there */
+    Worker_Pool *pool;          /**< Workers that deliver replies, NULL to fork */
+    Thread_Pool *threads;       /**< Threads that serve the reads, NULL to serve them in the loop */
+    int uring;                  /**< Searches read the documents through io_uring */
+    pthread_rwlock_t table_lock; /**< Protects the index table, the free list, the secondary indexes and the metadata file */
+    Session sessions[MAX_SESSIONS]; /**< Clients with a persistent channel */
 } Server;
 
+/**
+ * @brief Kinds of work done by the worker pool
+ */
+typedef enum {
+    JOB_REPLY,      /**< Deliver a reply that is already built */
+    JOB_COUNT       /**< Count the keyword in a document and reply */
+} Job_Type;
+
+/**
+ * @brief Job handed to the worker pool
+ *
+ * Followed by `length` bytes: the reply (JOB_REPLY) or the null terminated
+ * path of the document, empty if it was not found (JOB_COUNT). The reply
+ * channel, when there is one, travels with the job as a descriptor.
+ */
+typedef struct {
+    Job_Type type;      /**< What to do */
+    Request request;    /**< Request being answered */
+    size_t length;      /**< Number of bytes after the job */
+} Job;
+
+static void run_job(void *context, const void *data, size_t size, int fd);
+static void run_task(void *context, void *task);
+static int deliver_response(Server *server, const Request *request,
+                            const void *response, size_t size, int blocking);
+
 
 static void record_requests(int reading_side) {
     // open the requests.log file
@@ -44,7 +112,7 @@ static void record_requests(int reading_side) {
     time_t t;
     struct tm *tm_info;
     char temp_time[20];
-    char args[512];
+    char args[1024];
 
     // read messages from the server
     while ((out = read(reading_side, &temp, sizeof(temp))) > 0) {
@@ -59,29 +127,50 @@ static void record_requests(int reading_side) {
         switch (temp.operation) {
             case INDEX:
                 op = 'A';
-                sprintf(args, "%s %s %s %s", temp.title, temp.authors,
-                        temp.year, temp.path);
+                snprintf(args, sizeof(args), "%s %s %.*s %s", temp.title,
+                         temp.authors, YEAR_SIZE, temp.year, temp.path);
                 break;
             case REMOVE:
                 op = 'D';
-                sprintf(args, "%s", temp.title);
+                sprintf(args, "%d", temp.key);
                 break;
             case CONSULT:
                 op = 'C';
-                sprintf(args, "%s", temp.title);
+                sprintf(args, "%d", temp.key);
                 break;
             case COUNT_WORD:
                 op = 'L';
-                sprintf(args, "%s %s", temp.title, temp.authors);
+                sprintf(args, "%d %s", temp.key, temp.keyword);
                 break;
             case LIST_WORD:
                 op = 'S';
-                sprintf(args, "%s %s", temp.title, temp.authors);
+                sprintf(args, "%s %d", temp.keyword, temp.n_procs);
                 break;
-            case KILL:
+            case SESSION_OPEN:
+            case SESSION_CLOSE:
                 op = 'K';
                 memset(args, 0, sizeof(args));
                 break;
+            case INDEX_BULK:
+                op = 'B';
+                sprintf(args, "%u documents", temp.n_records);
+                break;
+            case COMPACT:
+                op = 'P';
+                memset(args, 0, sizeof(args));
+                break;
+            case QUERY_AUTHOR:
+                op = 'W';
+                snprintf(args, sizeof(args), "%s", temp.authors);
+                break;
+            case QUERY_YEAR:
+                op = 'Y';
+                sprintf(args, "%d %d", temp.key, temp.key_last);
+                break;
+            case LOOKUP_PATH:
+                op = 'G';
+                snprintf(args, sizeof(args), "%s", temp.path);
+                break;
             case SHUTDOWN:
                 op = 'F';
                 memset(args, 0, sizeof(args));
@@ -92,15 +181,217 @@ static void record_requests(int reading_side) {
                 break;
         }
 
-        if (temp.operation != KILL) {
+        if (op != 'K') {
             sprintf(buffer, "[%d] requested %c | args: %s | (%s)\n", temp.client, op, args, temp_time);
             out = write(file, buffer, strlen(buffer));
         }
     }
 }
 
+static void index_metadata(Server *server, int identifier) {
+    Document buffer;
+    const Document *doc = storage_get(server->storage, identifier, &buffer);
+
+    if (doc != NULL) {
+        mi_add(server->meta_index, identifier, doc->authors, doc->year,
+               doc->path);
+    }
+}
+
+static void replay_change(void *context, Wal_Type type, int identifier) {
+    Server *server = (Server *)context;
+
+    if (type == WAL_INDEX) {
+        // the identifier may have been taken from the free list
+        it_add_entry(server->index_table, identifier);
+        fl_remove(server->free_list, identifier);
+
+        // the record read is the latest one of the identifier, a later
+        // change in the log takes it out again
+        if (server->meta_index != NULL) {
+            index_metadata(server, identifier);
+        }
+    } else if (it_remove_entry(server->index_table, identifier) != -1) {
+        fl_push(server->free_list, identifier);
+        mi_remove(server->meta_index, identifier);
+    }
+}
+
+static int build_meta_index(Server *server) {
+    server->meta_index = mi_create();
+    if (server->meta_index == NULL) {
+        return -1;
+    }
+
+    // every valid document, in the order of the heap
+    It_Iter iter;
+    it_iter_begin(server->index_table, 0, INT_MAX, &iter);
+    for (int id = it_iter_next(&iter); id != -1; id = it_iter_next(&iter)) {
+        index_metadata(server, id);
+    }
+
+    printf("[SERVER INFO] indexed the authors, years and paths of %u documents\n",
+           it_size(server->index_table));
+
+    return 0;
+}
+
+static int write_checkpoint(Server *server) {
+    // the checkpoint refers to records of the metadata file
+    if (storage_sync(server->storage) != 0 ||
+        checkpoint_write(CONTROL_FILE, server->free_list, server->index_table,
+                         server->meta_index) != 0) {
+        return -1;
+    }
+
+    // the logs only hold changes made after the checkpoint
+    unlink(WAL_OLD_FILE);
+    return wal_reset(server->wal);
+}
+
+static void start_checkpoint(Server *server) {
+    // one checkpoint at a time, and only every so many changes or seconds
+    if (server->checkpointer != 0 || server->checkpoint_every == 0 ||
+        server->changes == 0 ||
+        (server->changes < server->checkpoint_every &&
+         time(NULL) - server->checkpoint_time < CHECKPOINT_SECONDS)) {
+        return;
+    }
+
+    // new changes go to a new log while the old one is saved
+    if (wal_rotate(server->wal, WAL_OLD_FILE) != 0) {
+        return;
+    }
+
+    pid_t pid = fork();
+    switch (pid) {
+        case -1:
+            perror("fork()");
+            write_checkpoint(server);
+            break;
+        case 0:
+            // the child saves its copy of the structures, the server goes on
+            _exit(storage_sync(server->storage) == 0 &&
+                          checkpoint_write(CONTROL_FILE, server->free_list,
+                                           server->index_table,
+                                           server->meta_index) == 0
+                      ? 0
+                      : 1);
+        default:
+            server->checkpointer = pid;
+            break;
+    }
+
+    server->changes = 0;
+    server->checkpoint_time = time(NULL);
+}
+
+static void finish_checkpoint(Server *server, int status) {
+    server->checkpointer = 0;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        // the changes of the old log are in the checkpoint
+        unlink(WAL_OLD_FILE);
+        return;
+    }
+
+    // the old log can't be dropped, save everything right away instead
+    printf("[SERVER INFO] checkpoint failed, writing it again\n");
+    write_checkpoint(server);
+}
+
+static int keep_record(void *context, int identifier) {
+    return it_entry_is_valid((const Index_Table *)context, identifier);
+}
+
+static int start_compaction(Server *server) {
+    if (server->compactor != 0) {
+        return -1;
+    }
+
+    // changes made while the child copies are brought over at the end
+    storage_compact_start(server->storage);
+
+    pid_t pid = fork();
+    switch (pid) {
+        case -1:
+            perror("fork()");
+            storage_compact_abort(server->storage, STORAGE_FILE,
+                                  STORAGE_TABLE);
+            return -1;
+        case 0:
+            // the child copies the documents valid in its copy of the table
+            _exit(storage_compact_copy(server->storage, STORAGE_FILE,
+                                       STORAGE_TABLE, keep_record,
+                                       server->index_table) == 0
+                      ? 0
+                      : 1);
+        default:
+            server->compactor = pid;
+            break;
+    }
+
+    return 0;
+}
+
+static long long finish_compaction(Server *server, int status) {
+    long long reclaimed = -1;
+
+    server->compactor = 0;
+
+    // readers must not look at the storage while the files are swapped
+    pthread_rwlock_wrlock(&server->table_lock);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        reclaimed = storage_compact_finish(server->storage, STORAGE_FILE,
+                                           STORAGE_TABLE);
+    } else {
+        storage_compact_abort(server->storage, STORAGE_FILE, STORAGE_TABLE);
+    }
+    pthread_rwlock_unlock(&server->table_lock);
+
+    printf("[SERVER INFO] compaction reclaimed %lld bytes\n", reclaimed);
+    return reclaimed;
+}
+
+static int commit_changes(Server *server) {
+    // the records must be on the disk before the log refers to them
+    if (wal_sync_due(server->wal) && storage_sync(server->storage) != 0) {
+        return -1;
+    }
+
+    if (wal_commit(server->wal) != 0) {
+        return -1;
+    }
+
+    start_checkpoint(server);
+    return 0;
+}
+
+static int log_change(Server *server, Wal_Type type, int identifier) {
+    server->changes++;
+    return wal_append(server->wal, type, identifier);
+}
+
+static int replay_log(Server *server, const char *path) {
+    Wal *wal = wal_open(path, 0);
+    if (wal == NULL) {
+        return -1;
+    }
+
+    int replayed = wal_replay(wal, replay_change, server);
+    if (replayed > 0) {
+        printf("[SERVER INFO] replayed %d changes from %s\n", replayed, path);
+    }
+
+    wal_close(wal);
+    return replayed;
+}
+
 Server *start_server(const char *document_folder, int cache_size,
-                     Cache_Type type) {
+                     Cache_Type type, unsigned workers, unsigned threads,
+                     int map, unsigned sync_every,
+                     unsigned checkpoint_every, unsigned recovery_threads,
+                     int uring, Table_Type table) {
     printf("\n[SERVER IS STARTING]\n");
 
     Server *server = (Server *)calloc(1, sizeof(Server));
@@ -114,48 +405,94 @@ Server *start_server(const char *document_folder, int cache_size,
         return NULL;
     }
 
-    // open metadata.bin
-    server->metadata_file = open(STORAGE_FILE, O_CREAT | O_RDWR, 0666);
-    if (server->metadata_file == -1) {
-        perror("open()");
-        free(server->document_folder);
-        free(server);
-        return NULL;
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        server->sessions[i].channel = -1;
     }
 
-    // open the control metadata file
-    int control_file = open(CONTROL_FILE, O_CREAT | O_RDONLY, 0666);
-    if (control_file == -1) {
-        perror("open()");
-        close(server->metadata_file);
+    pthread_rwlock_init(&server->table_lock, NULL);
+
+    // every process and thread sets up its own ring, this one only checks
+    // that the kernel allows them
+    if (uring) {
+        Uring *probe = uring_create(URING_DEPTH);
+        if (probe == NULL) {
+            printf("[SERVER INFO] io_uring is not available, using read()\n");
+            uring = 0;
+        }
+        uring_destroy(probe);
+    }
+    server->uring = uring;
+
+    // load the last checkpoint of the free list and the index table
+    int loaded = checkpoint_load(CONTROL_FILE, table, &server->free_list,
+                                 &server->index_table, &server->meta_index);
+
+    // open (and map) metadata.bin and its offset table, the checkpoint
+    // tells which records of a file in an old format were removed
+    server->storage =
+        loaded == -1 ? NULL
+                     : storage_open(STORAGE_FILE, STORAGE_TABLE, map, uring,
+                                    loaded == 0 ? keep_record : NULL,
+                                    server->index_table);
+    if (server->storage == NULL) {
+        if (loaded != -1) {
+            fl_destroy(server->free_list);
+            it_destroy(server->index_table);
+            mi_destroy(server->meta_index);
+        }
         free(server->document_folder);
         free(server);
         return NULL;
     }
 
-    // upload the free list from the control file
-    server->free_list = fl_upload(control_file);
-    if (server->free_list == NULL) {
-        close(server->metadata_file);
-        close(control_file);
+    // without a checkpoint, the records of metadata.bin tell which
+    // documents are valid
+    if (loaded == 1 && storage_count(server->storage) > 0) {
+        printf("[SERVER INFO] %s is missing, scanning %s\n", CONTROL_FILE,
+               STORAGE_FILE);
+        fl_destroy(server->free_list);
+        it_destroy(server->index_table);
+        mi_destroy(server->meta_index);
+        server->meta_index = NULL;
+        loaded = checkpoint_rebuild(server->storage, recovery_threads, table,
+                                    &server->free_list,
+                                    &server->index_table) == 0
+                     ? 2
+                     : -1;
+    }
+
+    if (loaded == -1) {
+        storage_close(server->storage);
         free(server->document_folder);
         free(server);
         return NULL;
     }
 
-    // upload the index table from the control file
-    server->index_table = it_upload(control_file);
-    if (server->index_table == NULL) {
-        close(server->metadata_file);
-        close(control_file);
+    // changes made after the checkpoint, the log moved aside by a
+    // checkpoint that didn't finish comes first, a rebuilt table already
+    // has every change of the logs
+    int old = loaded == 2 ? 0 : replay_log(server, WAL_OLD_FILE);
+    int replayed = loaded == 2 ? 0 : replay_log(server, WAL_FILE);
+
+    // a rebuilt table, or a checkpoint older than the secondary indexes,
+    // leaves them to be read from the metadata file
+    int indexed = server->meta_index != NULL ? 0 : build_meta_index(server);
+
+    server->wal = wal_open(WAL_FILE, sync_every);
+    if (server->wal == NULL || old == -1 || replayed == -1 || indexed != 0 ||
+        write_checkpoint(server) != 0) {
+        storage_close(server->storage);
         free(server->document_folder);
         fl_destroy(server->free_list);
+        it_destroy(server->index_table);
+        mi_destroy(server->meta_index);
+        wal_close(server->wal);
         free(server);
         return NULL;
     }
 
-    close(control_file);
-    unlink(CONTROL_FILE);
+    server->checkpoint_every = checkpoint_every;
+    server->checkpoint_time = time(NULL);
 
     int requests_pipe[2];
     if (pipe(requests_pipe) != 0) {
@@ -173,7 +510,7 @@ Server *start_server(const char *document_folder, int cache_size,
         case 0:
             /* child code */
             close(requests_pipe[1]); // close writing side of the pipe
-            close(server->metadata_file);
+            storage_close(server->storage);
 
             record_requests(requests_pipe[0]);
             close(requests_pipe[0]); // close reading side of the pipe
@@ -188,7 +525,7 @@ Server *start_server(const char *document_folder, int cache_size,
 
     // start the cache
     if (type != NONE && cache_size > 0) {
-        server->cache = cache_start(cache_size, type, server->metadata_file);
+        server->cache = cache_start(cache_size, type, server->storage);
         if (server->cache == NULL) {
             shutdown_server(server);
             return NULL;
@@ -197,208 +534,950 @@ Server *start_server(const char *document_folder, int cache_size,
         server->cache = NULL;
     }
 
-    // show empty data structures
-    it_show(server->index_table);
-    fl_show(server->free_list);
-    show_cache(server->cache);
+    // show empty data structures
+    it_show(server->index_table);
+    fl_show(server->free_list);
+    show_cache(server->cache);
+
+    // start the workers last, they get a copy of the server as it is now
+    if (workers > 0) {
+        server->pool = pool_create(workers, run_job, server);
+        if (server->pool == NULL) {
+            shutdown_server(server);
+            return NULL;
+        }
+    }
+
+    if (threads > 0) {
+        server->threads = tpool_create(threads, run_task, server);
+        if (server->threads == NULL) {
+            shutdown_server(server);
+            return NULL;
+        }
+    }
+
+    printf("\n[SERVER IS ONLINE]\n");
+    return server;
+}
+
+static int find_session(const Server *server, pid_t client) {
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (server->sessions[i].client == client) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void open_session(Server *server, const Request *request) {
+    pid_t client = request->client;
+    int slot = find_session(server, 0);
+    if (slot == -1) {
+        printf("[SERVER INFO] no room for the session of %d\n", client);
+        return;
+    }
+
+    int channel = request->channel;
+    int owned = 0;
+
+    // shared memory clients already own a channel, their slot
+    if (channel == -1 && request->ring == NULL) {
+        char client_fifo[50];
+        sprintf(client_fifo, "%s_%d", CLIENT_FIFO, client);
+
+        // the client already holds the reading side, so this does not block
+        channel = open(client_fifo, O_WRONLY | O_NONBLOCK);
+        if (channel == -1) {
+            perror("open()");
+            return;
+        }
+
+        // replies are written with blocking semantics
+        fcntl(channel, F_SETFL, fcntl(channel, F_GETFL) & ~O_NONBLOCK);
+        owned = 1;
+    }
+
+    server->sessions[slot].client = client;
+    server->sessions[slot].channel = channel;
+    server->sessions[slot].owned = owned;
+
+    // acknowledge the session
+    size_t size = 0;
+    char *ack = encode_int_reply(request, 0, &size);
+    if (ack != NULL && request->ring != NULL) {
+        shm_write(request->ring, ack, size, client);
+    } else if (ack != NULL && write(channel, ack, size) == -1) {
+        perror("write()");
+    }
+
+    free(ack);
+}
+
+static void release_session(Server *server, int slot) {
+    if (server->sessions[slot].owned) {
+        close(server->sessions[slot].channel);
+    }
+
+    free(server->sessions[slot].bulk_ids);
+    memset(server->sessions + slot, 0, sizeof(Session));
+    server->sessions[slot].channel = -1;
+}
+
+static void close_session(Server *server, pid_t client) {
+    int slot = find_session(server, client);
+    if (slot != -1) {
+        release_session(server, slot);
+    }
+}
+
+void drop_client(Server *server, pid_t client) {
+    close_session(server, client);
+
+    if (server->compactor != 0 && server->compact_request.client == client) {
+        server->compact_reachable = 0;
+    }
+}
+
+static void answer_compaction(Server *server, long long reclaimed) {
+    size_t size = 0;
+    char *reply = encode_reply(&server->compact_request, &reclaimed,
+                               sizeof(reclaimed), &size);
+
+    if (reply != NULL && server->compact_reachable) {
+        deliver_response(server, &server->compact_request, reply, size, 0);
+    }
+
+    free(reply);
+}
+
+void reap_worker(Server *server, pid_t pid, int status) {
+    if (pid == server->checkpointer) {
+        finish_checkpoint(server, status);
+        return;
+    }
+
+    if (pid == server->compactor) {
+        answer_compaction(server, finish_compaction(server, status));
+        return;
+    }
+
+    pool_reap(server->pool, pid);
+}
+
+void drop_channel(Server *server, int channel) {
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (server->sessions[i].client != 0 &&
+            server->sessions[i].channel == channel) {
+            release_session(server, i);
+        }
+    }
+
+    // the descriptor may be reused by another connection
+    if (server->compactor != 0 &&
+        server->compact_request.channel == channel) {
+        server->compact_reachable = 0;
+    }
+}
+
+static int reply_channel(const Server *server, const Request *request) {
+    if (request->channel != -1) {
+        return request->channel;
+    }
+
+    int slot = find_session(server, request->client);
+    return slot == -1 ? -1 : server->sessions[slot].channel;
+}
+
+/**
+ * @brief Writes a reply one frame at a time
+ *
+ * Every frame of a reply is at most PIPE_BUF bytes, so each write is atomic
+ * and the frames of other replies on the same channel only come between
+ * them.
+ */
+static int write_frames(const Request *request, int fd, const char *response,
+                        size_t size) {
+    for (size_t done = 0; done < size;) {
+        size_t length = reply_frame(request, response + done, size - done);
+
+        if (write(fd, response + done, length) == -1) {
+            perror("write()");
+            return -1;
+        }
+        done += length;
+    }
+
+    return 0;
+}
+
+static int write_reply(const Request *request, int channel,
+                       const void *response, size_t size) {
+    const char *frames = (const char *)response;
+
+    if (request->ring != NULL) {
+        // the client reads the reply straight from shared memory
+        for (size_t done = 0; done < size;) {
+            size_t length = reply_frame(request, frames + done, size - done);
+
+            if (shm_write(request->ring, frames + done, length,
+                          request->client) != 0) {
+                printf("[SERVER INFO] client %d is gone\n", request->client);
+                return -1;
+            }
+            done += length;
+        }
+
+        return 0;
+    }
+
+    if (channel != -1) {
+        // the client has a persistent channel
+        return write_frames(request, channel, frames, size);
+    }
+
+    char client_fifo[50];
+    sprintf(client_fifo, "%s_%d", CLIENT_FIFO, request->client);
+
+    // open the client fifo to send response
+    int output = open(client_fifo, O_WRONLY);
+    if (output == -1) {
+        perror("open()");
+        return -1;
+    }
+
+    // send response to client
+    int status = write_frames(request, output, frames, size);
+    close(output);
+
+    return status;
+}
+
+static int write_response(const Server *server, const Request *request,
+                          const void *response, size_t size) {
+    return write_reply(request, reply_channel(server, request), response,
+                       size);
+}
+
+static void run_job(void *context, const void *data, size_t size, int fd) {
+    const Job *job = (const Job *)data;
+    const char *payload = (const char *)data + sizeof(Job);
+    char *reply = NULL;
+    size_t length = 0;
+    int count = -1;
+
+    (void)context;
+
+    if (size < sizeof(Job) || size != sizeof(Job) + job->length) {
+        return;
+    }
+
+    switch (job->type) {
+        case JOB_REPLY:
+            write_reply(&job->request, fd, payload, job->length);
+            break;
+        case JOB_COUNT:
+            if (job->length > 1) {
+                // count the number of lines
+                count = count_keyword(payload, job->request.keyword);
+            }
+
+            reply = encode_int_reply(&job->request, count, &length);
+            if (reply != NULL) {
+                write_reply(&job->request, fd, reply, length);
+                free(reply);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static int submit_job(Server *server, Job_Type type, const Request *request,
+                      const void *payload, size_t length) {
+    char *data = (char *)malloc(sizeof(Job) + length);
+    if (data == NULL) {
+        return 1;
+    }
+
+    Job *job = (Job *)data;
+    job->type = type;
+    job->request = *request;
+    job->request.records = NULL;
+    job->length = length;
+    memcpy(data + sizeof(Job), payload, length);
+
+    // the worker writes on its own copy of the channel
+    int channel = request->ring != NULL ? -1 : reply_channel(server, request);
+
+    int status = pool_submit(server->pool, data, sizeof(Job) + length, channel);
+    free(data);
+
+    return status;
+}
+
+static int deliver_response(Server *server, const Request *request,
+                            const void *response, size_t size, int blocking) {
+    if (blocking) {
+        // a thread of the pool, the channel was chosen when it was queued
+        write_reply(request, request->channel, response, size);
+        return 0;
+    }
+
+    if (request->ring != NULL || reply_channel(server, request) != -1) {
+        // a channel is already open, no need for a child process
+        if (write_response(server, request, response, size) != 0) {
+            close_session(server, request->client);
+        }
+
+        return 0;
+    }
+
+    // opening the client fifo may block, leave it to a worker
+    if (submit_job(server, JOB_REPLY, request, response, size) == 0) {
+        return 0;
+    }
+
+    switch (fork()) {
+        case -1:
+            perror("fork()");
+            return 1;
+        case 0:
+            write_response(server, request, response, size);
+            _exit(0);
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+static const Document *get_document(Server *server, int identifier,
+                                    Document *buffer) {
+    // check if the entry is valid
+    if (it_entry_is_valid(server->index_table, identifier) == 0) {
+        return NULL;
+    }
+
+    if (server->cache == NULL) {
+        // decoded into the buffer
+        return storage_get(server->storage, identifier, buffer);
+    }
+
+    // get document from cache
+    Document *doc = cache_get_document(server->cache, identifier);
+    if (doc == NULL) {
+        return NULL;
+    }
+
+    memcpy(buffer, doc, sizeof(Document));
+    destroy_document(doc);
+
+    return buffer;
+}
+
+static int same_metadata(const Document *a, const Document *b) {
+    return strcmp(a->title, b->title) == 0 &&
+           strcmp(a->authors, b->authors) == 0 &&
+           strncmp(a->year, b->year, YEAR_SIZE) == 0;
+}
+
+static int same_document(Server *server, int identifier,
+                         const Document *doc) {
+    Document buffer;
+    const Document *old = storage_get(server->storage, identifier, &buffer);
+
+    return old != NULL && same_metadata(old, doc);
+}
+
+/**
+ * @brief What index_batch() does with each document of a batch
+ */
+typedef enum {
+    BATCH_SKIP,     /**< Same metadata as the indexed document, nothing to write */
+    BATCH_NEW,      /**< New path, takes a free identifier */
+    BATCH_COPY,     /**< Later copy of a path that took an identifier in the batch */
+    BATCH_REWRITE   /**< New metadata for a path indexed before the batch */
+} Batch_Kind;
+
+/**
+ * @brief Last document of the batch, before i, written with the identifier
+ *        of i
+ */
+static int earlier_copy(const int *ids, const unsigned char *kind,
+                        unsigned i) {
+    for (unsigned j = i; j-- > 0;) {
+        if (ids[j] == ids[i] && kind[j] != BATCH_SKIP) {
+            return j;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Undoes the changes of index_batch() for the documents before end
+ *
+ * The identifiers taken go back to the free list, and the documents whose
+ * metadata was rewritten get their previous record and keys back.
+ */
+static void unindex_batch(Server *server, const int *ids,
+                          const unsigned char *kind, const Document *old,
+                          unsigned end) {
+    for (unsigned i = end; i-- > 0;) {
+        if (kind[i] == BATCH_NEW) {
+            // later copies are undone with it
+            mi_remove(server->meta_index, ids[i]);
+            it_remove_entry(server->index_table, ids[i]);
+
+            // identifiers past the end of the offset table are free already
+            if ((unsigned)ids[i] < storage_count(server->storage)) {
+                storage_remove(server->storage, ids[i]);
+                fl_push(server->free_list, ids[i]);
+            }
+        } else if (kind[i] == BATCH_REWRITE && old[i].path[0] != '\0') {
+            if (!same_document(server, ids[i], old + i)) {
+                storage_write(server->storage, ids[i], old + i, 1);
+            }
+            mi_add(server->meta_index, ids[i], old[i].authors, old[i].year,
+                   old[i].path);
+        }
+    }
+}
+
+static int index_batch(Server *server, const Document *docs, unsigned count,
+                       int *ids) {
+    // end of the offset table, where new identifiers are appended
+    int next = storage_count(server->storage);
+
+    // what is done with each document, and the records it replaces
+    unsigned char *kind = (unsigned char *)malloc(count + 1);
+    Document *old = (Document *)malloc((count + 1) * sizeof(Document));
+    if (kind == NULL || old == NULL) {
+        free(kind);
+        free(old);
+        return -1;
+    }
+
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        // a path already indexed keeps its identifier, and its record is
+        // only rewritten if the metadata changed
+        ids[i] = mi_find_path(server->meta_index, docs[i].path);
+        int j = ids[i] == -1 ? -1 : earlier_copy(ids, kind, i);
+
+        if (ids[i] == -1) {
+            // reuse the free identifiers first, then append
+            kind[i] = BATCH_NEW;
+            ids[i] = fl_is_empty(server->free_list)
+                         ? next++
+                         : fl_pop(server->free_list);
+        } else if (j != -1) {
+            // the metadata file doesn't have the earlier copy yet, the path
+            // holds what it says
+            if (same_metadata(docs + j, docs + i)) {
+                kind[i] = BATCH_SKIP;
+            } else if (kind[j] == BATCH_REWRITE) {
+                old[i] = old[j];
+                kind[i] = BATCH_REWRITE;
+            } else {
+                kind[i] = BATCH_COPY;
+            }
+        } else {
+            // the record before the batch, put back if the batch fails
+            if (storage_get(server->storage, ids[i], old + i) == NULL) {
+                memset(old + i, 0, sizeof(Document));
+            }
+            kind[i] = same_metadata(old + i, docs + i) ? BATCH_SKIP
+                                                        : BATCH_REWRITE;
+        }
+
+        if (kind[i] == BATCH_SKIP) {
+            continue;
+        }
+
+        // a prefetched block may hold the previous record of the identifier
+        cache_remove_document(server->cache, ids[i]);
+
+        // later copies of the path in the batch find it
+        if (mi_add(server->meta_index, ids[i], docs[i].authors, docs[i].year,
+                   docs[i].path) != 0) {
+            unindex_batch(server, ids, kind, old, i + 1);
+            free(kind);
+            free(old);
+            return -1;
+        }
+    }
+
+    // one write per run of consecutive identifiers
+    unsigned start = 0;
+    for (i = 1; i <= count; i++) {
+        if (i < count && kind[i] != BATCH_SKIP &&
+            kind[i - 1] != BATCH_SKIP && ids[i] == ids[i - 1] + 1) {
+            continue;
+        }
+
+        if (kind[start] != BATCH_SKIP &&
+            storage_write(server->storage, ids[start], docs + start,
+                          i - start) != 0) {
+            unindex_batch(server, ids, kind, old, count);
+            free(kind);
+            free(old);
+            return -1;
+        }
+
+        start = i;
+    }
+
+    // documents of a batch are not cached, they would evict everything else
+    for (i = 0; i < count; i++) {
+        if (kind[i] != BATCH_SKIP &&
+            it_add_entry(server->index_table, ids[i]) != 0) {
+            unindex_batch(server, ids, kind, old, count);
+            free(kind);
+            free(old);
+            return -1;
+        }
+    }
+
+    free(old);
+
+    // the batch is applied, like a single INDEX a change that can't be
+    // logged is only lost if the server stops before the next checkpoint
+    for (i = 0; i < count; i++) {
+        if (kind[i] != BATCH_SKIP &&
+            log_change(server, WAL_INDEX, ids[i]) != 0) {
+            free(kind);
+            return -1;
+        }
+    }
+
+    free(kind);
+    return 0;
+}
+
+static int bulk_append(Session *session, const int *ids, unsigned count) {
+    if (session->bulk_count + count > session->bulk_capacity) {
+        unsigned capacity = session->bulk_capacity == 0 ? 256
+                                                        : session->bulk_capacity;
+        while (capacity < session->bulk_count + count) {
+            capacity *= 2;
+        }
+
+        int *other = (int *)realloc(session->bulk_ids, capacity * sizeof(int));
+        if (other == NULL) {
+            return 1;
+        }
+
+        session->bulk_ids = other;
+        session->bulk_capacity = capacity;
+    }
+
+    memcpy(session->bulk_ids + session->bulk_count, ids, count * sizeof(int));
+    session->bulk_count += count;
+
+    return 0;
+}
+
+/**
+ * @brief Document being read by search_uring()
+ */
+typedef struct {
+    int identifier;     /**< Document identifier */
+    int fd;             /**< Descriptor of the document, -1 if the slot is free */
+    char *buffer;       /**< Contents of the document */
+    size_t capacity;    /**< Capacity of buffer */
+    size_t size;        /**< Bytes of the document */
+    size_t done;        /**< Bytes read so far */
+} Pending_Read;
+
+static void grep_document(Server *server, const char *keyword, int identifier,
+                          int output) {
+    Document buffer;
+
+    // get the document from the storage
+    const Document *doc = get_document(server, identifier, &buffer);
+    if (doc == NULL) {
+        return;
+    }
+
+    char *path = join_paths(server->document_folder, doc->path);
+
+    // check if the keyword exists in the file
+    int out = keyword_exists(path, keyword);
+    free(path);
+
+    if (out == 0 && write(output, &identifier, sizeof(int)) == -1) {
+        // send the id to the parent process, the write of one integer
+        // is atomic, so ids are never mixed
+        perror("write()");
+    }
+}
+
+static void search_grep(Server *server, const char *keyword, It_Iter range,
+                        int output) {
+    for (int id = it_iter_next(&range); id != -1; id = it_iter_next(&range)) {
+        grep_document(server, keyword, id, output);
+    }
+}
+
+static int open_document(Server *server, int identifier, Pending_Read *read) {
+    Document buffer;
+    const Document *doc = get_document(server, identifier, &buffer);
+    if (doc == NULL) {
+        return -1;
+    }
+
+    char *path = join_paths(server->document_folder, doc->path);
+    int fd = path == NULL ? -1 : open(path, O_RDONLY);
+    free(path);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // an empty document never has the keyword
+    struct stat info;
+    if (fstat(fd, &info) == -1 || info.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (read->capacity < (size_t)info.st_size + 1) {
+        char *other = (char *)realloc(read->buffer, info.st_size + 1);
+        if (other == NULL) {
+            close(fd);
+            return -1;
+        }
+
+        read->buffer = other;
+        read->capacity = info.st_size + 1;
+    }
+
+    read->identifier = identifier;
+    read->fd = fd;
+    read->size = info.st_size;
+    read->done = 0;
 
-    printf("\n[SERVER IS ONLINE]\n");
-    return server;
+    return 0;
 }
 
-static void send_response(pid_t client, const void *response, size_t size) {
-    char client_fifo[50];
-    sprintf(client_fifo, "%s_%d", CLIENT_FIFO, client);
+static int queue_read(Uring *ring, Pending_Read *reads, unsigned slot) {
+    Pending_Read *read = reads + slot;
+    size_t length = read->size - read->done;
 
-    // open the client fifo to send response
-    int output = open(client_fifo, O_WRONLY);
-    if (output == -1) {
-        perror("open()");
-        return;
+    // larger documents take several reads
+    if (length > 1 << 30) {
+        length = 1 << 30;
     }
 
-    // send response to client
-    ssize_t out = write(output, response, size);
-    if (out == -1) {
-        perror("write()");
-        return;
+    return uring_read(ring, read->fd, read->buffer + read->done, length,
+                      read->done, slot);
+}
+
+/**
+ * @brief Searches the documents of a range with many reads in flight
+ *
+ * @retval 0 Every document of the range was searched
+ * @retval 1 The ring failed, the documents left in the range were not
+ * @retval -1 The ring can't be set up, the range is untouched
+ */
+static int search_uring(Server *server, const char *keyword, It_Iter *range,
+                        int output) {
+    // the same basic regular expression grep would use, one line at a time
+    regex_t regex;
+    if (regcomp(&regex, keyword, REG_NOSUB | REG_NEWLINE) != 0) {
+        return -1;
     }
 
-    close(output);
+    Uring *ring = uring_create(URING_DEPTH);
+    if (ring == NULL) {
+        regfree(&regex);
+        return -1;
+    }
 
-    int server = open(SERVER_FIFO, O_WRONLY);
-    if (server == -1) {
-        perror("open()");
-        return;
+    Pending_Read reads[URING_DEPTH];
+    memset(reads, 0, sizeof(reads));
+    for (unsigned i = 0; i < URING_DEPTH; i++) {
+        reads[i].fd = -1;
     }
 
-    Request request;
-    request.operation = KILL;
-    request.client = getpid();
-    memset(request.title, 0, sizeof(request.title));
-    memset(request.authors, 0, sizeof(request.authors));
-    memset(request.year, 0, sizeof(request.year));
-    memset(request.path, 0, sizeof(request.path));
+    unsigned pending = 0;
+    uint64_t slot = 0;
+    int result = 0, failed = 0;
+    int next = it_iter_next(range);
+
+    // once the ring fails, only the reads in flight are waited for
+    while (pending > 0 || (next != -1 && failed == 0)) {
+        // keep a read in flight for every free slot
+        for (unsigned i = 0; i < URING_DEPTH && next != -1 && failed == 0;
+             i++) {
+            if (reads[i].fd != -1) {
+                continue;
+            }
 
-    // tell the server that the job is done
-    out = write(server, &request, sizeof(request));
-    close(server);
-    if (out == -1) {
-        perror("write()");
-        return;
-    }
-}
+            int identifier = next;
+            next = it_iter_next(range);
+            if (open_document(server, identifier, reads + i) != 0) {
+                continue;
+            }
 
-static Document *get_document(Server *server, int identifier) {
-    // check if the entry is valid
-    if (it_entry_is_valid(server->index_table, identifier) == 0) {
-        return NULL;
-    }
+            if (queue_read(ring, reads, i) == 0) {
+                pending++;
+                continue;
+            }
 
-    if (server->cache == NULL) {
-        // get document from disk
-        Document doc;
+            // no room in the ring, this one is read the old way
+            close(reads[i].fd);
+            reads[i].fd = -1;
+            grep_document(server, keyword, identifier, output);
+        }
 
-        // go to the right position
-        if (lseek(server->metadata_file, identifier * sizeof(Document),
-                  SEEK_SET) == -1) {
-            perror("lseek()");
-            return NULL;
+        if (pending == 0) {
+            continue;
         }
 
-        // read the metadata
-        ssize_t out = read(server->metadata_file, &doc, sizeof(doc));
-        if (out == -1) {
-            perror("read()");
-            return NULL;
+        // the ring is tried once more for the reads in flight, a second
+        // failure gives up waiting for them
+        if (uring_submit(ring, 1) != 0) {
+            if (failed++ > 0) {
+                break;
+            }
+        }
+
+        // documents are checked in the order their reads finish
+        while (uring_reap(ring, &slot, &result)) {
+            Pending_Read *read = reads + slot;
+
+            if (result > 0) {
+                read->done += result;
+            }
+
+            // larger documents take several reads
+            if (result > 0 && read->done < read->size && failed == 0 &&
+                queue_read(ring, reads, slot) == 0) {
+                continue;
+            }
+
+            // the search process exits without flushing its standard output
+            if (result < 0) {
+                fprintf(stderr, "read(): document %d: %s\n", read->identifier,
+                        strerror(-result));
+            }
+
+            if (result < 0 || (result > 0 && read->done < read->size)) {
+                // the rest of the document can't be read through the ring
+                grep_document(server, keyword, read->identifier, output);
+            } else {
+                read->buffer[read->done] = '\0';
+                if (regexec(&regex, read->buffer, 0, NULL, 0) == 0 &&
+                    write(output, &read->identifier, sizeof(int)) == -1) {
+                    perror("write()");
+                }
+            }
+
+            close(read->fd);
+            read->fd = -1;
+            pending--;
         }
+    }
 
-        return clone_document(&doc);
+    // taken from the range but never read
+    if (failed && next != -1) {
+        grep_document(server, keyword, next, output);
     }
 
-    // get document from cache
-    return cache_get_document(server->cache, identifier);
-}
+    for (unsigned i = 0; i < URING_DEPTH; i++) {
+        if (reads[i].fd == -1) {
+            free(reads[i].buffer);
+            continue;
+        }
 
-static char *list_documents(Server *server, const char *keyword, int n_procs) {
+        // the kernel may still write the buffer, it is left to the exit of
+        // the search process
+        close(reads[i].fd);
+        grep_document(server, keyword, reads[i].identifier, output);
+    }
 
-    // close the metadata file, so that processes don't share the offset
-    close(server->metadata_file);
+    uring_destroy(ring);
+    regfree(&regex);
 
-    // get the number of documents indexed
-    int identifier = 0;
-    ssize_t out = 0;
-    Document *doc = NULL;
+    return failed ? 1 : 0;
+}
+
+static int start_search(Server *server, const char *keyword, int n_procs,
+                        int *workers) {
     // open the comunication channels
     int fildes[2];
     if (pipe(fildes) == -1) {
         perror("pipe()");
-        return NULL;
+        return -1;
     }
 
-    // get the valid ids
-    int *valid_ids = it_get_valid_ids(server->index_table);
+    // no change may be half done in the copy of the table of a process
+    pthread_rwlock_rdlock(&server->table_lock);
     unsigned count = it_size(server->index_table);
-    unsigned chunk = count / n_procs;
-    char *path;
+
+    if (n_procs < 1) {
+        n_procs = 1;
+    }
 
     if (n_procs > count) {
         n_procs = count;
     }
 
+    if (n_procs > MAX_SEARCH_PROCS) {
+        n_procs = MAX_SEARCH_PROCS;
+    }
+
+    // every process walks a range with the same number of valid documents
+    int bounds[MAX_SEARCH_PROCS + 1];
+    if (n_procs > 0) {
+        it_partition(server->index_table, n_procs, bounds);
+    }
+    *workers = 0;
+
     for (int i = 0; i < n_procs; i++) {
         switch (fork()) {
             case -1:
                 /* error code */
                 perror("fork()");
-                return NULL;
+                pthread_rwlock_unlock(&server->table_lock);
+                close(fildes[1]);
+                return fildes[0];
             case 0:
                 /* child code */
 
                 // close readind side of the pipe
                 close(fildes[0]);
 
-                identifier = i * chunk;
+                It_Iter range;
+                it_iter_begin(server->index_table, bounds[i], bounds[i + 1],
+                              &range);
 
-                // last process does the remaining ids
-                if (i == n_procs - 1) {
-                    chunk += count % n_procs;
-                }
+                // other threads of the server may hold the cache lock, so
+                // read the metadata straight from the storage, which has
+                // no offset to share with the parent
+                server->cache = NULL;
 
-                // open the metadata.bin file
-                server->metadata_file = open(STORAGE_FILE, O_RDONLY);
-                if (server->metadata_file == -1) {
-                    perror("open()");
-                    _exit(1);
+                // many documents in flight, or one grep at a time, for the
+                // documents the ring didn't get to
+                if (server->uring == 0 ||
+                    search_uring(server, keyword, &range, fildes[1]) != 0) {
+                    search_grep(server, keyword, range, fildes[1]);
                 }
 
-                count = 0;
-                while (count < chunk) {
+                _exit(0);
+            default:
+                /* parent code */
+                (*workers)++;
+                break;
+        }
+    }
 
-                    // get document from cache or disk
-                    doc = get_document(server, valid_ids[identifier]);
+    pthread_rwlock_unlock(&server->table_lock);
+    close(fildes[1]);
 
-                    path = join_paths(server->document_folder, doc->path);
+    return fildes[0];
+}
 
-                    // check if the keyword exists in the file
-                    out = keyword_exists(path, keyword);
+static void stream_documents(Server *server, const Request *request,
+                             int blocking) {
+    int workers = 0;
+    int input = start_search(server, request->keyword, request->n_procs,
+                             &workers);
 
-                    if (path != NULL) {
-                        free(path);
-                    }
+    // replies of the stream go through the same descriptor
+    Request stream = *request;
+    int owned = 0;
 
-                    if (out == 0) {
-                        // send the id to the parent process
-                        out = write(fildes[1], &(valid_ids[identifier]),
-                                    sizeof(valid_ids[identifier]));
-                    }
+    // threads of the pool don't look at the sessions, the channel was
+    // chosen when the request was queued
+    if (stream.ring == NULL && blocking == 0) {
+        stream.channel = reply_channel(server, request);
+    }
 
-                    identifier++;
-                    count++;
-                }
+    if (stream.ring == NULL && stream.channel == -1) {
+        char client_fifo[50];
+        sprintf(client_fifo, "%s_%d", CLIENT_FIFO, request->client);
 
-                _exit(0);
-            default:
-                /* parent code */
-                break;
+        stream.channel = open(client_fifo, O_WRONLY);
+        if (stream.channel == -1) {
+            perror("open()");
         }
+        owned = 1;
     }
 
-    close(fildes[1]);
+    int reachable = stream.ring != NULL || stream.channel != -1;
 
-    char buffer[BUFSIZ];
-    char temp[12];
+    int batch[MAX_LIST_BATCH];
+    int *all = NULL;
+    unsigned found = 0;
+    ssize_t out = 0;
+    char *reply = NULL;
+    size_t size = 0;
+
+    // forward the ids as soon as the workers find them, each read gets
+    // whatever is in the pipe (up to one frame)
+    while (input != -1 && (out = read(input, batch, sizeof(batch))) > 0) {
+        unsigned count = out / sizeof(int);
+
+        if (request->legacy) {
+            // old clients get everything at once
+            int *other = (int *)realloc(all, (found + count) * sizeof(int));
+            if (other != NULL) {
+                all = other;
+                memcpy(all + found, batch, count * sizeof(int));
+                found += count;
+            }
+            continue;
+        }
 
-    strcat(buffer, "[");
+        reply = encode_list_batch(request, batch, count, 1, &size);
+        if (reply != NULL && reachable &&
+            write_reply(&stream, stream.channel, reply, size) != 0) {
+            // the client is gone, stop the workers
+            free(reply);
+            break;
+        }
+        free(reply);
+    }
 
-    // receive the ids with the keyword
-    while ((out = read(fildes[0], &identifier, sizeof(identifier))) > 0) {
-        sprintf(temp, "%d, ", identifier);
-        strcat(buffer, temp);
+    if (input != -1) {
+        close(input);
     }
 
-    // terminate the string
-    if (strlen(buffer) > 1) {
-        buffer[strlen(buffer) - 2] = ']';
-        buffer[strlen(buffer) - 1] = '\0';
-    } else {
-        strcat(buffer, "]");
+    // wait for the workers, not for the children of other threads
+    for (int i = 0; i < workers; i++) {
+        waitpid(-1, NULL, __WNOTHREAD);
     }
 
-    // wait for the child processes
-    for (int i = 0; i < n_procs; i++) {
-        wait(NULL);
+    // the last frame ends the stream
+    reply = request->legacy ? encode_list_reply(request, all, found, &size)
+                            : encode_list_batch(request, NULL, 0, 0, &size);
+    if (reply != NULL && reachable) {
+        write_reply(&stream, stream.channel, reply, size);
     }
 
-    return strdup(buffer);
+    free(reply);
+    free(all);
+
+    if (owned && stream.channel != -1) {
+        close(stream.channel);
+    }
 }
 
-int process_request(Server *server, const Request *request) {
+static int serve_request(Server *server, const Request *request,
+                         int blocking) {
     int identifier = 0;
-    off_t position = 0;
     Document *doc = NULL;
+    Document buffer;
+    const Document *found = NULL;
+    char *path = NULL;
     int temp = 0;
-    char result[BUFSIZ];
+    char *reply = NULL;
+    size_t size = 0;
+    int *ids = NULL;
+    unsigned n_ids = 0;
     ssize_t out;
 
     // record the request in the log file
@@ -412,17 +1491,6 @@ int process_request(Server *server, const Request *request) {
         case INDEX:
             /* index document */
 
-            if (fl_is_empty(server->free_list) != 0) {
-                // empty list, append to the file
-                position = lseek(server->metadata_file, 0, SEEK_END);
-                identifier = position / sizeof(Document);
-            } else {
-                identifier = fl_pop(server->free_list);
-                // go to the empty spot
-                lseek(server->metadata_file, identifier * sizeof(Document),
-                      SEEK_SET);
-            }
-
             // create document
             doc = create_document(request->title, request->authors,
                                   request->year, request->path);
@@ -430,107 +1498,145 @@ int process_request(Server *server, const Request *request) {
                 return -1;
             }
 
+            pthread_rwlock_wrlock(&server->table_lock);
+
+            // a path already indexed keeps its identifier
+            identifier = mi_find_path(server->meta_index, doc->path);
+            if (identifier != -1 && same_document(server, identifier, doc)) {
+                // nothing changed, nothing to write or log
+                pthread_rwlock_unlock(&server->table_lock);
+                destroy_document(doc);
+
+                reply = encode_int_reply(request, identifier, &size);
+                break;
+            }
+
+            if (identifier != -1) {
+                // new metadata for the same file, rewritten in place
+                cache_remove_document(server->cache, identifier);
+            } else if (fl_is_empty(server->free_list) != 0) {
+                // empty list, append to the file
+                identifier = storage_count(server->storage);
+            } else {
+                // reuse the empty spot
+                identifier = fl_pop(server->free_list);
+            }
+
             // write the document in the metadata file
-            out = write(server->metadata_file, doc, sizeof(Document));
-            if (out == -1) {
-                perror("write()");
+            if (storage_write(server->storage, identifier, doc, 1) != 0) {
+                pthread_rwlock_unlock(&server->table_lock);
+                destroy_document(doc);
                 return -1;
             }
             
-            // add entry to the index table
-            if (it_add_entry(server->index_table, identifier) != 0) {
+            // add entry to the index table and the secondary indexes
+            if (it_add_entry(server->index_table, identifier) != 0 ||
+                mi_add(server->meta_index, identifier, doc->authors,
+                       doc->year, doc->path) != 0) {
+                pthread_rwlock_unlock(&server->table_lock);
+                destroy_document(doc);
                 return -1;
             }
 
             // add the document to the cache
             cache_add_document(server->cache, identifier, doc);
+
+            pthread_rwlock_unlock(&server->table_lock);
             
             destroy_document(doc);
 
-            switch (fork()) {
-                case -1:
-                    perror("fork()");
-                    return 1;
-                case 0:
-                    send_response(request->client, &identifier,
-                                  sizeof(identifier));
-                    _exit(0);
-                default:
-                    break;
+            // the change reaches the log before the reply
+            if (log_change(server, WAL_INDEX, identifier) != 0 ||
+                commit_changes(server) != 0) {
+                return -1;
             }
 
+            reply = encode_int_reply(request, identifier, &size);
             break;
 
         case REMOVE:
             /* remove index */
 
-            identifier = atoi(request->title);
+            identifier = request->key;
+
+            pthread_rwlock_wrlock(&server->table_lock);
 
             // remove entry from table
             temp = it_remove_entry(server->index_table, identifier);
 
             if (temp != -1) {
+                // leave a tombstone, so the table can be rebuilt from the
+                // metadata file
+                storage_remove(server->storage, identifier);
+
                 // add free id to free list
                 fl_push(server->free_list, identifier);
+                mi_remove(server->meta_index, identifier);
 
                 // remove document from cache
                 cache_remove_document(server->cache, identifier);
+
+                temp = log_change(server, WAL_REMOVE, identifier);
             } else {
                 // document not found
                 identifier = -1;
+                temp = 0;
             }
 
-            switch (fork()) {
-                case -1:
-                    perror("fork()");
-                    return 1;
-                case 0:
-                    send_response(request->client, &identifier,
-                                  sizeof(identifier));
-                    _exit(0);
-                default:
-                    break;
+            pthread_rwlock_unlock(&server->table_lock);
+
+            if (temp != 0 || commit_changes(server) != 0) {
+                return -1;
             }
 
+            reply = encode_int_reply(request, identifier, &size);
             break;
 
         case CONSULT:
             /* consult a document */
 
-            identifier = atoi(request->title);
-
-            // get the document (from cache or disk)
-            doc = get_document(server, identifier);
-
-            switch (fork()) {
-                case -1:
-                    perror("fork()");
-                    return 1;
-                case 0:
-
-                    // document was not found
-                    if (doc == NULL) {
-                        doc = malloc(sizeof(Document));
-                        sprintf(doc->title, "Document was not found");
-                    }
-
-                    send_response(request->client, doc, sizeof(Document));
-                    _exit(0);
-                default:
-                    break;
-            }
-
-            destroy_document(doc);
-
+            // get the document (from cache or the mapping), the view is
+            // only valid while the lock is held
+            pthread_rwlock_rdlock(&server->table_lock);
+            found = get_document(server, request->key, &buffer);
+            reply = encode_document_reply(request, found, &size);
+            pthread_rwlock_unlock(&server->table_lock);
             break;
 
         case COUNT_WORD:
             /* count keyword */
 
-            identifier = atoi(request->title);
+            // get the path of the document (from cache or the mapping)
+            pthread_rwlock_rdlock(&server->table_lock);
+            found = get_document(server, request->key, &buffer);
+            path = found == NULL ? NULL
+                                 : join_paths(server->document_folder,
+                                              found->path);
+            pthread_rwlock_unlock(&server->table_lock);
+
+            if (blocking) {
+                // a thread of the pool, the search runs right here
+                reply = encode_int_reply(request,
+                                         path == NULL
+                                             ? -1
+                                             : count_keyword(path,
+                                                             request->keyword),
+                                         &size);
+                free(path);
+                break;
+            }
+
+            if (server->pool != NULL) {
+                // the worker searches the document and replies
+                temp = submit_job(server, JOB_COUNT, request,
+                                  path == NULL ? "" : path,
+                                  path == NULL ? 1 : strlen(path) + 1);
 
-            // get the document (from cache or file)
-            doc = get_document(server, identifier);
+                if (temp == 0) {
+                    free(path);
+                    break;
+                }
+            }
 
             switch (fork()) {
                 case -1:
@@ -539,28 +1645,32 @@ int process_request(Server *server, const Request *request) {
                 case 0:
 
                     int count = -1;
-                    if (doc != NULL) {
-                        char *path =
-                            join_paths(server->document_folder, doc->path);
+                    if (path != NULL) {
                         // count the number of lines
-                        count = count_keyword(path, request->authors);
-
-                        if (path != NULL) {
-                            free(path);
-                        }
+                        count = count_keyword(path, request->keyword);
                     }
 
-                    send_response(request->client, &count, sizeof(count));
+                    reply = encode_int_reply(request, count, &size);
+                    if (reply != NULL) {
+                        write_response(server, request, reply, size);
+                    }
                     _exit(0);
                 default:
                     break;
             }
 
+            free(path);
             break;
 
         case LIST_WORD:
             /* identify the documents that contain the keyword */
 
+            if (blocking) {
+                // a thread of the pool, the ids are sent from here
+                stream_documents(server, request, 1);
+                break;
+            }
+
             switch (fork()) {
                 case -1:
                     /* error code */
@@ -568,20 +1678,8 @@ int process_request(Server *server, const Request *request) {
                     return -1;
                 case 0:
 
-                    // get the number of processes
-                    int n_procs = atoi(request->authors);
-
-                    // get the list of ids
-                    char *other =
-                        list_documents(server, request->title, n_procs);
-                    if (other != NULL) {
-                        strcpy(result, other);
-                        free(other);
-                    } else {
-                        sprintf(result, "Error searching the documents!!");
-                    }
-
-                    send_response(request->client, result, strlen(result) + 1);
+                    // send the ids while they are found
+                    stream_documents(server, request, 0);
                     _exit(0);
                 default:
                     break;
@@ -589,18 +1687,116 @@ int process_request(Server *server, const Request *request) {
 
             break;
 
-        case KILL:
-            /* wait for child process */
+        case INDEX_BULK:
+            /* index a batch of documents */
+
+            ids = (int *)calloc(request->n_records + 1, sizeof(int));
+            if (ids == NULL) {
+                return -1;
+            }
+
+            pthread_rwlock_wrlock(&server->table_lock);
+            temp = index_batch(server, (const Document *)request->records,
+                               request->n_records, ids);
+            pthread_rwlock_unlock(&server->table_lock);
+
+            if (temp != 0) {
+                free(ids);
+                return -1;
+            }
+
+            temp = find_session(server, request->client);
+            if (temp == -1) {
+                // without a session every frame is answered on its own
+                if (commit_changes(server) != 0) {
+                    free(ids);
+                    return -1;
+                }
+
+                reply = encode_list_reply(request, ids, request->n_records,
+                                          &size);
+                free(ids);
+                break;
+            }
+
+            Session *session = server->sessions + temp;
+            if (bulk_append(session, ids, request->n_records) != 0) {
+                free(ids);
+                return -1;
+            }
+            free(ids);
+
+            // answer once, after the last frame of the batch, whose changes
+            // reach the log together
+            if ((request->flags & FRAME_MORE) == 0) {
+                if (commit_changes(server) != 0) {
+                    return -1;
+                }
+
+                reply = encode_list_reply(request, session->bulk_ids,
+                                          session->bulk_count, &size);
+                session->bulk_count = 0;
+            }
+
+            break;
+
+        case QUERY_AUTHOR:
+        case QUERY_YEAR:
+            /* documents of an author or a range of years */
+
+            // answered from memory, the metadata file is not read
+            pthread_rwlock_rdlock(&server->table_lock);
+            ids = request->operation == QUERY_AUTHOR
+                      ? mi_by_author(server->meta_index, request->authors,
+                                     &n_ids)
+                      : mi_by_years(server->meta_index, request->key,
+                                    request->key_last, &n_ids);
+            pthread_rwlock_unlock(&server->table_lock);
+
+            reply = encode_list_reply(request, ids, n_ids, &size);
+            free(ids);
+            break;
+
+        case LOOKUP_PATH:
+            /* document indexed with a path */
+
+            pthread_rwlock_rdlock(&server->table_lock);
+            identifier = mi_find_path(server->meta_index, request->path);
+            pthread_rwlock_unlock(&server->table_lock);
+
+            reply = encode_int_reply(request, identifier, &size);
+            break;
+
+        case COMPACT:
+            /* rewrite metadata.bin with the valid documents only */
+
+            if (start_compaction(server) == 0) {
+                // answered once the copy ends, see reap_worker()
+                server->compact_request = *request;
+                server->compact_request.records = NULL;
+                server->compact_reachable = 1;
+                break;
+            }
+
+            long long failed = -1;
+            reply = encode_reply(request, &failed, sizeof(failed), &size);
+            break;
+
+        case SESSION_OPEN:
+            /* keep a channel open to the client */
+
+            open_session(server, request);
 
-            // NEEDS IMPROVEMENTS, TEMPORARY
-            waitpid(request->client, NULL, 0);
+            break;
+        case SESSION_CLOSE:
+            /* release the client channel */
+
+            close_session(server, request->client);
 
             break;
         case SHUTDOWN:
             /* shutdown the server */
 
-            identifier = atoi(request->title);
-
             return 1;
 
             break;
@@ -609,12 +1805,77 @@ int process_request(Server *server, const Request *request) {
             break;
     }
 
+    // light replies are delivered right away
+    if (reply != NULL) {
+        temp = deliver_response(server, request, reply, size, blocking);
+        free(reply);
+        return temp;
+    }
+
     return 0;
 }
 
+static void run_task(void *context, void *task) {
+    Request *request = (Request *)task;
+
+    serve_request((Server *)context, request, 1);
+
+    if (request->channel != -1) {
+        close(request->channel);
+    }
+    free(request);
+}
+
+int process_request(Server *server, const Request *request) {
+    switch (request->operation) {
+        case CONSULT:
+        case COUNT_WORD:
+        case LIST_WORD:
+        case QUERY_AUTHOR:
+        case QUERY_YEAR:
+        case LOOKUP_PATH:
+            if (server->threads == NULL) {
+                break;
+            }
+
+            Request *task = (Request *)malloc(sizeof(Request));
+            if (task == NULL) {
+                break;
+            }
+
+            // the thread gets its own channel, the session or the
+            // connection may be closed before the reply is written
+            *task = *request;
+            task->records = NULL;
+            task->channel = -1;
+            if (request->ring == NULL && reply_channel(server, request) != -1) {
+                task->channel = dup(reply_channel(server, request));
+            }
+
+            if (tpool_submit(server->threads, task) == 0) {
+                return 0;
+            }
+
+            if (task->channel != -1) {
+                close(task->channel);
+            }
+            free(task);
+            break;
+        default:
+            break;
+    }
+
+    // requests that change the server are served in order, by the loop
+    return serve_request(server, request, 0);
+}
+
 void shutdown_server(Server *server) {
     printf("\n[SERVER IS SHUTTING DOWN]\n");
 
+    // let the threads and the workers deliver the replies still queued
+    tpool_destroy(server->threads);
+    pool_destroy(server->pool);
+
     if (server->document_folder != NULL) {
         free(server->document_folder);
     }
@@ -624,30 +1885,38 @@ void shutdown_server(Server *server) {
     fl_show(server->free_list);
     show_cache(server->cache);
 
-    // close the metadata file
-    close(server->metadata_file);
-
-    // open the control file to record auxiliar data structures
-    int control_file = open(CONTROL_FILE, O_CREAT | O_TRUNC | O_WRONLY, 0666);
-    if (control_file == -1) {
-        perror("open()");
-        return;
+    // close the remaining client sessions
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (server->sessions[i].client != 0) {
+            release_session(server, i);
+        }
     }
 
-    // record the auxiliar dada structures
-    fl_record(server->free_list, control_file);
-    it_record(server->index_table, control_file);
+    // record the auxiliar data structures, the logs are no longer needed
+    if (server->checkpointer != 0) {
+        waitpid(server->checkpointer, NULL, 0);
+    }
+    if (server->compactor != 0) {
+        int status = 0;
+        waitpid(server->compactor, &status, 0);
+        finish_compaction(server, status);
+    }
+    wal_commit(server->wal);
+    write_checkpoint(server);
+    wal_close(server->wal);
 
-    close(control_file);
+    // unmap and close the metadata file
+    storage_close(server->storage);
 
     // free the data structures
     fl_destroy(server->free_list);
     it_destroy(server->index_table);
+    mi_destroy(server->meta_index);
     cache_destroy(server->cache);
 
     close(server->requests_log_pipe);
-    close(server->metadata_file);
 
+    pthread_rwlock_destroy(&server->table_lock);
     free(server);
 
     unlink(SERVER_FIFO);
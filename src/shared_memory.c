@@ -0,0 +1,483 @@
+#include "shared_memory.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHM_MAGIC 0x44534D52u   /**< Set once the region is ready ("DSMR") */
+#define SHM_SPIN 2000           /**< Checks before sleeping, on multi-core hosts */
+#define SHM_YIELDS 4            /**< Yields before sleeping, on single core hosts */
+#define SHM_POLL_MS 100         /**< Sleep between checks that the peer is alive */
+
+#define CACHE_LINE 64
+
+/**
+ * @brief Ring buffer of bytes
+ *
+ * head and tail count every byte written and read so far, and wrap around
+ * naturally. They live in different cache lines, so the producer and the
+ * consumer don't keep stealing each other's line.
+ */
+struct shm_ring {
+    _Alignas(CACHE_LINE) _Atomic uint32_t head; /**< Bytes written so far */
+    _Atomic uint32_t readers;                   /**< Readers sleeping on head */
+    _Atomic uint32_t lock;                      /**< Serializes the producers */
+    _Alignas(CACHE_LINE) _Atomic uint32_t tail; /**< Bytes read so far */
+    _Atomic uint32_t writers;                   /**< Writers sleeping on tail */
+    _Alignas(CACHE_LINE) char data[SHM_RING_SIZE]; /**< Ring contents */
+};
+
+/**
+ * @brief Channel of one client
+ */
+typedef struct {
+    _Atomic pid_t owner;        /**< Client holding the slot, 0 if free */
+    _Atomic uint32_t ready;     /**< Rings were reset by the owner */
+    Shm_Ring request;           /**< Client to server */
+    Shm_Ring reply;             /**< Server to client */
+} Slot;
+
+struct shm_region {
+    _Atomic uint32_t magic;     /**< SHM_MAGIC once the server is ready */
+    pid_t server;               /**< Process ID of the server */
+    _Atomic uint32_t doorbell;  /**< Number of requests announced */
+    _Atomic uint32_t sleeping;  /**< The server sleeps on the doorbell */
+    Slot slots[SHM_SLOTS];      /**< Client channels */
+};
+
+
+static long futex(_Atomic uint32_t *word, int op, uint32_t value,
+                  const struct timespec *timeout) {
+    return syscall(SYS_futex, (uint32_t *)word, op, value, timeout, NULL, 0);
+}
+
+static void wake_all(_Atomic uint32_t *word) {
+    futex(word, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+static int is_alive(pid_t process) {
+    return process <= 0 || kill(process, 0) == 0 || errno != ESRCH;
+}
+
+static int spin_limit(void) {
+    static int limit = -1;
+
+    // spinning only pays off when the other side runs on another core
+    if (limit == -1) {
+        limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN : 0;
+    }
+
+    return limit;
+}
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * @brief Waits until a word no longer holds the value seen
+ *
+ * @param word Word to watch
+ * @param seen Value seen by the caller
+ * @param sleepers Counter of processes sleeping on the word
+ * @param peer Process that changes the word (0 to wait for timeout_ms only)
+ * @param timeout_ms Maximum wait when there is no peer
+ * @retval 0 The word changed
+ * @retval 1 Timed out
+ * @retval -1 The peer is gone
+ */
+static int wait_change(_Atomic uint32_t *word, uint32_t seen,
+                       _Atomic uint32_t *sleepers, pid_t peer,
+                       int timeout_ms) {
+    int limit = spin_limit();
+    for (int i = 0; i < limit; i++) {
+        if (atomic_load_explicit(word, memory_order_acquire) != seen) {
+            return 0;
+        }
+        cpu_relax();
+    }
+
+    // on a single core, hand the processor to the other side instead
+    for (int i = 0; limit == 0 && i < SHM_YIELDS; i++) {
+        sched_yield();
+        if (atomic_load_explicit(word, memory_order_acquire) != seen) {
+            return 0;
+        }
+    }
+
+    int wait_ms = peer > 0 ? SHM_POLL_MS : timeout_ms;
+    struct timespec step = {wait_ms / 1000, (wait_ms % 1000) * 1000000L};
+    int result = 0;
+
+    // announce the sleeper before the last check, the producer checks after
+    atomic_fetch_add(sleepers, 1);
+
+    while (result == 0 && atomic_load(word) == seen) {
+        futex(word, FUTEX_WAIT, seen, &step);
+
+        if (atomic_load(word) != seen) {
+            break;
+        }
+
+        if (peer <= 0) {
+            result = 1;
+        } else if (is_alive(peer) == 0) {
+            result = -1;
+        }
+    }
+
+    atomic_fetch_sub(sleepers, 1);
+
+    return result;
+}
+
+static void lock_ring(Shm_Ring *ring) {
+    // 0 free, 1 taken, 2 taken with waiters
+    uint32_t state = 0;
+    if (atomic_compare_exchange_strong(&ring->lock, &state, 1)) {
+        return;
+    }
+
+    if (state != 2) {
+        state = atomic_exchange(&ring->lock, 2);
+    }
+
+    while (state != 0) {
+        futex(&ring->lock, FUTEX_WAIT, 2, NULL);
+        state = atomic_exchange(&ring->lock, 2);
+    }
+}
+
+static void unlock_ring(Shm_Ring *ring) {
+    if (atomic_fetch_sub(&ring->lock, 1) != 1) {
+        atomic_store(&ring->lock, 0);
+        futex(&ring->lock, FUTEX_WAKE, 1, NULL);
+    }
+}
+
+static void reset_ring(Shm_Ring *ring) {
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    atomic_store(&ring->lock, 0);
+}
+
+static void copy_in(Shm_Ring *ring, uint32_t position, const char *bytes,
+                    size_t size) {
+    size_t start = position & (SHM_RING_SIZE - 1);
+    size_t first = SHM_RING_SIZE - start < size ? SHM_RING_SIZE - start : size;
+
+    memcpy(ring->data + start, bytes, first);
+    memcpy(ring->data, bytes + first, size - first);
+}
+
+static void copy_out(const Shm_Ring *ring, uint32_t position, char *bytes,
+                     size_t size) {
+    size_t start = position & (SHM_RING_SIZE - 1);
+    size_t first = SHM_RING_SIZE - start < size ? SHM_RING_SIZE - start : size;
+
+    memcpy(bytes, ring->data + start, first);
+    memcpy(bytes + first, ring->data, size - first);
+}
+
+static void consume(Shm_Ring *ring, uint32_t tail) {
+    atomic_store(&ring->tail, tail);
+
+    // a writer may be waiting for room
+    if (atomic_load(&ring->writers) != 0) {
+        wake_all(&ring->tail);
+    }
+}
+
+static int read_ring(Shm_Ring *ring, void *data, size_t size, pid_t peer) {
+    char *bytes = (char *)data;
+
+    while (size > 0) {
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        if (head == tail) {
+            if (wait_change(&ring->head, head, &ring->readers, peer, 0) != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        size_t length = head - tail < size ? head - tail : size;
+        copy_out(ring, tail, bytes, length);
+        consume(ring, tail + length);
+
+        bytes += length;
+        size -= length;
+    }
+
+    return 0;
+}
+
+int shm_write(Shm_Ring *ring, const void *data, size_t size, pid_t peer) {
+    const char *bytes = (const char *)data;
+    int status = 0;
+
+    lock_ring(ring);
+
+    while (status == 0 && size > 0) {
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        uint32_t room = SHM_RING_SIZE - (head - tail);
+
+        if (room == 0) {
+            // ring is full, wait for the reader
+            if (wait_change(&ring->tail, tail, &ring->writers, peer, 0) != 0) {
+                status = -1;
+            }
+            continue;
+        }
+
+        size_t length = room < size ? room : size;
+        copy_in(ring, head, bytes, length);
+        atomic_store(&ring->head, head + length);
+
+        // only pay for the system call when the reader sleeps
+        if (atomic_load(&ring->readers) != 0) {
+            wake_all(&ring->head);
+        }
+
+        bytes += length;
+        size -= length;
+    }
+
+    unlock_ring(ring);
+
+    return status;
+}
+
+ssize_t shm_take_frame(Shm_Ring *ring, char *frame, size_t size) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t available = head - tail;
+
+    if (available < sizeof(Header)) {
+        return 0;
+    }
+
+    Header header;
+    copy_out(ring, tail, (char *)&header, sizeof(Header));
+
+    if (header.magic != PROTOCOL_MAGIC ||
+        header.length > size - sizeof(Header)) {
+        // the stream can't be trusted anymore, drop it
+        consume(ring, head);
+        return -1;
+    }
+
+    size_t length = sizeof(Header) + header.length;
+    if (available < length) {
+        return 0;
+    }
+
+    copy_out(ring, tail, frame, length);
+    consume(ring, tail + length);
+
+    return length;
+}
+
+Shm_Region *shm_create(void) {
+    // remove a region left behind by a previous run
+    shm_unlink(SERVER_SHM);
+
+    int fd = shm_open(SERVER_SHM, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd == -1) {
+        perror("shm_open()");
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(Shm_Region)) == -1) {
+        perror("ftruncate()");
+        close(fd);
+        shm_unlink(SERVER_SHM);
+        return NULL;
+    }
+
+    Shm_Region *region = (Shm_Region *)mmap(NULL, sizeof(Shm_Region),
+                                            PROT_READ | PROT_WRITE, MAP_SHARED,
+                                            fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        perror("mmap()");
+        shm_unlink(SERVER_SHM);
+        return NULL;
+    }
+
+    // the object starts zeroed, so every slot is already free
+    region->server = getpid();
+    atomic_store(&region->magic, SHM_MAGIC);
+
+    return region;
+}
+
+void shm_destroy(Shm_Region *region) {
+    if (region == NULL) {
+        return;
+    }
+
+    atomic_store(&region->magic, 0);
+    munmap(region, sizeof(Shm_Region));
+    shm_unlink(SERVER_SHM);
+}
+
+Shm_Region *shm_attach(void) {
+    int fd = shm_open(SERVER_SHM, O_RDWR, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == -1 || info.st_size != sizeof(Shm_Region)) {
+        close(fd);
+        return NULL;
+    }
+
+    Shm_Region *region = (Shm_Region *)mmap(NULL, sizeof(Shm_Region),
+                                            PROT_READ | PROT_WRITE, MAP_SHARED,
+                                            fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        return NULL;
+    }
+
+    // a region without a live server is a leftover of a crash
+    if (atomic_load(&region->magic) != SHM_MAGIC ||
+        is_alive(region->server) == 0) {
+        munmap(region, sizeof(Shm_Region));
+        return NULL;
+    }
+
+    return region;
+}
+
+void shm_detach(Shm_Region *region) {
+    if (region != NULL) {
+        munmap(region, sizeof(Shm_Region));
+    }
+}
+
+int shm_claim_slot(Shm_Region *region) {
+    pid_t self = getpid();
+
+    for (int i = 0; i < SHM_SLOTS; i++) {
+        Slot *slot = region->slots + i;
+        pid_t free_slot = 0;
+
+        if (atomic_compare_exchange_strong(&slot->owner, &free_slot, self)) {
+            reset_ring(&slot->request);
+            reset_ring(&slot->reply);
+            atomic_store(&slot->ready, 1);
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void shm_release_slot(Shm_Region *region, int slot) {
+    Shm_Ring *ring = &region->slots[slot].request;
+    uint32_t tail = 0;
+
+    // a client waits for the server to take its last requests, replies
+    // are not expected for all of them (SHUTDOWN, SESSION_CLOSE)
+    while (getpid() != region->server &&
+           (tail = atomic_load(&ring->tail)) != atomic_load(&ring->head)) {
+        if (wait_change(&ring->tail, tail, &ring->writers, region->server,
+                        0) != 0) {
+            break;
+        }
+    }
+
+    atomic_store(&region->slots[slot].ready, 0);
+    atomic_store(&region->slots[slot].owner, 0);
+}
+
+pid_t shm_slot_owner(const Shm_Region *region, int slot) {
+    if (atomic_load(&region->slots[slot].ready) == 0) {
+        return 0;
+    }
+
+    return atomic_load(&region->slots[slot].owner);
+}
+
+Shm_Ring *shm_request_ring(Shm_Region *region, int slot) {
+    return &region->slots[slot].request;
+}
+
+Shm_Ring *shm_reply_ring(Shm_Region *region, int slot) {
+    return &region->slots[slot].reply;
+}
+
+unsigned shm_doorbell(const Shm_Region *region) {
+    return atomic_load(&region->doorbell);
+}
+
+int shm_wait_requests(Shm_Region *region, unsigned seen, int timeout_ms) {
+    return wait_change(&region->doorbell, seen, &region->sleeping, 0,
+                       timeout_ms);
+}
+
+int shm_send(Shm_Region *region, int slot, const void *frame, size_t size) {
+    if (shm_write(&region->slots[slot].request, frame, size,
+                  region->server) != 0) {
+        return -1;
+    }
+
+    atomic_fetch_add(&region->doorbell, 1);
+
+    // wake the server, when it is sleeping
+    if (atomic_load(&region->sleeping) != 0) {
+        wake_all(&region->doorbell);
+    }
+
+    return 0;
+}
+
+int shm_receive(Shm_Region *region, int slot, Header *header, char **payload) {
+    Shm_Ring *ring = &region->slots[slot].reply;
+    *payload = NULL;
+
+    if (read_ring(ring, header, sizeof(Header), region->server) != 0) {
+        return 1;
+    }
+
+    if (header->magic != PROTOCOL_MAGIC) {
+        printf("[PROTOCOL] invalid frame\n");
+        return -1;
+    }
+
+    if (header->length == 0) {
+        return 0;
+    }
+
+    *payload = (char *)malloc(header->length);
+    if (*payload == NULL) {
+        return -1;
+    }
+
+    if (read_ring(ring, *payload, header->length, region->server) != 0) {
+        free(*payload);
+        *payload = NULL;
+        return 1;
+    }
+
+    return 0;
+}
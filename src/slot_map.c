@@ -0,0 +1,157 @@
+
+#include "slot_map.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/**
+ * @brief Bucket of the hash table
+ */
+typedef struct bucket {
+    int identifier; /**< Document identifier, -1 if the bucket is empty */
+    int slot;       /**< Cache slot holding the document */
+} Bucket;
+
+/**
+ * @brief Hash table from identifiers to slots, with linear probing
+ *
+ * There are at least twice as many buckets as slots, so probes stay short
+ * even with every slot in use.
+ */
+struct slot_map {
+    Bucket *buckets;  /**< Buckets, a power of two of them */
+    unsigned mask;    /**< Number of buckets minus one */
+    unsigned shift;   /**< 32 minus the bits of the bucket index */
+    int count;        /**< Number of identifiers in the map */
+};
+
+
+/**
+ * @brief Home bucket of an identifier
+ *
+ * Fibonacci hashing, the multiplication spreads the consecutive identifiers
+ * of a block over the whole table.
+ */
+static unsigned home_bucket(const Slot_Map *map, int identifier) {
+    return ((uint32_t)identifier * 2654435769u) >> map->shift;
+}
+
+Slot_Map *sm_create(int slots) {
+    if (slots < 0) {
+        return NULL;
+    }
+
+    Slot_Map *map = (Slot_Map *)calloc(1, sizeof(Slot_Map));
+    if (map == NULL) {
+        return NULL;
+    }
+
+    unsigned bits = 3;
+    while ((1u << bits) < 2 * (unsigned)slots) {
+        bits++;
+    }
+
+    map->buckets = (Bucket *)malloc(sizeof(Bucket) << bits);
+    if (map->buckets == NULL) {
+        free(map);
+        return NULL;
+    }
+
+    map->mask = (1u << bits) - 1;
+    map->shift = 32 - bits;
+
+    for (unsigned i = 0; i <= map->mask; i++) {
+        map->buckets[i].identifier = -1;
+    }
+
+    return map;
+}
+
+void sm_destroy(Slot_Map *map) {
+    if (map != NULL) {
+        free(map->buckets);
+        free(map);
+    }
+}
+
+/**
+ * @brief Bucket of an identifier, or the empty bucket that ends its probe
+ */
+static unsigned probe(const Slot_Map *map, int identifier) {
+    unsigned i = home_bucket(map, identifier);
+    while (map->buckets[i].identifier != -1 &&
+           map->buckets[i].identifier != identifier) {
+        i = (i + 1) & map->mask;
+    }
+
+    return i;
+}
+
+int sm_find(const Slot_Map *map, int identifier) {
+    if (map == NULL || identifier < 0) {
+        return -1;
+    }
+
+    const Bucket *bucket = map->buckets + probe(map, identifier);
+
+    return bucket->identifier == identifier ? bucket->slot : -1;
+}
+
+int sm_count(const Slot_Map *map) {
+    return map == NULL ? 0 : map->count;
+}
+
+/**
+ * @brief Empties a bucket
+ */
+static void unlink_bucket(Slot_Map *map, unsigned i) {
+    map->buckets[i].identifier = -1;
+    map->count--;
+
+    // shift back the entries that probed past the freed bucket, so no
+    // probe sequence is cut short
+    for (unsigned j = (i + 1) & map->mask; map->buckets[j].identifier != -1;
+         j = (j + 1) & map->mask) {
+        unsigned home = home_bucket(map, map->buckets[j].identifier);
+        if (((j - home) & map->mask) >= ((j - i) & map->mask)) {
+            map->buckets[i] = map->buckets[j];
+            map->buckets[j].identifier = -1;
+            i = j;
+        }
+    }
+}
+
+void sm_set(Slot_Map *map, int *identifiers, int slot, int identifier) {
+    if (map == NULL || identifiers == NULL || slot < 0) {
+        return;
+    }
+
+    int old = identifiers[slot];
+    if (old == identifier) {
+        return;
+    }
+
+    if (old != -1) {
+        unsigned i = probe(map, old);
+        if (map->buckets[i].identifier == old) {
+            unlink_bucket(map, i);
+        }
+    }
+
+    identifiers[slot] = identifier;
+    if (identifier == -1) {
+        return;
+    }
+
+    unsigned i = probe(map, identifier);
+    if (map->buckets[i].identifier == identifier) {
+        // a single copy of a document, the one just placed is the newest
+        identifiers[map->buckets[i].slot] = -1;
+    } else {
+        map->count++;
+    }
+
+    map->buckets[i].identifier = identifier;
+    map->buckets[i].slot = slot;
+}
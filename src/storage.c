@@ -0,0 +1,1236 @@
+#define _GNU_SOURCE /* mremap() */
+
+#include "storage.h"
+#include "uring.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief First bytes of the heap file
+ */
+typedef struct {
+    uint32_t magic;     /**< Always STORAGE_MAGIC */
+    uint32_t version;   /**< Always STORAGE_VERSION */
+} Heap_Header;
+
+/**
+ * @brief State of a record in the heap
+ */
+typedef enum {
+    RECORD_LIVE = 1,    /**< Record of a valid document */
+    RECORD_REMOVED      /**< Tombstone, the document was removed */
+} Record_State;
+
+/**
+ * @brief Header of every record in the heap
+ *
+ * Followed by the title, the authors, the year and the path, without
+ * terminators.
+ */
+typedef struct {
+    int32_t identifier;     /**< Owner of the record */
+    uint32_t state;         /**< Record_State, rewritten in place on removal */
+    uint16_t lengths[4];    /**< Bytes of each field */
+} Record_Header;
+
+/**
+ * @brief Header of every record in a heap of version 1, without a state
+ */
+typedef struct {
+    int32_t identifier;     /**< Owner of the record */
+    uint16_t lengths[4];    /**< Bytes of each field */
+} Record_Header_V1;
+
+/**
+ * @brief Entry of the offset table, one per identifier
+ */
+typedef struct {
+    uint64_t offset;    /**< Start of the record in the heap, 0 if none */
+    uint32_t length;    /**< Bytes of the record */
+    uint32_t unused;    /**< Keeps the entries 8 byte aligned */
+} Slot;
+
+/**
+ * @brief Record of the fixed size format used before the heap
+ */
+typedef struct {
+    char title[200];
+    char authors[200];
+    char year[4];
+    char path[64];
+} Fixed_Record;
+
+#define RECORD_MAX (sizeof(Record_Header) + sizeof(Document))
+#define SCAN_CHUNK 1048576 /**< Most bytes read at once by storage_scan() */
+
+/**
+ * @brief Metadata files and the mapping of the heap
+ */
+typedef struct storage {
+    int heap;           /**< Descriptor of the heap file */
+    int table;          /**< Descriptor of the offset table file */
+    Slot *slots;        /**< Offset table, kept in memory */
+    unsigned count;     /**< Number of entries of the table */
+    unsigned capacity;  /**< Capacity of slots */
+    char *map;          /**< Start of the mapping of the heap, NULL for positional reads */
+    size_t mapped;      /**< Bytes mapped, may go past the end of the heap */
+    size_t size;        /**< Bytes of the heap */
+    unsigned version;   /**< Format of the heap, older ones are only read to convert them */
+    size_t mark;        /**< End of the heap when a compaction started, 0 if none */
+    int *removed;       /**< Identifiers removed since the compaction started */
+    unsigned n_removed; /**< Number of identifiers in removed */
+    unsigned removed_capacity; /**< Capacity of removed */
+    int uring;          /**< Positional reads of blocks go through io_uring */
+} Storage;
+
+// ring of the calling thread, rings can't be shared by threads nor by the
+// processes forked after they were set up
+static __thread Uring *thread_ring = NULL;
+static __thread pid_t ring_owner = 0;
+
+static size_t map_size(size_t needed, size_t current) {
+    size_t size = current < STORAGE_MIN_MAP ? STORAGE_MIN_MAP : current;
+
+    // double it, so appends remap a logarithmic number of times
+    while (size < needed) {
+        size *= 2;
+    }
+
+    return size;
+}
+
+static size_t encode_record(int identifier, const Document *doc, char *out) {
+    const char *fields[4] = {doc->title, doc->authors, doc->year, doc->path};
+    const size_t sizes[4] = {TITLE_SIZE, AUTHORS_SIZE, YEAR_SIZE, PATH_SIZE};
+    Record_Header header = {.identifier = identifier, .state = RECORD_LIVE};
+    size_t used = sizeof(header);
+
+    for (int i = 0; i < 4; i++) {
+        header.lengths[i] = strnlen(fields[i], sizes[i]);
+        memcpy(out + used, fields[i], header.lengths[i]);
+        used += header.lengths[i];
+    }
+
+    memcpy(out, &header, sizeof(header));
+    return used;
+}
+
+static int decode_header(const char *data, size_t length, unsigned version,
+                         Record_Header *header) {
+    if (version == STORAGE_VERSION) {
+        if (length < sizeof(Record_Header)) {
+            return -1;
+        }
+
+        memcpy(header, data, sizeof(Record_Header));
+        return sizeof(Record_Header);
+    }
+
+    // version 1 records have no state, they were all live
+    Record_Header_V1 old;
+    if (length < sizeof(old)) {
+        return -1;
+    }
+
+    memcpy(&old, data, sizeof(old));
+    header->identifier = old.identifier;
+    header->state = RECORD_LIVE;
+    memcpy(header->lengths, old.lengths, sizeof(old.lengths));
+
+    return sizeof(old);
+}
+
+static int decode_record(const char *data, size_t length, unsigned version,
+                         Document *doc) {
+    char *fields[4] = {doc->title, doc->authors, doc->year, doc->path};
+    const size_t sizes[4] = {TITLE_SIZE, AUTHORS_SIZE, YEAR_SIZE, PATH_SIZE};
+    Record_Header header;
+
+    int start = decode_header(data, length, version, &header);
+    if (start == -1) {
+        return -1;
+    }
+
+    size_t used = start;
+
+    for (int i = 0; i < 4; i++) {
+        if (header.lengths[i] > sizes[i] || used + header.lengths[i] > length) {
+            return -1;
+        }
+
+        // the year may fill its field, the others always end in '\0'
+        memcpy(fields[i], data + used, header.lengths[i]);
+        if (header.lengths[i] < sizes[i]) {
+            fields[i][header.lengths[i]] = '\0';
+        }
+        used += header.lengths[i];
+    }
+
+    return 0;
+}
+
+static int reserve_slots(Storage *storage, unsigned count) {
+    if (count <= storage->capacity) {
+        return 0;
+    }
+
+    unsigned capacity = storage->capacity == 0 ? 1024 : storage->capacity;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+
+    Slot *slots = (Slot *)realloc(storage->slots, capacity * sizeof(Slot));
+    if (slots == NULL) {
+        return -1;
+    }
+
+    memset(slots + storage->capacity, 0,
+           (capacity - storage->capacity) * sizeof(Slot));
+    storage->slots = slots;
+    storage->capacity = capacity;
+
+    return 0;
+}
+
+static int load_table(Storage *storage) {
+    struct stat info;
+    if (fstat(storage->table, &info) == -1) {
+        perror("fstat()");
+        return -1;
+    }
+
+    unsigned count = info.st_size / sizeof(Slot);
+    if (reserve_slots(storage, count) != 0) {
+        return -1;
+    }
+
+    // the whole table in a single read
+    ssize_t length = count * sizeof(Slot);
+    if (length > 0 && pread(storage->table, storage->slots, length, 0) !=
+                          length) {
+        perror("pread()");
+        return -1;
+    }
+
+    storage->count = count;
+    return 0;
+}
+
+static int open_heap(Storage *storage, const char *path) {
+    storage->heap = open(path, O_CREAT | O_RDWR, 0666);
+    if (storage->heap == -1) {
+        perror("open()");
+        return -1;
+    }
+
+    Heap_Header header = {STORAGE_MAGIC, STORAGE_VERSION};
+    struct stat info;
+    if (fstat(storage->heap, &info) == -1) {
+        perror("fstat()");
+        return -1;
+    }
+
+    if (info.st_size == 0) {
+        // new heap
+        if (pwrite(storage->heap, &header, sizeof(header), 0) !=
+            sizeof(header)) {
+            perror("pwrite()");
+            return -1;
+        }
+
+        storage->size = sizeof(header);
+        storage->version = STORAGE_VERSION;
+        return 0;
+    }
+
+    // without the magic it is a file of the fixed size format
+    Heap_Header found;
+    if (pread(storage->heap, &found, sizeof(found), 0) != sizeof(found) ||
+        found.magic != header.magic) {
+        return 1;
+    }
+
+    // a newer or damaged heap is never converted, that would overwrite it
+    if (found.version != header.version && found.version != 1) {
+        printf("[SERVER INFO] %s has an unknown version (%u)\n", path,
+               found.version);
+        return -1;
+    }
+
+    storage->size = info.st_size;
+    storage->version = found.version;
+
+    // records without a state must be converted before they are used
+    return found.version == header.version ? 0 : 2;
+}
+
+static Storage *open_files(const char *heap_path, const char *table_path,
+                           int *status) {
+    Storage *storage = (Storage *)calloc(1, sizeof(Storage));
+    if (storage == NULL) {
+        *status = -1;
+        return NULL;
+    }
+
+    *status = open_heap(storage, heap_path);
+    if (*status == 1 || *status == -1) {
+        if (storage->heap != -1) {
+            close(storage->heap);
+        }
+        free(storage);
+        return NULL;
+    }
+
+    storage->table = open(table_path, O_CREAT | O_RDWR, 0666);
+    if (storage->table == -1) {
+        perror("open()");
+    }
+
+    if (storage->table == -1 || load_table(storage) != 0) {
+        *status = -1;
+        storage_close(storage);
+        return NULL;
+    }
+
+    return storage;
+}
+
+static void swap_paths(const char *heap_path, const char *table_path,
+                       char *heap_temp, char *table_temp, char *marker,
+                       size_t size) {
+    snprintf(heap_temp, size, "%s.new", heap_path);
+    snprintf(table_temp, size, "%s.new", table_path);
+    snprintf(marker, size, "%s.commit", heap_path);
+}
+
+static void temp_paths(const char *heap_path, const char *table_path,
+                       char *heap_temp, char *table_temp, size_t size) {
+    char marker[256];
+    swap_paths(heap_path, table_path, heap_temp, table_temp, marker,
+               sizeof(marker));
+
+    // the copies of a committed swap are the metadata files until renamed
+    if (access(marker, F_OK) == -1) {
+        unlink(heap_temp);
+        unlink(table_temp);
+    }
+}
+
+static int sync_path(const char *path, int flags) {
+    int fd = open(path, flags);
+    if (fd == -1) {
+        perror("open()");
+        return -1;
+    }
+
+    int status = fsync(fd);
+    if (status == -1) {
+        perror("fsync()");
+    }
+
+    close(fd);
+    return status;
+}
+
+/**
+ * @brief Flushes the directory of a file, so its renames reach the disk
+ */
+static int sync_dir(const char *path) {
+    char dir[256];
+    const char *slash = strrchr(path, '/');
+
+    if (slash == NULL) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (slash == path) {
+        snprintf(dir, sizeof(dir), "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    }
+
+    return sync_path(dir, O_RDONLY | O_DIRECTORY);
+}
+
+/**
+ * @brief Renames the copies of a committed swap that are left, then drops
+ *        the marker
+ */
+static int finish_swap(const char *heap_path, const char *table_path) {
+    char heap_temp[256], table_temp[256], marker[256];
+    swap_paths(heap_path, table_path, heap_temp, table_temp, marker,
+               sizeof(marker));
+
+    // a copy already renamed is gone
+    if ((access(table_temp, F_OK) == 0 &&
+         rename(table_temp, table_path) == -1) ||
+        (access(heap_temp, F_OK) == 0 && rename(heap_temp, heap_path) == -1)) {
+        perror("rename()");
+        return -1;
+    }
+
+    // the marker only goes once the renames are on the disk, and is gone
+    // before new copies can be written
+    if (sync_dir(heap_path) != 0 || unlink(marker) == -1 ||
+        sync_dir(heap_path) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Swaps the metadata files for their copies
+ *
+ * The two renames can't be done at once, so the swap is committed before
+ * them by creating a marker next to the heap. From then on the copies are
+ * the metadata files, and storage_open() finishes a swap that was cut
+ * short. Without the marker it removes the copies instead.
+ *
+ * @retval 0 Swap is committed, the renames may still be left to
+ *           storage_open()
+ * @retval -1 Swap was not committed, the metadata files are unchanged
+ */
+static int replace_files(const char *heap_path, const char *table_path) {
+    char heap_temp[256], table_temp[256], marker[256];
+    swap_paths(heap_path, table_path, heap_temp, table_temp, marker,
+               sizeof(marker));
+
+    // the copies are complete on the disk before the swap commits
+    if (sync_path(heap_temp, O_RDONLY) != 0 ||
+        sync_path(table_temp, O_RDONLY) != 0) {
+        return -1;
+    }
+
+    int fd = open(marker, O_CREAT | O_WRONLY, 0666);
+    if (fd == -1) {
+        perror("open()");
+        return -1;
+    }
+    close(fd);
+
+    if (sync_dir(heap_path) != 0) {
+        unlink(marker);
+        return -1;
+    }
+
+    if (finish_swap(heap_path, table_path) != 0) {
+        printf("[SERVER INFO] the swap of %s ends when it is opened again\n",
+               heap_path);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Finishes or undoes a swap of the metadata files cut short
+ */
+static int recover_swap(const char *heap_path, const char *table_path) {
+    char heap_temp[256], table_temp[256], marker[256];
+    swap_paths(heap_path, table_path, heap_temp, table_temp, marker,
+               sizeof(marker));
+
+    if (access(marker, F_OK) == 0) {
+        printf("[SERVER INFO] finishing the swap of %s\n", heap_path);
+        return finish_swap(heap_path, table_path);
+    }
+
+    // copies of a swap that never committed
+    unlink(heap_temp);
+    unlink(table_temp);
+    return 0;
+}
+
+/**
+ * @brief Turns the records of a converted heap that a filter drops into
+ *        tombstones
+ *
+ * The old formats have no record states, so every record is converted as
+ * live, a NULL filter leaves them that way.
+ */
+static int mark_removed(Storage *storage, Storage_Filter keep,
+                        void *context) {
+    for (unsigned i = 0; keep != NULL && i < storage->count; i++) {
+        if (storage->slots[i].offset != 0 && !keep(context, i) &&
+            storage_remove(storage, i) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int upgrade_fixed(const char *heap_path, const char *table_path,
+                         Storage_Filter keep, void *context) {
+    int old = open(heap_path, O_RDONLY);
+    if (old == -1) {
+        perror("open()");
+        return -1;
+    }
+
+    char heap_temp[256], table_temp[256];
+    temp_paths(heap_path, table_path, heap_temp, table_temp,
+               sizeof(heap_temp));
+
+    int status = 0;
+    Storage *storage = open_files(heap_temp, table_temp, &status);
+    if (storage == NULL) {
+        close(old);
+        return -1;
+    }
+
+    printf("[SERVER INFO] converting %s to the compact format\n", heap_path);
+
+    Fixed_Record *records = (Fixed_Record *)malloc(256 * sizeof(Fixed_Record));
+    Document *docs = (Document *)malloc(256 * sizeof(Document));
+    ssize_t out = 0;
+    int identifier = 0;
+
+    // convert a batch of records at a time
+    while (records != NULL && docs != NULL &&
+           (out = read(old, records, 256 * sizeof(Fixed_Record))) > 0) {
+        unsigned count = out / sizeof(Fixed_Record);
+
+        memset(docs, 0, count * sizeof(Document));
+        for (unsigned i = 0; i < count; i++) {
+            memcpy(docs[i].title, records[i].title, sizeof(records[i].title));
+            memcpy(docs[i].authors, records[i].authors,
+                   sizeof(records[i].authors));
+            memcpy(docs[i].year, records[i].year, sizeof(records[i].year));
+            memcpy(docs[i].path, records[i].path, sizeof(records[i].path));
+        }
+
+        if (storage_write(storage, identifier, docs, count) != 0) {
+            status = -1;
+            break;
+        }
+
+        identifier += count;
+    }
+
+    if (records == NULL || docs == NULL || out == -1) {
+        status = -1;
+    }
+
+    if (status == 0) {
+        status = mark_removed(storage, keep, context);
+    }
+
+    free(records);
+    free(docs);
+    close(old);
+    storage_close(storage);
+
+    if (status != 0) {
+        unlink(heap_temp);
+        unlink(table_temp);
+        return -1;
+    }
+
+    // the old file is only replaced once the new one is complete
+    return replace_files(heap_path, table_path);
+}
+
+static int copy_records(const Storage *from, Storage *to,
+                        Storage_Filter keep, void *context) {
+    Document *docs = (Document *)malloc(256 * sizeof(Document));
+    unsigned count = 0;
+    int first = 0, status = 0;
+
+    if (docs == NULL) {
+        return -1;
+    }
+
+    // every run of consecutive records is written at once, identifiers
+    // without a record stay without one
+    for (unsigned i = 0; status == 0 && i <= from->count; i++) {
+        if (count > 0 && (count == 256 || i == from->count ||
+                          i != first + count)) {
+            if (storage_write(to, first, docs, count) != 0) {
+                status = -1;
+            }
+            count = 0;
+        }
+
+        if (i < from->count && (keep == NULL || keep(context, i)) &&
+            storage_get(from, i, docs + count) != NULL) {
+            if (count == 0) {
+                first = i;
+            }
+            count++;
+        }
+    }
+
+    free(docs);
+    return status;
+}
+
+static int upgrade_heap(Storage *old, const char *heap_path,
+                        const char *table_path, Storage_Filter keep,
+                        void *context) {
+    char heap_temp[256], table_temp[256];
+    temp_paths(heap_path, table_path, heap_temp, table_temp,
+               sizeof(heap_temp));
+
+    int status = 0;
+    Storage *storage = open_files(heap_temp, table_temp, &status);
+    if (storage == NULL) {
+        storage_close(old);
+        return -1;
+    }
+
+    printf("[SERVER INFO] adding record states to %s\n", heap_path);
+
+    status = copy_records(old, storage, NULL, NULL);
+    if (status == 0) {
+        status = mark_removed(storage, keep, context);
+    }
+
+    storage_close(old);
+    storage_close(storage);
+
+    if (status != 0) {
+        unlink(heap_temp);
+        unlink(table_temp);
+        return -1;
+    }
+
+    return replace_files(heap_path, table_path);
+}
+
+static int map_heap(Storage *storage) {
+    storage->mapped = map_size(storage->size, 0);
+
+    // pages past the end of the heap are mapped but never touched
+    storage->map = (char *)mmap(NULL, storage->mapped, PROT_READ, MAP_SHARED,
+                                storage->heap, 0);
+    if (storage->map == MAP_FAILED) {
+        perror("mmap()");
+        storage->map = NULL;
+        storage->mapped = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+Storage *storage_open(const char *heap_path, const char *table_path,
+                      int map, int uring, Storage_Filter keep,
+                      void *context) {
+    if (recover_swap(heap_path, table_path) != 0) {
+        return NULL;
+    }
+
+    int status = 0;
+    Storage *storage = open_files(heap_path, table_path, &status);
+
+    // metadata file written before the compact format
+    if (status == 1 && upgrade_fixed(heap_path, table_path, keep, context) == 0) {
+        storage = open_files(heap_path, table_path, &status);
+    }
+
+    // heap written before records had a state
+    if (status == 2) {
+        storage = upgrade_heap(storage, heap_path, table_path, keep,
+                                   context) == 0
+                      ? open_files(heap_path, table_path, &status)
+                      : NULL;
+    }
+
+    if (storage == NULL) {
+        return NULL;
+    }
+
+    storage->uring = uring;
+    if (map == 0) {
+        return storage;
+    }
+
+    if (map_heap(storage) != 0) {
+        printf("[SERVER INFO] reading %s with pread()\n", heap_path);
+    }
+
+    return storage;
+}
+
+void storage_close(Storage *storage) {
+    if (storage == NULL) {
+        return;
+    }
+
+    if (storage->map != NULL) {
+        munmap(storage->map, storage->mapped);
+    }
+    if (storage->table != -1) {
+        close(storage->table);
+    }
+    close(storage->heap);
+    free(storage->slots);
+    free(storage->removed);
+    free(storage);
+}
+
+unsigned storage_count(const Storage *storage) {
+    return storage->count;
+}
+
+const Document *storage_get(const Storage *storage, int identifier,
+                            Document *buffer) {
+    if (identifier < 0 || identifier >= storage->count ||
+        storage->slots[identifier].offset == 0) {
+        return NULL;
+    }
+
+    const Slot *slot = storage->slots + identifier;
+    const char *data = NULL;
+    char record[RECORD_MAX];
+
+    if (slot->length > RECORD_MAX) {
+        return NULL;
+    }
+
+    if (storage->map != NULL) {
+        // decode straight from the mapping
+        data = storage->map + slot->offset;
+    } else {
+        if (pread(storage->heap, record, slot->length, slot->offset) !=
+            (ssize_t)slot->length) {
+            perror("pread()");
+            return NULL;
+        }
+        data = record;
+    }
+
+    if (decode_record(data, slot->length, storage->version, buffer) != 0) {
+        return NULL;
+    }
+
+    return buffer;
+}
+
+static Uring *get_ring(void) {
+    if (thread_ring == NULL || ring_owner != getpid()) {
+        // a ring inherited through fork() belongs to the parent
+        thread_ring = uring_create(URING_DEPTH);
+        ring_owner = getpid();
+    }
+
+    return thread_ring;
+}
+
+static int reap_runs(Uring *ring, const Slot *table, const unsigned *ends,
+                     int *failed) {
+    uint64_t tag = 0;
+    int result = 0, reaped = 0;
+
+    while (uring_reap(ring, &tag, &result)) {
+        // the tag is the first identifier of the run
+        size_t length = table[ends[tag] - 1].offset +
+                        table[ends[tag] - 1].length - table[tag].offset;
+        if (result != (int)length) {
+            *failed = 1;
+        }
+        reaped++;
+    }
+
+    return reaped;
+}
+
+static int read_block_uring(const Storage *storage, Uring *ring,
+                            const Slot *table, Document *const *slots,
+                            unsigned count) {
+    size_t *positions = (size_t *)malloc(count * sizeof(size_t));
+    unsigned *ends = (unsigned *)malloc(count * sizeof(unsigned));
+    size_t total = 0;
+
+    // every record gets its place in one buffer, in the order of the block
+    for (unsigned i = 0; positions != NULL && i < count; i++) {
+        positions[i] = total;
+        total += table[i].offset == 0 ? 0 : table[i].length;
+    }
+
+    char *data = (char *)malloc(total + 1);
+    if (positions == NULL || ends == NULL || data == NULL) {
+        free(positions);
+        free(ends);
+        free(data);
+        return -2;
+    }
+
+    unsigned i = 0, pending = 0;
+    int failed = 0;
+
+    // one read per run of adjacent records, all of them in flight at once
+    while (i < count && failed == 0) {
+        if (table[i].offset == 0) {
+            i++;
+            continue;
+        }
+
+        unsigned end = i + 1;
+        while (end < count && table[end].offset != 0 &&
+               table[end].offset ==
+                   table[end - 1].offset + table[end - 1].length) {
+            end++;
+        }
+        ends[i] = end;
+
+        size_t length = table[end - 1].offset + table[end - 1].length -
+                        table[i].offset;
+        while (failed == 0 && uring_read(ring, storage->heap,
+                                         data + positions[i], length,
+                                         table[i].offset, i) != 0) {
+            // the ring is full, wait for some of the reads
+            if (uring_submit(ring, 1) != 0) {
+                failed = 1;
+            }
+            pending -= reap_runs(ring, table, ends, &failed);
+        }
+
+        pending++;
+        i = end;
+    }
+
+    while (pending > 0) {
+        if (uring_submit(ring, 1) != 0) {
+            failed = 1;
+            break;
+        }
+        pending -= reap_runs(ring, table, ends, &failed);
+    }
+
+    for (unsigned j = 0; failed == 0 && j < count; j++) {
+        if (table[j].offset == 0 ||
+            decode_record(data + positions[j], table[j].length,
+                          storage->version, slots[j]) != 0) {
+            memset(slots[j], 0, sizeof(Document));
+        }
+    }
+
+    free(positions);
+    free(ends);
+    free(data);
+
+    // a read that failed or came short is done again with pread()
+    return failed ? -2 : (int)count;
+}
+
+int storage_read_block(const Storage *storage, int identifier,
+                       Document *const *slots, unsigned count) {
+    if (count == 0 || identifier < 0 || identifier >= storage->count) {
+        return 0;
+    }
+
+    // stop at the end of the table
+    if (count > storage->count - identifier) {
+        count = storage->count - identifier;
+    }
+
+    const Slot *table = storage->slots + identifier;
+    char *span = NULL;
+    unsigned i = 0;
+
+    // several runs are read at once, a single one is a single pread()
+    Uring *ring = NULL;
+    if (storage->map == NULL && storage->uring && count > 1 &&
+        (ring = get_ring()) != NULL) {
+        int out = read_block_uring(storage, ring, table, slots, count);
+        if (out != -2) {
+            return out;
+        }
+    }
+
+    while (i < count) {
+        if (table[i].offset == 0) {
+            // identifier without a record
+            memset(slots[i], 0, sizeof(Document));
+            i++;
+            continue;
+        }
+
+        // records of consecutive identifiers are usually next to each other
+        // in the heap, so every run of them is read at once
+        unsigned end = i + 1;
+        while (end < count && table[end].offset != 0 &&
+               table[end].offset ==
+                   table[end - 1].offset + table[end - 1].length) {
+            end++;
+        }
+
+        const char *data = NULL;
+
+        if (storage->map != NULL) {
+            data = storage->map + table[i].offset;
+        } else {
+            size_t length = table[end - 1].offset + table[end - 1].length -
+                            table[i].offset;
+            char *grown = (char *)realloc(span, length);
+            if (grown == NULL ||
+                pread(storage->heap, grown, length, table[i].offset) !=
+                    (ssize_t)length) {
+                perror("pread()");
+                free(grown == NULL ? span : grown);
+                return i == 0 ? -1 : (int)i;
+            }
+
+            span = grown;
+            data = span;
+        }
+
+        for (unsigned j = i; j < end; j++) {
+            if (decode_record(data + (table[j].offset - table[i].offset),
+                              table[j].length, storage->version,
+                              slots[j]) != 0) {
+                memset(slots[j], 0, sizeof(Document));
+            }
+        }
+
+        i = end;
+    }
+
+    free(span);
+    return count;
+}
+
+static int write_slots(const Storage *storage, int identifier,
+                       unsigned count) {
+    ssize_t size = count * sizeof(Slot);
+    if (pwrite(storage->table, storage->slots + identifier, size,
+               (off_t)identifier * sizeof(Slot)) != size) {
+        perror("pwrite()");
+        return -1;
+    }
+
+    return 0;
+}
+
+int storage_write(Storage *storage, int identifier, const Document *docs,
+                  unsigned count) {
+    if (identifier < 0 || reserve_slots(storage, identifier + count) != 0) {
+        return -1;
+    }
+
+    char *records = (char *)malloc(count * RECORD_MAX);
+    // the entries of the records, then the ones they replace
+    Slot *entries = (Slot *)malloc(2 * count * sizeof(Slot));
+    if (records == NULL || entries == NULL) {
+        free(records);
+        free(entries);
+        return -1;
+    }
+
+    // pack the records, they go to the end of the heap in one write
+    size_t length = 0;
+    for (unsigned i = 0; i < count; i++) {
+        size_t used =
+            encode_record(identifier + i, docs + i, records + length);
+
+        entries[i].offset = storage->size + length;
+        entries[i].length = used;
+        entries[i].unused = 0;
+        length += used;
+    }
+
+    ssize_t out = pwrite(storage->heap, records, length, storage->size);
+    free(records);
+    if (out != (ssize_t)length) {
+        perror("pwrite()");
+        free(entries);
+        return -1;
+    }
+
+    storage->size += length;
+
+    // the heap outgrew the mapping
+    if (storage->map != NULL && storage->size > storage->mapped) {
+        size_t mapped = map_size(storage->size, storage->mapped);
+        char *map = (char *)mremap(storage->map, storage->mapped, mapped,
+                                   MREMAP_MAYMOVE);
+        if (map == MAP_FAILED) {
+            perror("mremap()");
+            free(entries);
+            return -1;
+        }
+
+        storage->map = map;
+        storage->mapped = mapped;
+    }
+
+    // the table only points to records that are already in the heap
+    unsigned previous = storage->count;
+    memcpy(entries + count, storage->slots + identifier, count * sizeof(Slot));
+    memcpy(storage->slots + identifier, entries, count * sizeof(Slot));
+    if (identifier + count > storage->count) {
+        storage->count = identifier + count;
+    }
+
+    if (write_slots(storage, identifier, count) != 0) {
+        // the previous records are still in the heap
+        memcpy(storage->slots + identifier, entries + count,
+               count * sizeof(Slot));
+        storage->count = previous;
+        free(entries);
+        return -1;
+    }
+
+    free(entries);
+    return 0;
+}
+
+int storage_remove(Storage *storage, int identifier) {
+    if (identifier < 0 || identifier >= storage->count ||
+        storage->slots[identifier].offset == 0) {
+        return -1;
+    }
+
+    // only the state of the header changes, the mapping sees it too
+    uint32_t state = RECORD_REMOVED;
+    off_t offset = storage->slots[identifier].offset +
+                   offsetof(Record_Header, state);
+    if (pwrite(storage->heap, &state, sizeof(state), offset) !=
+        sizeof(state)) {
+        perror("pwrite()");
+        return -1;
+    }
+
+    // the copy being compacted may still have the record as live
+    if (storage->mark != 0) {
+        if (storage->n_removed == storage->removed_capacity) {
+            unsigned capacity = storage->removed_capacity == 0
+                                    ? 256
+                                    : storage->removed_capacity * 2;
+            int *other =
+                (int *)realloc(storage->removed, capacity * sizeof(int));
+            if (other == NULL) {
+                return -1;
+            }
+
+            storage->removed = other;
+            storage->removed_capacity = capacity;
+        }
+
+        storage->removed[storage->n_removed++] = identifier;
+    }
+
+    return 0;
+}
+
+static void scan_headers(const char *data, const Slot *table, int identifier,
+                         unsigned count, unsigned char *live) {
+    Record_Header header;
+
+    for (unsigned i = 0; i < count; i++) {
+        memcpy(&header, data + (table[i].offset - table[0].offset),
+               sizeof(header));
+
+        // the owner must match too, a damaged table may point elsewhere
+        live[i] = header.identifier == identifier + (int)i &&
+                  header.state == RECORD_LIVE;
+    }
+}
+
+int storage_scan(const Storage *storage, int identifier, unsigned count,
+                 unsigned char *live) {
+    if (count == 0 || identifier < 0 || identifier >= storage->count) {
+        return 0;
+    }
+
+    if (count > storage->count - identifier) {
+        count = storage->count - identifier;
+    }
+
+    const Slot *table = storage->slots + identifier;
+    char *span = NULL;
+    unsigned i = 0;
+
+    if (storage->map == NULL) {
+        span = (char *)malloc(SCAN_CHUNK);
+        if (span == NULL) {
+            return -1;
+        }
+    }
+
+    while (i < count) {
+        if (table[i].offset == 0 || table[i].length < sizeof(Record_Header)) {
+            live[i++] = 0;
+            continue;
+        }
+
+        // runs of records that are next to each other in the heap, up to a
+        // chunk, so the heap is read sequentially in large reads
+        unsigned end = i + 1;
+        while (end < count && table[end].offset != 0 &&
+               table[end].offset ==
+                   table[end - 1].offset + table[end - 1].length &&
+               table[end].offset + table[end].length - table[i].offset <=
+                   SCAN_CHUNK) {
+            end++;
+        }
+
+        const char *data = NULL;
+
+        if (storage->map != NULL) {
+            data = storage->map + table[i].offset;
+        } else {
+            size_t length = table[end - 1].offset + table[end - 1].length -
+                            table[i].offset;
+            if (length > SCAN_CHUNK ||
+                pread(storage->heap, span, length, table[i].offset) !=
+                    (ssize_t)length) {
+                perror("pread()");
+                free(span);
+                return -1;
+            }
+            data = span;
+        }
+
+        scan_headers(data, table + i, identifier + i, end - i, live + i);
+        i = end;
+    }
+
+    free(span);
+    return count;
+}
+
+int storage_sync(const Storage *storage) {
+    // the heap first, the table points into it
+    if (fdatasync(storage->heap) == -1 || fdatasync(storage->table) == -1) {
+        perror("fdatasync()");
+        return -1;
+    }
+
+    return 0;
+}
+
+void storage_compact_start(Storage *storage) {
+    storage->mark = storage->size;
+    storage->n_removed = 0;
+}
+
+int storage_compact_copy(const Storage *storage, const char *heap_path,
+                         const char *table_path, Storage_Filter keep,
+                         void *context) {
+    // the copies of a swap cut short are still the metadata files
+    if (recover_swap(heap_path, table_path) != 0) {
+        return -1;
+    }
+
+    char heap_temp[256], table_temp[256];
+    temp_paths(heap_path, table_path, heap_temp, table_temp,
+               sizeof(heap_temp));
+
+    int status = 0;
+    Storage *copy = open_files(heap_temp, table_temp, &status);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    // in the order of the identifiers, so blocks of the caches are dense
+    status = copy_records(storage, copy, keep, context);
+    if (status == 0) {
+        status = storage_sync(copy);
+    }
+
+    storage_close(copy);
+
+    if (status != 0) {
+        unlink(heap_temp);
+        unlink(table_temp);
+    }
+
+    return status;
+}
+
+void storage_compact_abort(Storage *storage, const char *heap_path,
+                           const char *table_path) {
+    char heap_temp[256], table_temp[256];
+    temp_paths(heap_path, table_path, heap_temp, table_temp,
+               sizeof(heap_temp));
+
+    storage->mark = 0;
+    storage->n_removed = 0;
+}
+
+long long storage_compact_finish(Storage *storage, const char *heap_path,
+                                 const char *table_path) {
+    char heap_temp[256], table_temp[256];
+    snprintf(heap_temp, sizeof(heap_temp), "%s.new", heap_path);
+    snprintf(table_temp, sizeof(table_temp), "%s.new", table_path);
+
+    int status = 0;
+    Storage *copy = open_files(heap_temp, table_temp, &status);
+    Document buffer;
+
+    // live records written since the copy started
+    for (unsigned i = 0; copy != NULL && status == 0 && i < storage->count;
+         i++) {
+        unsigned char live = 0;
+
+        if (storage->slots[i].offset >= storage->mark &&
+            storage_scan(storage, i, 1, &live) == 1 && live &&
+            storage_get(storage, i, &buffer) != NULL &&
+            storage_write(copy, i, &buffer, 1) != 0) {
+            status = -1;
+        }
+    }
+
+    // records removed since the copy started, unless they were written
+    // again and are live
+    for (unsigned i = 0; copy != NULL && status == 0 && i < storage->n_removed;
+         i++) {
+        int identifier = storage->removed[i];
+        unsigned char live = 0;
+
+        if (storage_scan(storage, identifier, 1, &live) == 1 && live == 0 &&
+            identifier < copy->count && copy->slots[identifier].offset != 0) {
+            copy->slots[identifier].offset = 0;
+            copy->slots[identifier].length = 0;
+            status = write_slots(copy, identifier, 1);
+        }
+    }
+
+    if (copy == NULL || status != 0 || storage_sync(copy) != 0 ||
+        replace_files(heap_path, table_path) != 0) {
+        storage_close(copy);
+        storage_compact_abort(storage, heap_path, table_path);
+        return -1;
+    }
+
+    long long reclaimed = (long long)storage->size - (long long)copy->size;
+    int mapped = storage->map != NULL;
+
+    // the storage takes the new files, callers keep their pointer
+    if (mapped) {
+        munmap(storage->map, storage->mapped);
+        storage->map = NULL;
+        storage->mapped = 0;
+    }
+    close(storage->heap);
+    close(storage->table);
+    free(storage->slots);
+
+    storage->heap = copy->heap;
+    storage->table = copy->table;
+    storage->slots = copy->slots;
+    storage->count = copy->count;
+    storage->capacity = copy->capacity;
+    storage->size = copy->size;
+    storage->version = copy->version;
+    storage->mark = 0;
+    storage->n_removed = 0;
+
+    free(copy->removed);
+    free(copy);
+
+    if (mapped && map_heap(storage) != 0) {
+        printf("[SERVER INFO] reading %s with pread()\n", heap_path);
+    }
+
+    return reclaimed;
+}
@@ -0,0 +1,169 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Pool of threads sharing one bounded task queue
+ */
+typedef struct thread_pool {
+    unsigned size;          /**< Number of threads started */
+    pthread_t *threads;     /**< Identifier of each thread */
+    void *queue[TPOOL_QUEUE_SIZE]; /**< Circular queue of tasks */
+    unsigned head;          /**< Position of the next task to run */
+    unsigned count;         /**< Number of tasks in the queue */
+    unsigned pending;       /**< Tasks submitted and not finished yet */
+    int stopping;           /**< No more tasks are accepted */
+    pthread_mutex_t lock;   /**< Protects every field above */
+    pthread_cond_t filled;  /**< Signaled when a task is queued */
+    pthread_cond_t emptied; /**< Signaled when a task leaves the queue */
+    pthread_cond_t done;    /**< Signaled when pending reaches zero */
+    Task_Handler handler;   /**< Function that runs the tasks */
+    void *context;          /**< Passed to the handler */
+} Thread_Pool;
+
+static void *run_thread(void *argument) {
+    Thread_Pool *pool = (Thread_Pool *)argument;
+    void *task = NULL;
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+
+        while (pool->count == 0 && pool->stopping == 0) {
+            pthread_cond_wait(&pool->filled, &pool->lock);
+        }
+
+        // the queue is empty and will stay empty
+        if (pool->count == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        task = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % TPOOL_QUEUE_SIZE;
+        pool->count--;
+
+        pthread_cond_signal(&pool->emptied);
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->handler(pool->context, task);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        if (pool->pending == 0) {
+            pthread_cond_broadcast(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+Thread_Pool *tpool_create(unsigned size, Task_Handler handler, void *context) {
+    if (size == 0 || handler == NULL) {
+        return NULL;
+    }
+
+    Thread_Pool *pool = (Thread_Pool *)calloc(1, sizeof(Thread_Pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->threads = (pthread_t *)calloc(size, sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->handler = handler;
+    pool->context = context;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->filled, NULL);
+    pthread_cond_init(&pool->emptied, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // the threads inherit the mask, so they never take a signal
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+
+    for (unsigned i = 0; i < size; i++) {
+        int error = pthread_create(pool->threads + i, NULL, run_thread, pool);
+        if (error != 0) {
+            fprintf(stderr, "pthread_create(): error %d\n", error);
+            break;
+        }
+
+        pool->size++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    if (pool->size < size) {
+        tpool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+int tpool_submit(Thread_Pool *pool, void *task) {
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->count == TPOOL_QUEUE_SIZE && pool->stopping == 0) {
+        pthread_cond_wait(&pool->emptied, &pool->lock);
+    }
+
+    if (pool->stopping) {
+        pthread_mutex_unlock(&pool->lock);
+        return 1;
+    }
+
+    pool->queue[(pool->head + pool->count) % TPOOL_QUEUE_SIZE] = task;
+    pool->count++;
+    pool->pending++;
+
+    pthread_cond_signal(&pool->filled);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+void tpool_wait(Thread_Pool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void tpool_destroy(Thread_Pool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    // threads leave once the queue is empty
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->filled);
+    pthread_cond_broadcast(&pool->emptied);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned i = 0; i < pool->size; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->filled);
+    pthread_cond_destroy(&pool->emptied);
+    pthread_cond_destroy(&pool->done);
+
+    free(pool->threads);
+    free(pool);
+}
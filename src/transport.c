@@ -0,0 +1,409 @@
+#include "transport.h"
+#include "protocol.h"
+#include "shared_memory.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 64       /**< Events handled per epoll_wait() call */
+#define BACKLOG 128         /**< Pending connections on the listening socket */
+#define SWEEP_MS 1000       /**< Idle time before looking for dead shm clients */
+
+/**
+ * @brief Connected client of the socket transport
+ *
+ * Requests may arrive split or glued together, so the bytes read are kept
+ * until a whole frame is available.
+ */
+typedef struct connection {
+    int fd;                         /**< Connected socket */
+    size_t used;                    /**< Bytes waiting in the buffer */
+    char buffer[2 * MAX_REQUEST];   /**< Bytes received, not processed yet */
+} Connection;
+
+static int open_child_signal(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    // SIGCHLD is only delivered through the descriptor
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        perror("sigprocmask()");
+        return -1;
+    }
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1) {
+        perror("signalfd()");
+    }
+
+    return fd;
+}
+
+static void reap_children(Server *server) {
+    pid_t pid = 0;
+    int status = 0;
+
+    // workers that died are replaced, reply children are just collected
+    // children forked by the threads of the server are waited by them
+    while ((pid = waitpid(-1, &status, WNOHANG | __WNOTHREAD)) > 0) {
+        reap_worker(server, pid, status);
+    }
+}
+
+static void read_child_signals(Server *server, int signals) {
+    struct signalfd_siginfo info;
+
+    // several exits may be merged in one signal, so wait for all of them
+    while (read(signals, &info, sizeof(info)) == sizeof(info))
+        ;
+
+    reap_children(server);
+}
+
+int run_fifo_loop(Server *server) {
+    Request request;
+    int stop = 0, out = 0;
+
+    // open the server fifo once, it stays open for the whole run
+    int input = open(SERVER_FIFO, O_RDONLY);
+    if (input == -1) {
+        perror("open()");
+        return 2;
+    }
+
+    // hold a writing side too, so the fifo never reaches end of file
+    int keep_alive = open(SERVER_FIFO, O_WRONLY);
+    if (keep_alive == -1) {
+        perror("open()");
+        close(input);
+        return 2;
+    }
+
+    int signals = open_child_signal();
+    if (signals == -1) {
+        close(keep_alive);
+        close(input);
+        return 2;
+    }
+
+    struct pollfd ready[2] = {{.fd = input, .events = POLLIN},
+                              {.fd = signals, .events = POLLIN}};
+
+    while (stop == 0) {
+        if (poll(ready, 2, -1) == -1) {
+            perror("poll()");
+            continue;
+        }
+
+        // reply children are done
+        if (ready[1].revents & POLLIN) {
+            read_child_signals(server, signals);
+        }
+
+        if ((ready[0].revents & POLLIN) == 0) {
+            continue;
+        }
+
+        // receive request from client
+        out = receive_request(input, &request);
+
+        if (out == 1) {
+            break;
+        }
+
+        // skip malformed messages
+        if (out == -1) {
+            continue;
+        }
+
+        // process request
+        stop = process_request(server, &request);
+        release_request(&request);
+    }
+
+    close(signals);
+    close(keep_alive);
+    close(input);
+
+    return 0;
+}
+
+static int open_listener(void) {
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener == -1) {
+        perror("socket()");
+        return -1;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, SERVER_SOCKET, sizeof(address.sun_path) - 1);
+
+    // remove a socket left behind by a previous run
+    unlink(SERVER_SOCKET);
+
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        perror("bind()");
+        close(listener);
+        return -1;
+    }
+
+    if (listen(listener, BACKLOG) == -1) {
+        perror("listen()");
+        close(listener);
+        return -1;
+    }
+
+    return listener;
+}
+
+static void close_connection(Server *server, int epoll, Connection *conn) {
+    epoll_ctl(epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+    drop_channel(server, conn->fd);
+    close(conn->fd);
+    free(conn);
+}
+
+static int accept_clients(int epoll, int listener) {
+    int fd = 0;
+
+    // accept every pending connection
+    while ((fd = accept(listener, NULL, NULL)) != -1) {
+        Connection *conn = (Connection *)calloc(1, sizeof(Connection));
+        if (conn == NULL) {
+            close(fd);
+            return 1;
+        }
+
+        conn->fd = fd;
+
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+        if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+            perror("epoll_ctl()");
+            close(fd);
+            free(conn);
+        }
+    }
+
+    return 0;
+}
+
+static int serve_connection(Server *server, Connection *conn) {
+    ssize_t out = read(conn->fd, conn->buffer + conn->used,
+                       sizeof(conn->buffer) - conn->used);
+    if (out <= 0) {
+        // client disconnected
+        return -1;
+    }
+
+    conn->used += out;
+
+    Header header;
+    Request request;
+    size_t frame = 0;
+    int stop = 0;
+
+    // process every complete frame in the buffer
+    while (stop == 0 && conn->used >= sizeof(Header)) {
+        memcpy(&header, conn->buffer, sizeof(Header));
+
+        if (header.magic != PROTOCOL_MAGIC ||
+            header.length > MAX_REQUEST - sizeof(Header)) {
+            printf("[PROTOCOL] invalid frame, closing connection\n");
+            return -1;
+        }
+
+        frame = sizeof(Header) + header.length;
+        if (conn->used < frame) {
+            break;
+        }
+
+        if (decode_request(&header, conn->buffer + sizeof(Header),
+                           &request) == 0) {
+            request.channel = conn->fd;
+            stop = process_request(server, &request);
+            release_request(&request);
+        }
+
+        conn->used -= frame;
+        memmove(conn->buffer, conn->buffer + frame, conn->used);
+    }
+
+    return stop;
+}
+
+int run_socket_loop(Server *server) {
+    int listener = open_listener();
+    if (listener == -1) {
+        return 2;
+    }
+
+    int epoll = epoll_create1(0);
+    if (epoll == -1) {
+        perror("epoll_create1()");
+        close(listener);
+        unlink(SERVER_SOCKET);
+        return 2;
+    }
+
+    int signals = open_child_signal();
+    if (signals == -1) {
+        close(epoll);
+        close(listener);
+        unlink(SERVER_SOCKET);
+        return 2;
+    }
+
+    // the listener and the signal descriptor are told apart by their tag
+    int accept_tag = 0, signal_tag = 0;
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = &accept_tag};
+    epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+
+    event.data.ptr = &signal_tag;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, signals, &event);
+
+    struct epoll_event events[MAX_EVENTS];
+    int stop = 0, ready = 0, out = 0;
+
+    while (stop == 0) {
+        ready = epoll_wait(epoll, events, MAX_EVENTS, -1);
+        if (ready == -1) {
+            perror("epoll_wait()");
+            continue;
+        }
+
+        for (int i = 0; i < ready && stop == 0; i++) {
+            if (events[i].data.ptr == &accept_tag) {
+                // new clients on the listening socket
+                accept_clients(epoll, listener);
+                continue;
+            }
+
+            if (events[i].data.ptr == &signal_tag) {
+                // reply children are done
+                read_child_signals(server, signals);
+                continue;
+            }
+
+            Connection *conn = (Connection *)events[i].data.ptr;
+
+            out = serve_connection(server, conn);
+            if (out == -1) {
+                close_connection(server, epoll, conn);
+            } else {
+                stop = out;
+            }
+        }
+    }
+
+    close(signals);
+    close(epoll);
+    close(listener);
+    unlink(SERVER_SOCKET);
+
+    return 0;
+}
+
+static void sweep_slots(Server *server, Shm_Region *region) {
+    for (int i = 0; i < SHM_SLOTS; i++) {
+        pid_t owner = shm_slot_owner(region, i);
+
+        // the client died without releasing the slot
+        if (owner != 0 && kill(owner, 0) == -1 && errno == ESRCH) {
+            printf("[SERVER INFO] releasing the slot of %d\n", owner);
+            drop_client(server, owner);
+            shm_release_slot(region, i);
+        }
+    }
+}
+
+static int serve_slot(Server *server, Shm_Region *region, int slot,
+                      unsigned *served) {
+    Shm_Ring *input = shm_request_ring(region, slot);
+    char frame[MAX_REQUEST];
+    Header header;
+    Request request;
+    ssize_t length = 0;
+    int stop = 0;
+
+    // process every complete frame in the request ring
+    while (stop == 0 &&
+           (length = shm_take_frame(input, frame, sizeof(frame))) != 0) {
+        if (length == -1) {
+            printf("[PROTOCOL] invalid frame in slot %d\n", slot);
+            break;
+        }
+
+        memcpy(&header, frame, sizeof(Header));
+
+        if (decode_request(&header, frame + sizeof(Header), &request) == 0) {
+            request.ring = shm_reply_ring(region, slot);
+            stop = process_request(server, &request);
+            release_request(&request);
+        }
+
+        (*served)++;
+    }
+
+    return stop;
+}
+
+int run_shm_loop(Server *server, Shm_Region *region) {
+    int stop = 0;
+    unsigned seen = 0, served = 0;
+
+    while (stop == 0) {
+        // read the doorbell first, so a request sent during the scan counts
+        seen = shm_doorbell(region);
+        served = 0;
+
+        for (int i = 0; i < SHM_SLOTS && stop == 0; i++) {
+            if (shm_slot_owner(region, i) != 0) {
+                stop = serve_slot(server, region, i, &served);
+            }
+        }
+
+        // reap the children that already sent their reply
+        reap_children(server);
+
+        if (stop == 0 && served == 0 &&
+            shm_wait_requests(region, seen, SWEEP_MS) == 1) {
+            sweep_slots(server, region);
+        }
+    }
+
+    return 0;
+}
+
+int connect_socket(void) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, SERVER_SOCKET, sizeof(address.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
@@ -0,0 +1,195 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * @brief Submission and completion rings shared with the kernel
+ */
+typedef struct uring {
+    int fd;                 /**< Descriptor of the ring */
+    unsigned *sq_head;      /**< Next entry the kernel takes */
+    unsigned *sq_tail;      /**< Next entry we fill */
+    unsigned sq_mask;       /**< Size of the submission ring minus one */
+    unsigned *sq_array;     /**< Indexes of the entries to submit */
+    struct io_uring_sqe *sqes; /**< Submission entries */
+    unsigned *cq_head;      /**< Next completion we take */
+    unsigned *cq_tail;      /**< Next completion the kernel fills */
+    unsigned cq_mask;       /**< Size of the completion ring minus one */
+    struct io_uring_cqe *cqes; /**< Completion entries */
+    unsigned queued;        /**< Entries filled and not submitted yet */
+    void *sq_map;           /**< Mapping of the submission ring */
+    size_t sq_size;         /**< Bytes of sq_map */
+    void *cq_map;           /**< Mapping of the completion ring, may be sq_map */
+    size_t cq_size;         /**< Bytes of cq_map */
+    size_t sqes_size;       /**< Bytes of sqes */
+} Uring;
+
+Uring *uring_create(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    Uring *ring = (Uring *)calloc(1, sizeof(Uring));
+    if (ring == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    ring->fd = fd;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // newer kernels map both rings at once
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) {
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        perror("mmap()");
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->cq_map = ring->sq_map;
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+        ring->cq_map = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            perror("mmap()");
+            munmap(ring->sq_map, ring->sq_size);
+            close(fd);
+            free(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(
+        NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        perror("mmap()");
+        if (ring->cq_map != ring->sq_map) {
+            munmap(ring->cq_map, ring->cq_size);
+        }
+        munmap(ring->sq_map, ring->sq_size);
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+
+    char *sq = (char *)ring->sq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+    char *cq = (char *)ring->cq_map;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return ring;
+}
+
+void uring_destroy(Uring *ring) {
+    if (ring == NULL) {
+        return;
+    }
+
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_size);
+    }
+    munmap(ring->sq_map, ring->sq_size);
+    close(ring->fd);
+    free(ring);
+}
+
+int uring_read(Uring *ring, int fd, void *buffer, unsigned length,
+               off_t offset, uint64_t tag) {
+    unsigned tail = *ring->sq_tail;
+
+    // the kernel moves the head as it takes entries
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >
+        ring->sq_mask) {
+        return -1;
+    }
+
+    unsigned index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = ring->sqes + index;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = tag;
+
+    ring->sq_array[index] = index;
+
+    // the entry must be complete before the kernel sees the new tail
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+
+    return 0;
+}
+
+int uring_submit(Uring *ring, unsigned wait) {
+    unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    if (ring->queued == 0 && wait == 0) {
+        return 0;
+    }
+
+    int out = -1;
+    do {
+        out = syscall(__NR_io_uring_enter, ring->fd, ring->queued, wait,
+                      flags, NULL, 0);
+    } while (out == -1 && errno == EINTR);
+
+    if (out == -1) {
+        perror("io_uring_enter()");
+        return -1;
+    }
+
+    ring->queued -= out < (int)ring->queued ? out : ring->queued;
+    return 0;
+}
+
+int uring_reap(Uring *ring, uint64_t *tag, int *result) {
+    unsigned head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    const struct io_uring_cqe *cqe = ring->cqes + (head & ring->cq_mask);
+    *tag = cqe->user_data;
+    *result = cqe->res;
+
+    // the slot can be reused by the kernel once the head moves past it
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
@@ -0,0 +1,244 @@
+#include "wal.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Record of the log, as stored in the file
+ */
+typedef struct {
+    uint32_t type;      /**< Wal_Type of the change */
+    int32_t identifier; /**< Document identifier */
+    uint32_t check;     /**< Checksum of the fields above */
+} Record;
+
+/**
+ * @brief Log file and the records not written yet
+ */
+typedef struct wal {
+    char *path;         /**< Path of the log file */
+    int fd;             /**< Descriptor of the log, opened for appending */
+    Record *pending;    /**< Records waiting for wal_commit() */
+    unsigned count;     /**< Number of pending records */
+    unsigned capacity;  /**< Capacity of pending */
+    unsigned sync_every; /**< Records between calls to fsync(), 0 for never */
+    unsigned unsynced;  /**< Records written since the last fsync() */
+} Wal;
+
+static uint32_t checksum(uint32_t type, int32_t identifier) {
+    // FNV-1a over both fields
+    uint32_t hash = 2166136261u;
+    uint32_t words[2] = {type, (uint32_t)identifier};
+
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 4; j++) {
+            hash ^= (words[i] >> (8 * j)) & 0xFF;
+            hash *= 16777619u;
+        }
+    }
+
+    return hash;
+}
+
+Wal *wal_open(const char *path, unsigned sync_every) {
+    Wal *wal = (Wal *)calloc(1, sizeof(Wal));
+    if (wal == NULL) {
+        return NULL;
+    }
+
+    wal->path = strdup(path);
+    if (wal->path == NULL) {
+        free(wal);
+        return NULL;
+    }
+
+    wal->fd = open(path, O_CREAT | O_RDWR | O_APPEND, 0666);
+    if (wal->fd == -1) {
+        perror("open()");
+        free(wal->path);
+        free(wal);
+        return NULL;
+    }
+
+    wal->sync_every = sync_every;
+
+    return wal;
+}
+
+void wal_close(Wal *wal) {
+    if (wal == NULL) {
+        return;
+    }
+
+    wal_commit(wal);
+    if (wal->unsynced > 0) {
+        fsync(wal->fd);
+    }
+
+    close(wal->fd);
+    free(wal->pending);
+    free(wal->path);
+    free(wal);
+}
+
+int wal_replay(Wal *wal, Wal_Handler handler, void *context) {
+    struct stat info;
+    if (fstat(wal->fd, &info) == -1) {
+        perror("fstat()");
+        return -1;
+    }
+
+    unsigned count = info.st_size / sizeof(Record);
+    if (count == 0) {
+        return 0;
+    }
+
+    Record *records = (Record *)malloc(count * sizeof(Record));
+    if (records == NULL) {
+        return -1;
+    }
+
+    // the whole log in a single read
+    if (pread(wal->fd, records, count * sizeof(Record), 0) !=
+        (ssize_t)(count * sizeof(Record))) {
+        perror("pread()");
+        free(records);
+        return -1;
+    }
+
+    unsigned i = 0;
+    while (i < count &&
+           records[i].check ==
+               checksum(records[i].type, records[i].identifier) &&
+           (records[i].type == WAL_INDEX || records[i].type == WAL_REMOVE)) {
+        handler(context, (Wal_Type)records[i].type, records[i].identifier);
+        i++;
+    }
+
+    free(records);
+
+    // drop a record cut short by a crash, and whatever follows it
+    if (i * sizeof(Record) < (size_t)info.st_size) {
+        printf("[SERVER INFO] dropping a damaged log record at %zu\n",
+               i * sizeof(Record));
+        if (ftruncate(wal->fd, i * sizeof(Record)) == -1) {
+            perror("ftruncate()");
+            return -1;
+        }
+    }
+
+    return i;
+}
+
+int wal_append(Wal *wal, Wal_Type type, int identifier) {
+    if (wal == NULL) {
+        return 0;
+    }
+
+    if (wal->count == wal->capacity) {
+        unsigned capacity = wal->capacity == 0 ? 64 : wal->capacity * 2;
+        Record *other =
+            (Record *)realloc(wal->pending, capacity * sizeof(Record));
+        if (other == NULL) {
+            return -1;
+        }
+
+        wal->pending = other;
+        wal->capacity = capacity;
+    }
+
+    Record *record = wal->pending + wal->count++;
+    record->type = type;
+    record->identifier = identifier;
+    record->check = checksum(type, identifier);
+
+    return 0;
+}
+
+int wal_sync_due(const Wal *wal) {
+    return wal != NULL && wal->count > 0 && wal->sync_every > 0 &&
+           wal->unsynced + wal->count >= wal->sync_every;
+}
+
+int wal_commit(Wal *wal) {
+    if (wal == NULL || wal->count == 0) {
+        return 0;
+    }
+
+    // every pending record in one write
+    size_t length = wal->count * sizeof(Record);
+    ssize_t out = write(wal->fd, wal->pending, length);
+    if (out != (ssize_t)length) {
+        perror("write()");
+        return -1;
+    }
+
+    wal->unsynced += wal->count;
+    wal->count = 0;
+
+    if (wal->sync_every > 0 && wal->unsynced >= wal->sync_every) {
+        if (fdatasync(wal->fd) == -1) {
+            perror("fdatasync()");
+            return -1;
+        }
+
+        wal->unsynced = 0;
+    }
+
+    return 0;
+}
+
+int wal_reset(Wal *wal) {
+    if (wal == NULL) {
+        return 0;
+    }
+
+    // O_APPEND writes follow the new end of the file
+    if (ftruncate(wal->fd, 0) == -1) {
+        perror("ftruncate()");
+        return -1;
+    }
+
+    wal->unsynced = 0;
+
+    return 0;
+}
+
+int wal_rotate(Wal *wal, const char *old_path) {
+    if (wal == NULL) {
+        return 0;
+    }
+
+    if (wal_commit(wal) != 0) {
+        return -1;
+    }
+
+    // the records written so far keep their place in the old log
+    if (wal->unsynced > 0 && fdatasync(wal->fd) == -1) {
+        perror("fdatasync()");
+        return -1;
+    }
+
+    if (rename(wal->path, old_path) == -1) {
+        perror("rename()");
+        return -1;
+    }
+
+    int fd = open(wal->path, O_CREAT | O_RDWR | O_APPEND, 0666);
+    if (fd == -1) {
+        perror("open()");
+        rename(old_path, wal->path);
+        return -1;
+    }
+
+    close(wal->fd);
+    wal->fd = fd;
+    wal->unsynced = 0;
+
+    return 0;
+}
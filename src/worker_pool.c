@@ -0,0 +1,203 @@
+#include "worker_pool.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * @brief Pool of worker processes sharing one job queue
+ */
+typedef struct worker_pool {
+    unsigned size;          /**< Number of workers */
+    pid_t *workers;         /**< Process ID of each worker, 0 if not running */
+    int queue[2];           /**< Sending side [0] and receiving side [1] */
+    Job_Handler handler;    /**< Function that runs the jobs */
+    void *context;          /**< Passed to the handler */
+} Worker_Pool;
+
+static void run_worker(Worker_Pool *pool) {
+    char *job = (char *)malloc(POOL_JOB_SIZE);
+    if (job == NULL) {
+        _exit(1);
+    }
+
+    // only the parent sends jobs
+    close(pool->queue[0]);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec data = {.iov_base = job, .iov_len = POOL_JOB_SIZE};
+    struct msghdr message;
+    ssize_t out = 0;
+    int fd = -1;
+
+    while (1) {
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        // every message is a whole job, taken by a single worker
+        out = recvmsg(pool->queue[1], &message, 0);
+        if (out == -1 && errno == EINTR) {
+            continue;
+        }
+
+        // the queue was closed, the server is shutting down
+        if (out <= 0) {
+            break;
+        }
+
+        fd = -1;
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        if (header != NULL && header->cmsg_type == SCM_RIGHTS) {
+            memcpy(&fd, CMSG_DATA(header), sizeof(int));
+        }
+
+        pool->handler(pool->context, job, out, fd);
+
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    free(job);
+    _exit(0);
+}
+
+static int start_worker(Worker_Pool *pool, unsigned index) {
+    pid_t pid = fork();
+
+    switch (pid) {
+        case -1:
+            perror("fork()");
+            pool->workers[index] = 0;
+            return 1;
+        case 0:
+            run_worker(pool);
+            _exit(0);
+        default:
+            pool->workers[index] = pid;
+            break;
+    }
+
+    return 0;
+}
+
+Worker_Pool *pool_create(unsigned size, Job_Handler handler, void *context) {
+    if (size == 0 || handler == NULL) {
+        return NULL;
+    }
+
+    Worker_Pool *pool = (Worker_Pool *)calloc(1, sizeof(Worker_Pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->workers = (pid_t *)calloc(size, sizeof(pid_t));
+    if (pool->workers == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    // message boundaries are kept, so a job is never split between workers
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pool->queue) ==
+        -1) {
+        perror("socketpair()");
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+
+    pool->size = size;
+    pool->handler = handler;
+    pool->context = context;
+
+    for (unsigned i = 0; i < size; i++) {
+        if (start_worker(pool, i) != 0) {
+            pool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+int pool_submit(Worker_Pool *pool, const void *job, size_t size, int fd) {
+    if (pool == NULL || size > POOL_JOB_SIZE) {
+        return 1;
+    }
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec data = {.iov_base = (void *)job, .iov_len = size};
+    struct msghdr message;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+
+    // the worker gets its own copy of the descriptor
+    if (fd != -1) {
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &fd, sizeof(int));
+    }
+
+    ssize_t out = 0;
+    do {
+        out = sendmsg(pool->queue[0], &message, 0);
+    } while (out == -1 && errno == EINTR);
+
+    if (out == -1) {
+        perror("sendmsg()");
+        return 1;
+    }
+
+    return 0;
+}
+
+int pool_reap(Worker_Pool *pool, pid_t pid) {
+    if (pool == NULL) {
+        return 0;
+    }
+
+    for (unsigned i = 0; i < pool->size; i++) {
+        if (pool->workers[i] == pid) {
+            // a worker died, put another one in its place
+            printf("[SERVER INFO] worker %d exited, restarting it\n", pid);
+            start_worker(pool, i);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void pool_destroy(Worker_Pool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    // workers see the end of the queue once the jobs left are taken
+    close(pool->queue[0]);
+
+    for (unsigned i = 0; i < pool->size; i++) {
+        if (pool->workers[i] > 0) {
+            waitpid(pool->workers[i], NULL, 0);
+        }
+    }
+
+    close(pool->queue[1]);
+    free(pool->workers);
+    free(pool);
+}